@@ -0,0 +1,142 @@
+/* arena.h
+ * ls-fuse - ls -lR output mounter
+ *
+ * Copyright (C) 2013 Dmitry Podgorny <pasis.ua@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LS_FUSE_ARENA_H
+#define LS_FUSE_ARENA_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* chunks grow from the minimal to the maximal size twice at a time */
+#define ARENA_MIN_CHUNK 1024U
+#define ARENA_MAX_CHUNK (1024U * 1024U)
+/* enough for any field of lsnode_t */
+#define ARENA_ALIGN 8U
+
+typedef struct _arena_chunk_t {
+	struct _arena_chunk_t *next;
+	size_t used;
+	size_t size;
+	char data[];
+} arena_chunk_t;
+
+/*
+ * Bump allocator, objects are released all together with the arena.
+ * Zeroed arena is empty. An arena must be used by a single thread at a time.
+ */
+typedef struct {
+	/* the chunk objects are allocated from, it is the head of the list */
+	arena_chunk_t *chunk;
+	/* total size of the chunks */
+	size_t mem;
+} arena_t;
+
+static inline size_t arena_pad(const arena_chunk_t *chunk, size_t align)
+{
+	return (size_t)(-(uintptr_t)&chunk->data[chunk->used] & (align - 1));
+}
+
+/* align must be power of 2 */
+static inline void *arena_alloc_align(arena_t *arena, size_t size,
+				      size_t align)
+{
+	arena_chunk_t *chunk = arena->chunk;
+	size_t csize;
+	void *p;
+
+	if (chunk == NULL ||
+	    chunk->size - chunk->used < arena_pad(chunk, align) + size) {
+		csize = chunk == NULL ? ARENA_MIN_CHUNK : chunk->size * 2;
+		if (csize > ARENA_MAX_CHUNK) {
+			csize = ARENA_MAX_CHUNK;
+		}
+		if (csize < size + align) {
+			csize = size + align;
+		}
+		chunk = (arena_chunk_t *)malloc(sizeof(*chunk) + csize);
+		if (chunk == NULL) {
+			return NULL;
+		}
+		chunk->next = arena->chunk;
+		chunk->used = 0;
+		chunk->size = csize;
+		arena->chunk = chunk;
+		arena->mem += csize;
+	}
+	chunk->used += arena_pad(chunk, align);
+	p = &chunk->data[chunk->used];
+	chunk->used += size;
+
+	return p;
+}
+
+static inline void *arena_alloc(arena_t *arena, size_t size)
+{
+	return arena_alloc_align(arena, size, ARENA_ALIGN);
+}
+
+/* s is not required to be null-terminated, the copy is */
+static inline char *arena_strndup(arena_t *arena, const char *s, size_t len)
+{
+	char *p = (char *)arena_alloc_align(arena, len + 1, 1);
+
+	if (p != NULL) {
+		memcpy(p, s, len);
+		p[len] = '\0';
+	}
+
+	return p;
+}
+
+/* moves all objects of src to dst, src becomes empty */
+static inline void arena_move(arena_t *dst, arena_t *src)
+{
+	arena_chunk_t *tail = src->chunk;
+
+	if (tail == NULL) {
+		return;
+	}
+	while (tail->next != NULL) {
+		tail = tail->next;
+	}
+	/* the current chunk of dst remains the head */
+	if (dst->chunk != NULL) {
+		tail->next = dst->chunk->next;
+		dst->chunk->next = src->chunk;
+	} else {
+		dst->chunk = src->chunk;
+	}
+	dst->mem += src->mem;
+	memset(src, 0, sizeof(*src));
+}
+
+static inline void arena_destroy(arena_t *arena)
+{
+	arena_chunk_t *chunk;
+
+	while (arena->chunk != NULL) {
+		chunk = arena->chunk;
+		arena->chunk = chunk->next;
+		free(chunk);
+	}
+	arena->mem = 0;
+}
+
+#endif /* LS_FUSE_ARENA_H */
@@ -0,0 +1,574 @@
+/* decomp.c
+ * ls-fuse - ls -lR output mounter
+ *
+ * Copyright (C) 2013 Dmitry Podgorny <pasis.ua@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <sys/types.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#include <assert.h>
+#include <errno.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+#ifdef HAVE_BZLIB
+#include <bzlib.h>
+#endif
+#ifdef HAVE_LZMA
+#include <lzma.h>
+#endif
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+#include "decomp.h"
+#include "tools.h"
+#include "log.h"
+
+#define IN_BUFSIZ (1024 * 1024)
+#define BLOCK_SIZE (1024 * 1024)
+/* number of decompressed blocks which may wait for the parser */
+#define QUEUE_LEN 4
+
+/* returned by step() when a compressed stream ends */
+#define STREAM_END 1
+
+typedef struct decomp decomp_t;
+
+struct decomp_ops {
+	const char *name;
+	int (*init)(decomp_t *);
+	/*
+	 * Decompresses input from d->in to out. Sets number of produced bytes
+	 * to *len. Returns 0, STREAM_END or -errno.
+	 */
+	int (*step)(decomp_t *d, char *out, size_t size, size_t *len);
+	void (*end)(decomp_t *);
+};
+
+struct decomp {
+	const struct decomp_ops *ops;
+	int fd;
+	char *in;
+	size_t in_pos;
+	size_t in_len;
+	bool eof;
+	bool done;
+	union {
+#ifdef HAVE_ZLIB
+		z_stream z;
+#endif
+#ifdef HAVE_BZLIB
+		bz_stream bz;
+#endif
+#ifdef HAVE_LZMA
+		lzma_stream xz;
+#endif
+#ifdef HAVE_ZSTD
+		ZSTD_DStream *zstd;
+#endif
+		int dummy;
+	} s;
+};
+
+typedef struct {
+	char *buf;
+	size_t len;
+} block_t;
+
+/* blocks go from the decompressing thread to the parser in a ring */
+typedef struct {
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	block_t blocks[QUEUE_LEN];
+	/* number of filled and consumed blocks */
+	size_t head;
+	size_t tail;
+	bool done;
+	bool abort;
+	int err;
+	decomp_t *d;
+} queue_t;
+
+#ifdef HAVE_ZLIB
+static int gzip_init(decomp_t *d)
+{
+	memset(&d->s.z, 0, sizeof(d->s.z));
+	/* 32 enables gzip header detection */
+	return inflateInit2(&d->s.z, 15 + 32) == Z_OK ? 0 : -ENOMEM;
+}
+
+static int gzip_step(decomp_t *d, char *out, size_t size, size_t *len)
+{
+	z_stream *z = &d->s.z;
+	uInt in_len = (uInt)MIN(d->in_len - d->in_pos, (size_t)UINT_MAX);
+	int ret;
+
+	z->next_in = (Bytef *)&d->in[d->in_pos];
+	z->avail_in = in_len;
+	z->next_out = (Bytef *)out;
+	z->avail_out = (uInt)MIN(size, (size_t)UINT_MAX);
+	ret = inflate(z, Z_NO_FLUSH);
+	*len = (size_t)((char *)z->next_out - out);
+	d->in_pos += in_len - z->avail_in;
+
+	if (ret == Z_STREAM_END) {
+		/* the next gzip member may follow */
+		return inflateReset(z) == Z_OK ? STREAM_END : -EIO;
+	}
+	if (ret != Z_OK && ret != Z_BUF_ERROR) {
+		LOGE("gzip: %s", z->msg ? z->msg : "corrupted data");
+		return -EIO;
+	}
+	return 0;
+}
+
+static void gzip_end(decomp_t *d)
+{
+	inflateEnd(&d->s.z);
+}
+#endif /* HAVE_ZLIB */
+
+#ifdef HAVE_BZLIB
+static int bzip2_init(decomp_t *d)
+{
+	memset(&d->s.bz, 0, sizeof(d->s.bz));
+	return BZ2_bzDecompressInit(&d->s.bz, 0, 0) == BZ_OK ? 0 : -ENOMEM;
+}
+
+static int bzip2_step(decomp_t *d, char *out, size_t size, size_t *len)
+{
+	bz_stream *bz = &d->s.bz;
+	unsigned int in_len;
+	int ret;
+
+	in_len = (unsigned int)MIN(d->in_len - d->in_pos, (size_t)UINT_MAX);
+	bz->next_in = &d->in[d->in_pos];
+	bz->avail_in = in_len;
+	bz->next_out = out;
+	bz->avail_out = (unsigned int)MIN(size, (size_t)UINT_MAX);
+	ret = BZ2_bzDecompress(bz);
+	*len = (size_t)(bz->next_out - out);
+	d->in_pos += in_len - bz->avail_in;
+
+	if (ret == BZ_STREAM_END) {
+		/* parallel bzip2 tools write several streams */
+		BZ2_bzDecompressEnd(bz);
+		return bzip2_init(d) == 0 ? STREAM_END : -ENOMEM;
+	}
+	if (ret != BZ_OK) {
+		LOGE("bzip2: corrupted data (%d)", ret);
+		return -EIO;
+	}
+	return 0;
+}
+
+static void bzip2_end(decomp_t *d)
+{
+	BZ2_bzDecompressEnd(&d->s.bz);
+}
+#endif /* HAVE_BZLIB */
+
+#ifdef HAVE_LZMA
+static int xz_init(decomp_t *d)
+{
+	lzma_stream init = LZMA_STREAM_INIT;
+
+	d->s.xz = init;
+	return lzma_stream_decoder(&d->s.xz, UINT64_MAX, LZMA_CONCATENATED) ==
+	       LZMA_OK ? 0 : -ENOMEM;
+}
+
+static int xz_step(decomp_t *d, char *out, size_t size, size_t *len)
+{
+	lzma_stream *xz = &d->s.xz;
+	size_t in_len = d->in_len - d->in_pos;
+	lzma_ret ret;
+
+	xz->next_in = (const uint8_t *)&d->in[d->in_pos];
+	xz->avail_in = in_len;
+	xz->next_out = (uint8_t *)out;
+	xz->avail_out = size;
+	/* concatenated streams end only when the decoder is told so */
+	ret = lzma_code(xz, d->eof ? LZMA_FINISH : LZMA_RUN);
+	*len = size - xz->avail_out;
+	d->in_pos += in_len - xz->avail_in;
+
+	if (ret == LZMA_STREAM_END) {
+		return STREAM_END;
+	}
+	if (ret != LZMA_OK && ret != LZMA_BUF_ERROR) {
+		LOGE("xz: corrupted data (%d)", (int)ret);
+		return -EIO;
+	}
+	return 0;
+}
+
+static void xz_end(decomp_t *d)
+{
+	lzma_end(&d->s.xz);
+}
+#endif /* HAVE_LZMA */
+
+#ifdef HAVE_ZSTD
+static int zstd_init(decomp_t *d)
+{
+	d->s.zstd = ZSTD_createDStream();
+	if (!d->s.zstd) {
+		return -ENOMEM;
+	}
+	if (ZSTD_isError(ZSTD_initDStream(d->s.zstd))) {
+		ZSTD_freeDStream(d->s.zstd);
+		return -ENOMEM;
+	}
+	return 0;
+}
+
+static int zstd_step(decomp_t *d, char *out, size_t size, size_t *len)
+{
+	ZSTD_inBuffer in = {
+		.src = &d->in[d->in_pos],
+		.size = d->in_len - d->in_pos,
+		.pos = 0,
+	};
+	ZSTD_outBuffer o = {
+		.dst = out,
+		.size = size,
+		.pos = 0,
+	};
+	size_t ret;
+
+	ret = ZSTD_decompressStream(d->s.zstd, &o, &in);
+	*len = o.pos;
+	d->in_pos += in.pos;
+
+	if (ZSTD_isError(ret)) {
+		LOGE("zstd: %s", ZSTD_getErrorName(ret));
+		return -EIO;
+	}
+	/* 0 means the frame is complete, the next one may follow */
+	return ret == 0 ? STREAM_END : 0;
+}
+
+static void zstd_end(decomp_t *d)
+{
+	ZSTD_freeDStream(d->s.zstd);
+}
+#endif /* HAVE_ZSTD */
+
+static const struct decomp_ops decomp_tbl[] = {
+	[DECOMP_GZIP] = {
+		.name = "gzip",
+#ifdef HAVE_ZLIB
+		.init = gzip_init,
+		.step = gzip_step,
+		.end = gzip_end,
+#endif
+	},
+	[DECOMP_BZIP2] = {
+		.name = "bzip2",
+#ifdef HAVE_BZLIB
+		.init = bzip2_init,
+		.step = bzip2_step,
+		.end = bzip2_end,
+#endif
+	},
+	[DECOMP_XZ] = {
+		.name = "xz",
+#ifdef HAVE_LZMA
+		.init = xz_init,
+		.step = xz_step,
+		.end = xz_end,
+#endif
+	},
+	[DECOMP_ZSTD] = {
+		.name = "zstd",
+#ifdef HAVE_ZSTD
+		.init = zstd_init,
+		.step = zstd_step,
+		.end = zstd_end,
+#endif
+	},
+};
+
+int decomp_detect(const char *buf, size_t size)
+{
+	static const struct {
+		int type;
+		size_t len;
+		const char *magic;
+	} magic_tbl[] = {
+		{DECOMP_GZIP, 2, "\x1f\x8b"},
+		{DECOMP_BZIP2, 3, "BZh"},
+		{DECOMP_XZ, 6, "\xfd" "7zXZ\0"},
+		{DECOMP_ZSTD, 4, "\x28\xb5\x2f\xfd"},
+	};
+	size_t i;
+
+	for (i = 0; i < ARRAY_SIZE(magic_tbl); i++) {
+		if (size >= magic_tbl[i].len &&
+		    memcmp(buf, magic_tbl[i].magic, magic_tbl[i].len) == 0) {
+			return magic_tbl[i].type;
+		}
+	}
+
+	return DECOMP_NONE;
+}
+
+ssize_t decomp_read_head(int fd, char *buf, size_t size)
+{
+	size_t len = 0;
+	ssize_t ret;
+
+	while (len < DECOMP_MAGIC_LEN && len < size) {
+		ret = read(fd, buf + len, size - len);
+		if (ret < 0 && errno == EINTR) {
+			continue;
+		}
+		if (ret < 0) {
+			LOGE("read: %s", strerror(errno));
+			return -errno;
+		}
+		if (ret == 0) {
+			break;
+		}
+		len += (size_t)ret;
+	}
+
+	return (ssize_t)len;
+}
+
+static int read_in(decomp_t *d)
+{
+	ssize_t ret;
+
+	do {
+		ret = read(d->fd, d->in, IN_BUFSIZ);
+	} while (ret < 0 && errno == EINTR);
+
+	if (ret < 0) {
+		LOGE("read: %s", strerror(errno));
+		return -errno;
+	}
+	d->in_pos = 0;
+	d->in_len = (size_t)ret;
+	d->eof = ret == 0;
+
+	return 0;
+}
+
+/* fills out with decompressed data, *len < size only at the end */
+static int decomp_fill(decomp_t *d, char *out, size_t size, size_t *len)
+{
+	size_t n;
+	int err;
+
+	*len = 0;
+	while (*len < size && !d->done) {
+		if (d->in_pos == d->in_len && !d->eof) {
+			err = read_in(d);
+			if (err != 0) {
+				return err;
+			}
+		}
+
+		err = d->ops->step(d, out + *len, size - *len, &n);
+		if (err < 0) {
+			return err;
+		}
+		*len += n;
+
+		if (err == STREAM_END) {
+			if (d->in_pos == d->in_len && !d->eof) {
+				err = read_in(d);
+				if (err != 0) {
+					return err;
+				}
+			}
+			/* otherwise another stream follows */
+			d->done = d->in_pos == d->in_len;
+		} else if (n == 0 && d->in_pos == d->in_len && d->eof) {
+			LOGE("%s: unexpected end of data", d->ops->name);
+			return -EIO;
+		}
+	}
+
+	return 0;
+}
+
+static void *decomp_thread(void *arg)
+{
+	queue_t *q = (queue_t *)arg;
+	block_t *block;
+	int err = 0;
+
+	while (1) {
+		pthread_mutex_lock(&q->lock);
+		while (q->head - q->tail == QUEUE_LEN && !q->abort) {
+			pthread_cond_wait(&q->cond, &q->lock);
+		}
+		if (q->abort) {
+			pthread_mutex_unlock(&q->lock);
+			break;
+		}
+		pthread_mutex_unlock(&q->lock);
+
+		/* the parser doesn't touch blocks behind the head */
+		block = &q->blocks[q->head % QUEUE_LEN];
+		err = decomp_fill(q->d, block->buf, BLOCK_SIZE, &block->len);
+		if (err != 0 || block->len == 0) {
+			break;
+		}
+
+		pthread_mutex_lock(&q->lock);
+		++q->head;
+		pthread_cond_broadcast(&q->cond);
+		pthread_mutex_unlock(&q->lock);
+	}
+
+	pthread_mutex_lock(&q->lock);
+	q->done = true;
+	q->err = err;
+	pthread_cond_broadcast(&q->cond);
+	pthread_mutex_unlock(&q->lock);
+
+	return NULL;
+}
+
+/* passes blocks from the queue to cb until the thread finishes */
+static int queue_consume(queue_t *q, decomp_cb_t cb, void *arg)
+{
+	block_t *block;
+	int err = 0;
+
+	while (1) {
+		pthread_mutex_lock(&q->lock);
+		while (q->head == q->tail && !q->done) {
+			pthread_cond_wait(&q->cond, &q->lock);
+		}
+		if (q->head == q->tail) {
+			err = q->err;
+			pthread_mutex_unlock(&q->lock);
+			break;
+		}
+		pthread_mutex_unlock(&q->lock);
+
+		block = &q->blocks[q->tail % QUEUE_LEN];
+		err = cb(arg, block->buf, block->len);
+
+		pthread_mutex_lock(&q->lock);
+		++q->tail;
+		if (err != 0) {
+			q->abort = true;
+		}
+		pthread_cond_broadcast(&q->cond);
+		pthread_mutex_unlock(&q->lock);
+		if (err != 0) {
+			break;
+		}
+	}
+
+	return err;
+}
+
+/* fallback when a thread can't be created */
+static int decomp_inline(decomp_t *d, char *buf, decomp_cb_t cb, void *arg)
+{
+	size_t len;
+	int err;
+
+	while (1) {
+		err = decomp_fill(d, buf, BLOCK_SIZE, &len);
+		if (err != 0 || len == 0) {
+			return err;
+		}
+		err = cb(arg, buf, len);
+		if (err != 0) {
+			return err;
+		}
+	}
+}
+
+int decomp_parse(int fd, int type, const char *head, size_t head_len,
+		 decomp_cb_t cb, void *arg)
+{
+	decomp_t d;
+	queue_t q;
+	pthread_t thread;
+	char *blocks;
+	size_t i;
+	int err;
+
+	assert(type > DECOMP_NONE && type < (int)ARRAY_SIZE(decomp_tbl));
+	assert(head_len <= IN_BUFSIZ);
+
+	memset(&d, 0, sizeof(d));
+	d.ops = &decomp_tbl[type];
+	if (!d.ops->init) {
+		LOGE("%s support isn't compiled in", d.ops->name);
+		return -ENOTSUP;
+	}
+
+	d.fd = fd;
+	d.in = (char *)malloc(IN_BUFSIZ);
+	blocks = (char *)malloc((size_t)QUEUE_LEN * BLOCK_SIZE);
+	if (!d.in || !blocks) {
+		err = -ENOMEM;
+		goto out_free;
+	}
+	memcpy(d.in, head, head_len);
+	d.in_len = head_len;
+
+	err = d.ops->init(&d);
+	if (err != 0) {
+		goto out_free;
+	}
+
+	memset(&q, 0, sizeof(q));
+	for (i = 0; i < QUEUE_LEN; i++) {
+		q.blocks[i].buf = &blocks[i * BLOCK_SIZE];
+	}
+	q.d = &d;
+	pthread_mutex_init(&q.lock, NULL);
+	pthread_cond_init(&q.cond, NULL);
+
+	if (pthread_create(&thread, NULL, decomp_thread, &q) == 0) {
+		err = queue_consume(&q, cb, arg);
+		pthread_join(thread, NULL);
+	} else {
+		LOGD("can't create a thread, decompressing inline");
+		err = decomp_inline(&d, blocks, cb, arg);
+	}
+
+	pthread_cond_destroy(&q.cond);
+	pthread_mutex_destroy(&q.lock);
+	d.ops->end(&d);
+
+out_free:
+	free(blocks);
+	free(d.in);
+
+	return err;
+}
@@ -0,0 +1,57 @@
+/* decomp.h
+ * ls-fuse - ls -lR output mounter
+ *
+ * Copyright (C) 2013 Dmitry Podgorny <pasis.ua@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LS_FUSE_DECOMP_H
+#define LS_FUSE_DECOMP_H
+
+#include <sys/types.h>
+
+/* number of bytes enough to detect any supported format */
+#define DECOMP_MAGIC_LEN 6
+
+enum decomp_type {
+	DECOMP_NONE = 0,
+	DECOMP_GZIP,
+	DECOMP_BZIP2,
+	DECOMP_XZ,
+	DECOMP_ZSTD,
+};
+
+/* called for every block of decompressed data, size is never 0 */
+typedef int (*decomp_cb_t)(void *arg, const char *buf, size_t size);
+
+/* returns one of decomp_type values by magic bytes at the start of buf */
+int decomp_detect(const char *buf, size_t size);
+
+/*
+ * Reads from fd until DECOMP_MAGIC_LEN bytes are read or EOF is reached.
+ * Returns number of read bytes or -errno.
+ */
+ssize_t decomp_read_head(int fd, char *buf, size_t size);
+
+/*
+ * Decompresses stream of the type and passes the result to cb. head contains
+ * data which is already read from fd. Decompression runs on a separate thread
+ * and is stopped when cb returns non-zero value. Returns 0 on success, error
+ * of cb or -errno.
+ */
+int decomp_parse(int fd, int type, const char *head, size_t head_len,
+		 decomp_cb_t cb, void *arg);
+
+#endif /* LS_FUSE_DECOMP_H */
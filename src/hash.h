@@ -21,103 +21,145 @@
 #define LS_FUSE_HASH_H
 
 #include <assert.h>
-#include <limits.h>
+#include <errno.h>
+#include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
 
-#if defined(_POSIX_LOGIN_NAME_MAX) && _POSIX_LOGIN_NAME_MAX > 32
-#define MAX_KEY_LEN _POSIX_LOGIN_NAME_MAX
-#else
-#define MAX_KEY_LEN 32
-#endif
+#include "arena.h"
 
-#define HASH_TBL_SIZE 128U
-#if HASH_TBL_SIZE & ~(HASH_TBL_SIZE - 1U) != HASH_TBL_SIZE
-#error HASH_TBL_SIZE must be power of 2
-#endif
-#define HASH_TBL_MASK (HASH_TBL_SIZE - 1)
+/* initial number of slots, must be power of 2 */
+#define HASH_TBL_MIN_SIZE 64U
 
-typedef struct _hash_t {
-	char key[MAX_KEY_LEN];
+typedef struct {
+	/* NULL for an empty slot */
+	const char *key;
+	size_t len;
+	uint32_t hash;
 	long value;
-	struct _hash_t *next;
 } hash_t;
 
-typedef hash_t hash_tbl_t[HASH_TBL_SIZE];
-
-static int hash_func(const char *s)
+/*
+ * Open addressing table with linear probing. It grows when it becomes half
+ * full. Keys of any length are copied to the arena. Zeroed table is empty.
+ */
+typedef struct {
+	hash_t *slots;
+	size_t size;
+	size_t count;
+	arena_t arena;
+} hash_tbl_t;
+
+/* FNV-1a */
+static inline uint32_t hash_func(const char *s, size_t len)
 {
-	int h = 0;
+	uint32_t h = 2166136261U;
 
 	assert(s != NULL);
-	while (*s) {
-		h = (h + *s) & HASH_TBL_MASK;
+	while (len > 0) {
+		h = (h ^ (unsigned char)*s) * 16777619U;
 		++s;
+		--len;
 	}
 
 	return h;
 }
 
-static inline void hash_add(hash_tbl_t tbl, const char *key, long value)
+static inline hash_t *hash_find(const hash_tbl_t *tbl, const char *key,
+				size_t len, uint32_t h)
 {
-	int i;
-	hash_t *h;
-
-	i = hash_func(key);
-	if (*tbl[i].key == 0) {
-		strncpy(tbl[i].key, key, MAX_KEY_LEN);
-		tbl[i].key[MAX_KEY_LEN - 1] = '\0';
-		tbl[i].value = value;
-
-	} else {
-		h = &tbl[i];
-		while (h->next) {
-			h = h->next;
+	size_t mask = tbl->size - 1;
+	size_t i = h & mask;
+	hash_t *slot;
+
+	while (1) {
+		slot = &tbl->slots[i];
+		if (slot->key == NULL || (slot->hash == h && slot->len == len &&
+					  memcmp(slot->key, key, len) == 0)) {
+			return slot;
 		}
-		h->next = (hash_t *)malloc(sizeof(hash_t));
-		h = h->next;
-		memset(h, 0, sizeof(hash_t));
-		/* h->key will be null-terminated as h->key[MAX_KEY_LEN] is
-		 * set to 0 by memset */
-		strncpy(h->key, key, MAX_KEY_LEN - 1);
-		h->value = value;
+		i = (i + 1) & mask;
 	}
 }
 
-static inline long hash_get(const hash_tbl_t tbl, const char *key)
+static inline int hash_grow(hash_tbl_t *tbl)
 {
-	int i;
-	const hash_t *h;
+	size_t size = tbl->size ? tbl->size * 2 : HASH_TBL_MIN_SIZE;
+	hash_tbl_t tmp = *tbl;
+	hash_t *slot;
+	size_t i;
+
+	tmp.slots = (hash_t *)calloc(size, sizeof(hash_t));
+	if (tmp.slots == NULL) {
+		return -ENOMEM;
+	}
+	tmp.size = size;
+
+	for (i = 0; i < tbl->size; i++) {
+		if (tbl->slots[i].key != NULL) {
+			slot = hash_find(&tmp, tbl->slots[i].key,
+					 tbl->slots[i].len,
+					 tbl->slots[i].hash);
+			*slot = tbl->slots[i];
+		}
+	}
+	free(tbl->slots);
+	*tbl = tmp;
 
-	i = hash_func(key);
-	if (*tbl[i].key == 0) {
-		return -1;
+	return 0;
+}
+
+/* key is not required to be null-terminated */
+static inline int hash_add(hash_tbl_t *tbl, const char *key, size_t len,
+			   long value)
+{
+	uint32_t h = hash_func(key, len);
+	hash_t *slot;
+
+	if (tbl->count + 1 > tbl->size / 2 && hash_grow(tbl) != 0) {
+		return -ENOMEM;
 	}
 
-	h = &tbl[i];
-	while (h) {
-		if (strncmp(h->key, key, MAX_KEY_LEN) == 0) {
-			return h->value;
+	slot = hash_find(tbl, key, len, h);
+	if (slot->key == NULL) {
+		slot->key = arena_strndup(&tbl->arena, key, len);
+		if (slot->key == NULL) {
+			return -ENOMEM;
 		}
-		h = h->next;
+		slot->len = len;
+		slot->hash = h;
+		++tbl->count;
 	}
+	slot->value = value;
 
-	return -1;
+	return 0;
 }
 
-static inline void hash_destroy(hash_tbl_t tbl)
+static inline long hash_get(const hash_tbl_t *tbl, const char *key,
+			    size_t len)
 {
-	unsigned int i;
-	hash_t *h;
-	hash_t *next;
-
-	for (i = 0; i < HASH_TBL_SIZE; i++) {
-		h = tbl[i].next;
-		while (h != NULL) {
-			next = h->next;
-			free(h);
-			h = next;
-		}
+	const hash_t *slot;
+
+	if (tbl->count == 0) {
+		return -1;
 	}
+
+	slot = hash_find(tbl, key, len, hash_func(key, len));
+
+	return slot->key != NULL ? slot->value : -1;
+}
+
+/* bytes of slots and keys */
+static inline size_t hash_mem(const hash_tbl_t *tbl)
+{
+	return tbl->size * sizeof(hash_t) + tbl->arena.mem;
+}
+
+static inline void hash_destroy(hash_tbl_t *tbl)
+{
+	arena_destroy(&tbl->arena);
+	free(tbl->slots);
+	memset(tbl, 0, sizeof(*tbl));
 }
 
 #endif /* LS_FUSE_HASH_H */
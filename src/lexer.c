@@ -0,0 +1,403 @@
+/* lexer.c
+ * ls-fuse - ls -lR output mounter
+ *
+ * Copyright (C) 2013 Dmitry Podgorny <pasis.ua@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <sys/types.h>
+
+#include <assert.h>
+#include <errno.h>
+#include <regex.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "lexer.h"
+#include "scan.h"
+#include "tools.h"
+
+/*
+ * The longest layout is ls -l with "major, minor" in place of size:
+ * mode, links, owner, group, major, minor, month, day, time and name.
+ */
+#define MAX_TOKENS 10
+
+typedef struct {
+	size_t so;
+	size_t eo;
+} token_t;
+
+/* bitmap of spaces in a window of the line */
+typedef struct {
+	const char *s;
+	size_t len;
+	size_t base;
+	uint64_t mask;
+} space_map_t;
+
+typedef bool (*lex_func_t)(const char *, size_t, const token_t *, size_t,
+			   bool, regmatch_t []);
+
+static inline bool is_digit(char c)
+{
+	return c >= '0' && c <= '9';
+}
+
+static void space_map_init(space_map_t *map, const char *s, size_t len)
+{
+	map->s = s;
+	map->len = len;
+	map->base = 0;
+	map->mask = scan_spaces(s, len);
+}
+
+/*
+ * Returns offset of the first space (or non-space if space is false) at i or
+ * later. Returns length of the line if there is no such byte. Offsets must
+ * not decrease between calls.
+ */
+static size_t space_map_find(space_map_t *map, size_t i, bool space)
+{
+	uint64_t m;
+
+	while (i < map->len) {
+		if (i - map->base >= SCAN_MASK_BITS) {
+			map->base = i;
+			map->mask = scan_spaces(&map->s[i], map->len - i);
+		}
+		m = space ? map->mask : ~map->mask;
+		m >>= i - map->base;
+		if (m != 0) {
+			i += __builtin_ctzll(m);
+			return i < map->len ? i : map->len;
+		}
+		i = map->base + SCAN_MASK_BITS;
+	}
+	return map->len;
+}
+
+static bool is_digits(const char *s, const token_t *t)
+{
+	size_t i;
+
+	for (i = t->so; i < t->eo; i++) {
+		if (!is_digit(s[i])) {
+			return false;
+		}
+	}
+	return t->eo > t->so;
+}
+
+/* [0-9A-Za-z_-]+ */
+static bool is_usr(const char *s, const token_t *t)
+{
+	size_t i;
+	char c;
+
+	for (i = t->so; i < t->eo; i++) {
+		c = s[i];
+		if (!is_digit(c) && !(c >= 'a' && c <= 'z') &&
+		    !(c >= 'A' && c <= 'Z') && c != '_' && c != '-') {
+			return false;
+		}
+	}
+	return true;
+}
+
+/* [0-9a-zA-Z:_.-]+ */
+static bool is_selinux(const char *s, const token_t *t)
+{
+	size_t i;
+	char c;
+
+	for (i = t->so; i < t->eo; i++) {
+		c = s[i];
+		if (!is_digit(c) && !(c >= 'a' && c <= 'z') &&
+		    !(c >= 'A' && c <= 'Z') && c != ':' && c != '_' &&
+		    c != '.' && c != '-') {
+			return false;
+		}
+	}
+	return true;
+}
+
+/* [-bcdlps][-rwxsStT]{9,9}[t@+.]? */
+static bool is_mode(const char *s, const token_t *t)
+{
+	size_t len = t->eo - t->so;
+	size_t i;
+
+	if (len != 10 && len != 11) {
+		return false;
+	}
+	if (strchr("-bcdlps", s[t->so]) == NULL) {
+		return false;
+	}
+	for (i = t->so + 1; i < t->so + 10; i++) {
+		if (strchr("-rwxsStT", s[i]) == NULL) {
+			return false;
+		}
+	}
+	return len == 10 || strchr("t@+.", s[t->so + 10]) != NULL;
+}
+
+/* [1-3]?[0-9] */
+static bool is_day(const char *s, const token_t *t)
+{
+	size_t len = t->eo - t->so;
+
+	if (len == 1) {
+		return is_digit(s[t->so]);
+	}
+	return len == 2 && s[t->so] >= '1' && s[t->so] <= '3' &&
+	       is_digit(s[t->so + 1]);
+}
+
+/* [0-9]{4,4} or [0-2]?[0-9]:[0-5][0-9] */
+static bool is_year_or_time(const char *s, const token_t *t)
+{
+	const char *p = &s[t->so];
+	size_t len = t->eo - t->so;
+
+	if (len == 4 && is_digits(s, t)) {
+		return true;
+	}
+	if (len == 5 && p[0] >= '0' && p[0] <= '2') {
+		++p;
+		--len;
+	}
+	return len == 4 && is_digit(p[0]) && p[1] == ':' &&
+	       p[2] >= '0' && p[2] <= '5' && is_digit(p[3]);
+}
+
+/* [0-9]{4,4}-[0-9]{2,2}-[0-9]{2,2} */
+static bool is_date_toolbox(const char *s, const token_t *t)
+{
+	const char *p = &s[t->so];
+
+	return t->eo - t->so == 10 && is_digit(p[0]) && is_digit(p[1]) &&
+	       is_digit(p[2]) && is_digit(p[3]) && p[4] == '-' &&
+	       is_digit(p[5]) && is_digit(p[6]) && p[7] == '-' &&
+	       is_digit(p[8]) && is_digit(p[9]);
+}
+
+/* [0-2][0-9]:[0-5][0-9] */
+static bool is_time_toolbox(const char *s, const token_t *t)
+{
+	const char *p = &s[t->so];
+
+	return t->eo - t->so == 5 && p[0] >= '0' && p[0] <= '2' &&
+	       is_digit(p[1]) && p[2] == ':' && p[3] >= '0' && p[3] <= '5' &&
+	       is_digit(p[4]);
+}
+
+/*
+ * Size is either a number or "major, minor" for device files. Returns number
+ * of tokens the size occupies or 0 if tokens don't look like a size.
+ */
+static size_t lex_size(const char *s, const token_t *t, size_t ntok,
+		       regmatch_t *m)
+{
+	token_t major;
+
+	if (ntok < 1) {
+		return 0;
+	}
+	if (is_digits(s, &t[0])) {
+		m->rm_so = t[0].so;
+		m->rm_eo = t[0].eo;
+		return 1;
+	}
+
+	major.so = t[0].so;
+	major.eo = t[0].eo - 1;
+	if (ntok < 2 || s[major.eo] != ',' || !is_digits(s, &major) ||
+	    !is_digits(s, &t[1])) {
+		return 0;
+	}
+	m->rm_so = t[0].so;
+	m->rm_eo = t[1].eo;
+	return 2;
+}
+
+static void set_match(regmatch_t *m, const token_t *t)
+{
+	m->rm_so = t->so;
+	m->rm_eo = t->eo;
+}
+
+static void set_mode_match(regmatch_t match[], const token_t *t)
+{
+	/* file type and rwx part are separate fields */
+	match[1].rm_so = t->so;
+	match[1].rm_eo = t->so + 1;
+	match[2].rm_so = t->so + 1;
+	match[2].rm_eo = t->so + 10;
+}
+
+static bool lex_l(const char *s, size_t len, const token_t *t, size_t ntok,
+		  bool has_bs, regmatch_t match[])
+{
+	size_t i;
+	size_t n;
+
+	(void)has_bs;
+
+	if (ntok < 9 || !is_digits(s, &t[1]) || !is_usr(s, &t[2]) ||
+	    !is_usr(s, &t[3])) {
+		return false;
+	}
+	n = lex_size(s, &t[4], ntok - 4, &match[5]);
+	i = 4 + n;
+	if (n == 0 || ntok < i + 4 || !is_day(s, &t[i + 1]) ||
+	    !is_year_or_time(s, &t[i + 2])) {
+		return false;
+	}
+
+	set_mode_match(match, &t[0]);
+	set_match(&match[3], &t[2]);
+	set_match(&match[4], &t[3]);
+	set_match(&match[6], &t[i]);
+	match[7].rm_so = t[i + 1].so;
+	match[7].rm_eo = t[i + 2].eo;
+	match[8].rm_so = t[i + 3].so;
+	match[8].rm_eo = len;
+
+	return true;
+}
+
+static bool lex_toolbox(const char *s, size_t len, const token_t *t,
+			size_t ntok, bool has_bs, regmatch_t match[])
+{
+	size_t i;
+
+	(void)has_bs;
+
+	if (ntok < 6 || !is_usr(s, &t[1]) || !is_usr(s, &t[2])) {
+		return false;
+	}
+	i = 3 + lex_size(s, &t[3], ntok - 3, &match[5]);
+	if (i == 3) {
+		/* directories have a gap instead of size */
+		if (t[3].so - t[2].eo < 3) {
+			return false;
+		}
+		match[5].rm_so = -1;
+		match[5].rm_eo = -1;
+	}
+	if (ntok < i + 3 || !is_date_toolbox(s, &t[i]) ||
+	    !is_time_toolbox(s, &t[i + 1])) {
+		return false;
+	}
+
+	set_mode_match(match, &t[0]);
+	set_match(&match[3], &t[1]);
+	set_match(&match[4], &t[2]);
+	set_match(&match[6], &t[i]);
+	set_match(&match[7], &t[i + 1]);
+	match[8].rm_so = t[i + 2].so;
+	match[8].rm_eo = len;
+
+	return true;
+}
+
+static bool lex_z(const char *s, size_t len, const token_t *t, size_t ntok,
+		  bool has_bs, regmatch_t match[])
+{
+	/* ls -Z doesn't print block size */
+	if (has_bs || ntok < 5 || !is_usr(s, &t[1]) || !is_usr(s, &t[2]) ||
+	    !is_selinux(s, &t[3])) {
+		return false;
+	}
+
+	set_mode_match(match, &t[0]);
+	set_match(&match[3], &t[1]);
+	set_match(&match[4], &t[2]);
+	set_match(&match[5], &t[3]);
+	match[6].rm_so = t[4].so;
+	match[6].rm_eo = len;
+
+	return true;
+}
+
+static const lex_func_t lex_tbl[LS_FMT_NUM] = {
+	[LS_FMT_L] = lex_l,
+	[LS_FMT_TOOLBOX] = lex_toolbox,
+	[LS_FMT_Z] = lex_z,
+};
+
+int lex_line(const char *s, size_t len, regmatch_t match[MATCH_NUM],
+	     int first)
+{
+	token_t t[MAX_TOKENS];
+	space_map_t map;
+	size_t ntok = 0;
+	size_t i = 0;
+	bool has_bs;
+	int i_match;
+	int weak = -1;
+	int fmt;
+
+	assert(s != NULL);
+	assert(first >= 0 && first < LS_FMT_NUM);
+
+	space_map_init(&map, s, len);
+
+	/* optional block size from ls -s */
+	i = space_map_find(&map, 0, false);
+	while (i < len && is_digit(s[i])) {
+		++i;
+	}
+	i = space_map_find(&map, i, false);
+	has_bs = i != 0;
+
+	while (i < len && ntok < MAX_TOKENS) {
+		t[ntok].so = i;
+		i = space_map_find(&map, i, true);
+		t[ntok].eo = i;
+		++ntok;
+		i = space_map_find(&map, i, false);
+	}
+
+	if (ntok == 0 || !is_mode(s, &t[0])) {
+		return -EINVAL;
+	}
+
+	for (i_match = 0; i_match < MATCH_NUM; i_match++) {
+		match[i_match].rm_so = -1;
+		match[i_match].rm_eo = -1;
+	}
+
+	for (i_match = 0; i_match < LS_FMT_NUM; i_match++) {
+		fmt = ls_fmt_nth(first, i_match);
+		if (!lex_tbl[fmt](s, len, t, ntok, has_bs, match)) {
+			continue;
+		}
+		if (i_match == 0 && ls_fmt_weak(fmt, s, match)) {
+			weak = fmt;
+			continue;
+		}
+		return fmt;
+	}
+
+	/* no other format fits, so the weak match stands */
+	if (weak >= 0 && lex_tbl[weak](s, len, t, ntok, has_bs, match)) {
+		return weak;
+	}
+
+	return -EINVAL;
+}
@@ -0,0 +1,76 @@
+/* lexer.h
+ * ls-fuse - ls -lR output mounter
+ *
+ * Copyright (C) 2013 Dmitry Podgorny <pasis.ua@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LS_FUSE_LEXER_H
+#define LS_FUSE_LEXER_H
+
+#include <sys/types.h>
+#include <regex.h>
+#include <stdbool.h>
+#include <string.h>
+
+/* maximum number of regex matches */
+#define MATCH_NUM 10
+
+/* supported layouts, in the order they are tried */
+enum ls_format {
+	LS_FMT_L = 0,		/* ls -l and ls -lR */
+	LS_FMT_TOOLBOX,		/* Android's toolbox */
+	LS_FMT_Z,		/* ls -lZ and ls -lRZ */
+	LS_FMT_NUM,
+};
+
+/*
+ * Returns i-th format to try when format first is expected. The rest formats
+ * follow in the default order.
+ */
+static inline int ls_fmt_nth(int first, int i)
+{
+	if (i == 0) {
+		return first;
+	}
+	return i <= first ? i - 1 : i;
+}
+
+/*
+ * Fields of ls -l and toolbox lines fit ls -lZ as well: the link count or
+ * the owner becomes the owner and the group or the size becomes the SELinux
+ * context. A real context has ':', so a -lZ match without it is weak. When
+ * ls -lZ is tried first, a weak match is taken only if no other format fits,
+ * so the line gets the same fields as in the default order.
+ */
+static inline bool ls_fmt_weak(int fmt, const char *s,
+			       const regmatch_t match[MATCH_NUM])
+{
+	return fmt == LS_FMT_Z &&
+	       memchr(&s[match[5].rm_so], ':',
+		      (size_t)(match[5].rm_eo - match[5].rm_so)) == NULL;
+}
+
+/*
+ * Splits a line into fields in a single scan. On success returns one of
+ * ls_format values and fills match[] with offsets of the fields in the same
+ * way regexec() does for the corresponding regexp from parser.c. Format first
+ * is tried before the others. Returns -EINVAL if the line doesn't look like
+ * any of supported layouts.
+ */
+int lex_line(const char *s, size_t len, regmatch_t match[MATCH_NUM],
+	     int first);
+
+#endif /* LS_FUSE_LEXER_H */
@@ -19,217 +19,1590 @@
 
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/statvfs.h>
+#include <sys/uio.h>
 
 #include <errno.h>
 #include <fuse.h>
+#include <fuse_lowlevel.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
 #include "node.h"
 #include "ls_fuse.h"
+#include "options.h"
+#include "parser.h"
+#include "search.h"
 #include "tools.h"
 
 #define SELINUX_XATTR "security.selinux"
+/* the description of an entry, see --content */
+#define SUMMARY_XATTR "user.lsfuse.summary"
 
-static int fuse_getattr(const char *path, struct stat *stbuf)
+/* totals of a directory, see node_tree_sum() */
+#define SUM_XATTR(name) "user.lsfuse." name
+
+/* names of the supported xattrs, each one is null-terminated */
+static const char xattr_list[] = SELINUX_XATTR "\0" SUMMARY_XATTR;
+static const char sum_xattr_list[] = SUM_XATTR("files") "\0"
+	SUM_XATTR("dirs") "\0" SUM_XATTR("size") "\0" SUM_XATTR("blocks");
+
+/* a page regular files repeat with --content=zero and pattern */
+#define CONTENT_PAGE 4096
+static char content_page[CONTENT_PAGE];
+
+/* virtual directory with information about the mount, it isn't listed */
+#define CTL_DIR "/.lsfuse"
+/* results of queries are files in it, see --search */
+#define SEARCH_DIR CTL_DIR "/search"
+#define CTL_BUFSIZ 8192
+
+typedef struct {
+	const char *name;
+	/* renders content like snprintf() */
+	int (*render)(char *buf, size_t size);
+} ctl_file_t;
+
+/* lookups answered with ENOENT, they are counted by concurrent requests */
+static unsigned long enoent_count;
+
+static void count_enoent(void)
 {
-	lsnode_t *node;
+	__atomic_fetch_add(&enoent_count, 1, __ATOMIC_RELAXED);
+}
 
-	memset(stbuf, 0, sizeof(struct stat));
+static int lookups_render(char *buf, size_t size)
+{
+	unsigned long rejected;
+	size_t filter_size;
 
-	node = node_from_path(path);
-	if (!node) {	
-		return -ENOENT;
+	node_filter_stats(&rejected, &filter_size);
+
+	return snprintf(buf, size,
+			"missing: %lu\n"
+			"filtered: %lu\n"
+			"filter: %zu KiB\n",
+			__atomic_load_n(&enoent_count, __ATOMIC_RELAXED),
+			rejected, filter_size / 1024);
+}
+
+static const ctl_file_t ctl_files[] = {
+	{"status", parser_status},
+	{"stats", parser_report},
+	{"lookups", lookups_render},
+};
+
+#if FUSE_USE_VERSION >= 30
+typedef uint64_t nlookup_t;
+#else
+typedef unsigned long nlookup_t;
+#endif
+
+/* seconds the kernel may cache attributes and names */
+#define ATTR_TIMEOUT 1.0
+/* inodes of /.lsfuse and its files, nodes never get these indices */
+#define CTL_INO ((fuse_ino_t)NODE_ID_RESERVED + 1)
+
+/* the root gets FUSE_ROOT_ID, other nodes get their index + 1 */
+static fuse_ino_t node_ino(const lsnode_t *node)
+{
+	if (node == node_get_root()) {
+		return FUSE_ROOT_ID;
 	}
+	return (fuse_ino_t)node_id(node) + 1;
+}
 
-	if ((node->mode & S_IFDIR) == S_IFDIR) {
-		stbuf->st_nlink = node->ndir + 2;
-	} else {
-		stbuf->st_nlink = 1;
+static lsnode_t *ino_node(fuse_ino_t ino)
+{
+	if (ino == FUSE_ROOT_ID) {
+		return node_get_root();
 	}
-	stbuf->st_mode = node->mode;
-	stbuf->st_size = node->size;
-	/* number of 512B blocks allocated */
-	stbuf->st_blocks = (node->size + 511) / 512;
-	stbuf->st_rdev = node->rdev;
-	stbuf->st_uid = node->uid;
-	stbuf->st_gid = node->gid;
-	stbuf->st_mtime = node->time;
+	if (ino < 2 || ino - 1 >= NODE_ID_RESERVED) {
+		return NULL;
+	}
+	return node_ptr((uint32_t)(ino - 1));
+}
 
-	return 0;
+static const ctl_file_t *ino_ctl_file(fuse_ino_t ino)
+{
+	if (ino <= CTL_INO || ino - CTL_INO > ARRAY_SIZE(ctl_files)) {
+		return NULL;
+	}
+	return &ctl_files[ino - CTL_INO - 1];
 }
 
-static int fuse_readdir(const char *path, void *buf, fuse_fill_dir_t filler,
-			off_t offset, struct fuse_file_info *fi)
+#define SEARCH_INO (CTL_INO + 1 + ARRAY_SIZE(ctl_files))
+/* results get inodes above nodes, so they need a 64bit fuse_ino_t */
+#define SEARCH_INO_BASE ((fuse_ino_t)UINT32_MAX + 1)
+
+static fuse_ino_t search_ino(long id)
 {
-	lsnode_t *parent;
-	lsnode_t *node;
-	char *name;
+	return SEARCH_INO_BASE + (fuse_ino_t)id;
+}
 
-	(void)offset;
-	(void)fi;
+/* returns id of the query or -1 if the inode isn't a result */
+static long ino_search(fuse_ino_t ino)
+{
+	if (SEARCH_INO_BASE == 0 || ino < SEARCH_INO_BASE) {
+		return -1;
+	}
+	return (long)(ino - SEARCH_INO_BASE);
+}
 
-	parent = node_from_path(path);
-	if (!parent) {
-		return -ENOENT;
+/* the tree doesn't change with --immutable, so the kernel keeps it longer */
+static double cache_timeout(void)
+{
+	return ls_opts.immutable ? IMMUTABLE_TIMEOUT : ATTR_TIMEOUT;
+}
+
+/* lines of printable bytes, they are the same at every page of a file */
+static void content_init(void)
+{
+	size_t i;
+
+	if (ls_opts.content != CONTENT_PATTERN) {
+		return;
 	}
-	if ((parent->mode & S_IFDIR) != S_IFDIR) {
-		return -ENOTDIR;
+	for (i = 0; i < CONTENT_PAGE; i++) {
+		content_page[i] = i % 64 == 63 ? '\n' :
+				  (char)('!' + (i * 7 + i / 64) % 94);
 	}
+}
 
-	if (filler(buf, ".", NULL, 0) == 1 ||
-	    filler(buf, "..", NULL, 0) == 1) {
-		return -EINVAL;
+/* bytes of synthetic content at the offset, the file has its listed size */
+static size_t content_len(const lsnode_t *node, size_t size, off_t offset)
+{
+	node_attr_t attr;
+
+	node_get_attr(node, &attr);
+	if (offset >= attr.size) {
+		return 0;
+	}
+	if ((unsigned long long)(attr.size - offset) < size) {
+		size = (size_t)(attr.size - offset);
+	}
+
+	return size;
+}
+
+static bool is_content(const lsnode_t *node)
+{
+	return ls_opts.content != CONTENT_SUMMARY && S_ISREG(node->mode);
+}
+
+/* reads of a file either go through the page cache or bypass it */
+static void open_cache(struct fuse_file_info *fi, bool ctl)
+{
+	if (ls_opts.immutable && !ctl) {
+		fi->keep_cache = 1;
+	} else {
+		fi->direct_io = 1;
+	}
+}
+
+/* attributes of entries are passed with readdirplus only */
+static int fill_dir(fuse_fill_dir_t filler, void *buf, const char *name,
+		    const struct stat *stbuf, off_t next)
+{
+#if FUSE_USE_VERSION >= 30
+	return filler(buf, name, stbuf, next, stbuf ? FUSE_FILL_DIR_PLUS : 0);
+#else
+	return filler(buf, name, stbuf, next);
+#endif
+}
+
+/*
+ * Offsets of a listing: "." is 0, ".." is 1 and the k-th entry of the
+ * directory is k + 2, entries which aren't listed are counted too. An entry
+ * is passed with the offset of the next one, readdir resumes from it.
+ */
+#define DIR_POS_FIRST 2
+
+/* where the last readdir of an open directory stopped, kept in fi->fh */
+typedef struct {
+	off_t pos;
+	uint32_t next;
+	unsigned long gen;
+} dir_cursor_t;
+
+/* called for every listed entry, returns false to stop the listing */
+typedef bool (*dir_add_t)(void *arg, const lsnode_t *node, const char *name,
+			  off_t next);
+
+static uint64_t dir_cursor_new(void)
+{
+	dir_cursor_t *cur = malloc(sizeof(*cur));
+
+	if (cur) {
+		cur->pos = -1;
+		cur->next = 0;
+		cur->gen = 0;
+	}
+
+	/* without a cursor every readdir seeks */
+	return (uint64_t)(uintptr_t)cur;
+}
+
+static dir_cursor_t *dir_cursor(const struct fuse_file_info *fi)
+{
+	return fi ? (dir_cursor_t *)(uintptr_t)fi->fh : NULL;
+}
+
+/*
+ * Lists entries of the directory from the offset. A listing continues from
+ * the cursor in O(1), other offsets are found with node_entry_at().
+ */
+static void dir_list(const lsnode_t *dir, off_t pos, dir_cursor_t *cur,
+		     dir_add_t add, void *arg)
+{
+	lsnode_t *node;
+	size_t len;
+
+	if (pos < DIR_POS_FIRST) {
+		pos = DIR_POS_FIRST;
+	}
+	if (cur && cur->pos == pos && cur->gen == node_tree_gen()) {
+		node = node_ptr(cur->next);
+	} else if (pos - DIR_POS_FIRST < UINT32_MAX) {
+		node = node_entry_at(dir, (uint32_t)(pos - DIR_POS_FIRST));
+	} else {
+		node = NULL;
 	}
 
-	node = parent->entry;
 	while (node) {
-		name = node->name;
-		if (name != NULL && strcmp(name, ".") != 0 &&
-		    strcmp(name, "..") != 0) {
-			if (filler(buf, node->name, NULL, 0) == 1) {
-				return -EINVAL;
+		len = node->name_len;
+		/* "." and ".." of the listing are replaced with our own */
+		if (node->name != NULL && !is_dot(node->name, len)) {
+			/* name isn't null-terminated if it's mapped */
+			char name[len + 1];
+
+			memcpy(name, node->name, len);
+			name[len] = '\0';
+			if (!add(arg, node, name, pos + 1)) {
+				break;
 			}
 		}
-		node = node->next;
+		node = node_next(node);
+		++pos;
 	}
 
-	return 0;
+	if (cur) {
+		cur->pos = pos;
+		cur->next = node ? node_id(node) : 0;
+		cur->gen = node_tree_gen();
+	}
 }
 
-static int fuse_readlink(const char *path, char *buf, size_t size)
+static bool is_ctl_dir(const char *path)
 {
-	lsnode_t *node;
-	size_t len;
+	return strcmp(path, CTL_DIR) == 0;
+}
 
-	node = node_from_path(path);
-	if (!node) {
-		return -ENOENT;
+static const ctl_file_t *ctl_file(const char *path)
+{
+	size_t len = sizeof(CTL_DIR) - 1;
+	size_t i;
+
+	if (strncmp(path, CTL_DIR, len) != 0 || path[len] != '/') {
+		return NULL;
 	}
-	if ((node->mode & S_IFLNK) != S_IFLNK) {
-		return -EINVAL;
+	for (i = 0; i < ARRAY_SIZE(ctl_files); i++) {
+		if (strcmp(&path[len + 1], ctl_files[i].name) == 0) {
+			return &ctl_files[i];
+		}
 	}
-	if (!node->data) {
-		return -EIO;
+
+	return NULL;
+}
+
+static bool is_search_dir(const char *path)
+{
+	return search_enabled() && strcmp(path, SEARCH_DIR) == 0;
+}
+
+/* returns PATTERN of /.lsfuse/search/PATTERN */
+static const char *search_pattern(const char *path)
+{
+	size_t len = sizeof(SEARCH_DIR) - 1;
+
+	if (!search_enabled() || strncmp(path, SEARCH_DIR, len) != 0 ||
+	    path[len] != '/' || path[len + 1] == '\0') {
+		return NULL;
 	}
 
-	len = strlen(node->data);
-	if (len >= size) {
-		return -EFAULT;
+	return &path[len + 1];
+}
+
+/* returns length of the content, it is truncated to CTL_BUFSIZ - 1 */
+static size_t ctl_render(const ctl_file_t *ctl, char *buf)
+{
+	int len = ctl->render(buf, CTL_BUFSIZ);
+
+	if (len < 0) {
+		return 0;
 	}
+	return (size_t)len < CTL_BUFSIZ ? (size_t)len : CTL_BUFSIZ - 1;
+}
 
-	memcpy(buf, node->data, len);
-	buf[len] = '\0';
+static void ctl_dir_stat(struct stat *stbuf)
+{
+	stbuf->st_ino = CTL_INO;
+	stbuf->st_mode = S_IFDIR | 0555;
+	stbuf->st_nlink = 2;
+}
 
-	return 0;
+static void ctl_file_stat(const ctl_file_t *ctl, struct stat *stbuf)
+{
+	char buf[CTL_BUFSIZ];
+
+	stbuf->st_ino = CTL_INO + 1 + (fuse_ino_t)(ctl - ctl_files);
+	stbuf->st_mode = S_IFREG | 0444;
+	stbuf->st_nlink = 1;
+	stbuf->st_size = (off_t)ctl_render(ctl, buf);
 }
 
-static int fuse_open(const char *path, struct fuse_file_info *fi)
+static void search_dir_stat(struct stat *stbuf)
 {
-	lsnode_t *node;
+	stbuf->st_ino = SEARCH_INO;
+	stbuf->st_mode = S_IFDIR | 0555;
+	stbuf->st_nlink = 2;
+}
 
-	node = node_from_path(path);
-	if (!node) {
-		return -ENOENT;
+/* the query runs here, so the size is known */
+static int search_file_stat(long id, struct stat *stbuf)
+{
+	long long len = search_read(id, NULL, 0, 0);
+
+	if (len < 0) {
+		return (int)len;
 	}
+	stbuf->st_ino = search_ino(id);
+	stbuf->st_mode = S_IFREG | 0444;
+	stbuf->st_nlink = 1;
+	stbuf->st_size = (off_t)len;
 
-	if ((fi->flags & O_WRONLY) == O_WRONLY) {
-		return -EACCES;
+	return 0;
+}
+
+static int search_file_read(long id, char *buf, size_t size, off_t offset)
+{
+	long long len = search_read(id, buf, size, offset);
+
+	if (len < 0) {
+		return (int)len;
+	}
+	if (offset >= len) {
+		return 0;
 	}
 
-	fi->direct_io = 1;
+	return (int)MIN((long long)size, len - offset);
+}
+
+static int ctl_getattr(const char *path, struct stat *stbuf)
+{
+	const ctl_file_t *ctl;
+	const char *pattern;
+	long id;
+	int err;
+
+	if (is_ctl_dir(path)) {
+		ctl_dir_stat(stbuf);
+		return 0;
+	}
+	if (is_search_dir(path)) {
+		search_dir_stat(stbuf);
+		return 0;
+	}
+	pattern = search_pattern(path);
+	if (pattern) {
+		/* the query may be replaced by others before it runs */
+		do {
+			id = search_query(pattern);
+			err = id < 0 ? (int)id : search_file_stat(id, stbuf);
+		} while (err == -ESTALE);
+		return err;
+	}
 
-	if (!node->data) {
-		node_create_data(node);
+	ctl = ctl_file(path);
+	if (!ctl) {
+		return -ENOENT;
 	}
+	ctl_file_stat(ctl, stbuf);
 
 	return 0;
 }
 
-static int fuse_read(const char *path, char *buf, size_t size, off_t offset,
-		      struct fuse_file_info *fi)
+static void node_stat(const lsnode_t *node, struct stat *stbuf)
+{
+	node_attr_t attr;
+
+	node_get_attr(node, &attr);
+	stbuf->st_ino = node_ino(node);
+	if ((attr.mode & S_IFDIR) == S_IFDIR) {
+		stbuf->st_nlink = node_ndir(node) + 2;
+	} else {
+		stbuf->st_nlink = 1;
+	}
+	stbuf->st_mode = attr.mode;
+	stbuf->st_size = attr.size;
+	/* number of 512B blocks allocated */
+	stbuf->st_blocks = attr.blocks;
+	stbuf->st_rdev = attr.rdev;
+	stbuf->st_uid = attr.uid;
+	stbuf->st_gid = attr.gid;
+	stbuf->st_mtime = attr.time;
+}
+
+static int path_stat(const char *path, struct stat *stbuf)
 {
 	lsnode_t *node;
-	size_t len;
-	char *ptr;
+	int err = 0;
 
-	(void)fi;
+	memset(stbuf, 0, sizeof(struct stat));
+
+	node_tree_rdlock();
+
+	if (is_ctl_dir(path) || ctl_file(path) || is_search_dir(path) ||
+	    search_pattern(path)) {
+		err = ctl_getattr(path, stbuf);
+		goto out;
+	}
 
 	node = node_from_path(path);
 	if (!node) {
-		return -EIO;
+		count_enoent();
+		err = -ENOENT;
+		goto out;
 	}
+	node_stat(node, stbuf);
 
-	if (!node->data) {
-		return -EINVAL;
+out:
+	node_tree_unlock();
+	return err;
+}
+
+static void ctl_readdir(void *buf, fuse_fill_dir_t filler, off_t offset,
+			bool plus)
+{
+	struct stat stbuf;
+	size_t i;
+
+	i = offset > DIR_POS_FIRST ? (size_t)(offset - DIR_POS_FIRST) : 0;
+	for (; i < ARRAY_SIZE(ctl_files); i++) {
+		memset(&stbuf, 0, sizeof(stbuf));
+		ctl_file_stat(&ctl_files[i], &stbuf);
+		if (fill_dir(filler, buf, ctl_files[i].name,
+			     plus ? &stbuf : NULL,
+			     (off_t)i + DIR_POS_FIRST + 1) != 0) {
+			return;
+		}
+	}
+	if (search_enabled() && i == ARRAY_SIZE(ctl_files)) {
+		memset(&stbuf, 0, sizeof(stbuf));
+		search_dir_stat(&stbuf);
+		fill_dir(filler, buf, "search", plus ? &stbuf : NULL,
+			 (off_t)i + DIR_POS_FIRST + 1);
 	}
+}
 
-	len = strlen(node->data);
-	if (offset > (off_t)len) {
-		return -EFAULT;
+typedef struct {
+	fuse_fill_dir_t filler;
+	void *buf;
+	bool plus;
+} dir_fill_t;
+
+/* dir_add_t for the path-based backend, stops when the buffer is full */
+static bool dir_fill(void *arg, const lsnode_t *node, const char *name,
+		     off_t next)
+{
+	dir_fill_t *f = arg;
+	struct stat stbuf;
+
+	if (f->plus) {
+		memset(&stbuf, 0, sizeof(stbuf));
+		node_stat(node, &stbuf);
 	}
 
-	ptr = &node->data[offset];
-	len = len - offset;
-	if (len > size) {
-		len = size;
+	return fill_dir(f->filler, f->buf, name, f->plus ? &stbuf : NULL,
+			next) == 0;
+}
+
+/* with plus attributes of the entries are passed too, see readdirplus */
+static int path_readdir(const char *path, void *buf, fuse_fill_dir_t filler,
+			off_t offset, dir_cursor_t *cur, bool plus)
+{
+	dir_fill_t f = {
+		.filler = filler,
+		.buf = buf,
+		.plus = plus,
+	};
+	lsnode_t *parent;
+	int err = 0;
+
+	if (ls_opts.progressive == PROGRESSIVE_WAIT) {
+		/* list the directory when all its entries are known */
+		parser_wait_dir(path);
 	}
 
-	memcpy(buf, ptr, len);
+	node_tree_rdlock();
 
-	return (int)len;
+	if ((offset < 1 && fill_dir(filler, buf, ".", NULL, 1) != 0) ||
+	    (offset < 2 && fill_dir(filler, buf, "..", NULL, 2) != 0)) {
+		goto out;
+	}
+
+	if (is_ctl_dir(path)) {
+		ctl_readdir(buf, filler, offset, plus);
+		goto out;
+	}
+	if (is_search_dir(path)) {
+		/* results aren't listed */
+		goto out;
+	}
+
+	parent = node_from_path(path);
+	if (!parent) {
+		err = -ENOENT;
+		goto out;
+	}
+	if ((parent->mode & S_IFDIR) != S_IFDIR) {
+		err = -ENOTDIR;
+		goto out;
+	}
+	node_load(parent);
+
+	dir_list(parent, offset, cur, dir_fill, &f);
+
+out:
+	node_tree_unlock();
+	return err;
 }
 
-static int fuse_listxattr(const char *path, char *buf, size_t size)
+static int fuse_opendir(const char *path, struct fuse_file_info *fi)
 {
-	size_t xattr_len = sizeof(SELINUX_XATTR);
+	(void)path;
+
+	fi->fh = dir_cursor_new();
 
+	return 0;
+}
+
+static int fuse_releasedir(const char *path, struct fuse_file_info *fi)
+{
 	(void)path;
 
-	if (size < xattr_len) {
-		return -ERANGE;
+	free(dir_cursor(fi));
+
+	return 0;
+}
+
+/* copies the null-terminated target of the symlink to buf */
+static int node_readlink(const lsnode_t *node, char *buf, size_t size)
+{
+	struct lsnode_ext *ext;
+	size_t len;
+
+	if ((node->mode & S_IFLNK) != S_IFLNK) {
+		return -EINVAL;
+	}
+	ext = node_ext(node);
+	if (!ext || !ext->data) {
+		return -EIO;
+	}
+
+	len = ext->data_len;
+	if (len >= size) {
+		return -EFAULT;
 	}
 
-	strncpy(buf, SELINUX_XATTR, xattr_len);
+	memcpy(buf, ext->data, len);
+	buf[len] = '\0';
 
-	return (int)xattr_len;
+	return 0;
 }
 
-static int fuse_getxattr(const char *path, const char *name, char *buf,
-			 size_t size)
+static int fuse_readlink(const char *path, char *buf, size_t size)
 {
 	lsnode_t *node;
-	size_t len;
+	int err;
 
-	/* only selinux xattr is supported */
-	if (strcmp(name, SELINUX_XATTR) != 0) {
-		return -ENODATA;
-	}
+	node_tree_rdlock();
 
 	node = node_from_path(path);
-	if (!node) {
-		return -ENOENT;
+	err = node ? node_readlink(node, buf, size) : -ENOENT;
+
+	node_tree_unlock();
+	return err;
+}
+
+static int fuse_open(const char *path, struct fuse_file_info *fi)
+{
+	int err = 0;
+
+	if ((fi->flags & O_WRONLY) == O_WRONLY) {
+		return -EACCES;
 	}
 
-	if (!node->selinux) {
-		return -ENODATA;
+	if (ctl_file(path) || search_pattern(path)) {
+		fi->direct_io = 1;
+		return 0;
 	}
+	open_cache(fi, false);
 
-	len = strlen(node->selinux);
-	if (len >= size) {
-		return -ERANGE;
+	node_tree_rdlock();
+	if (!node_from_path(path)) {
+		err = -ENOENT;
 	}
+	node_tree_unlock();
+
+	return err;
+}
 
-	strncpy(buf, node->selinux, size);
+static int ctl_read(const ctl_file_t *ctl, char *buf, size_t size,
+		    off_t offset)
+{
+	char data[CTL_BUFSIZ];
+	size_t len;
+
+	len = ctl_render(ctl, data);
+	if (offset >= (off_t)len) {
+		return 0;
+	}
+	len -= (size_t)offset;
+	if (len > size) {
+		len = size;
+	}
+	memcpy(buf, &data[offset], len);
 
-	return len + 1;
+	return (int)len;
 }
 
+/*
+ * Content of a file is rendered to buf on every read, it isn't kept. With
+ * --immutable a regular file is cut or padded with zeros to its listed
+ * size, the page cache relies on st_size.
+ */
+static int node_read(const lsnode_t *node, char *buf, size_t size,
+		     off_t offset)
+{
+	long long len;
+	long long end;
+	node_attr_t attr;
+	size_t pos;
+	size_t n;
+
+	if (is_content(node)) {
+		size = content_len(node, size, offset);
+		for (n = 0; n < size; n += CONTENT_PAGE - pos) {
+			pos = (size_t)((offset + (off_t)n) % CONTENT_PAGE);
+			memcpy(&buf[n], &content_page[pos],
+			       size - n < CONTENT_PAGE - pos ?
+			       size - n : CONTENT_PAGE - pos);
+		}
+		return (int)size;
+	}
+
+	len = node_render(node, buf, size, offset);
+	end = len;
+	if (len < 0) {
+		return -EINVAL;
+	}
+	if (ls_opts.immutable && S_ISREG(node->mode)) {
+		node_get_attr(node, &attr);
+		end = attr.size;
+	}
+	if (offset >= end) {
+		return 0;
+	}
+	if ((unsigned long long)(end - offset) < size) {
+		size = (size_t)(end - offset);
+	}
+	if (offset + (long long)size > len) {
+		len = len > offset ? len - offset : 0;
+		memset(&buf[len], 0, size - (size_t)len);
+	}
+
+	return (int)size;
+}
+
+static int fuse_read(const char *path, char *buf, size_t size, off_t offset,
+		      struct fuse_file_info *fi)
+{
+	const ctl_file_t *ctl;
+	const char *pattern;
+	lsnode_t *node;
+	long id;
+	int err;
+
+	(void)fi;
+
+	node_tree_rdlock();
+
+	ctl = ctl_file(path);
+	if (ctl) {
+		err = ctl_read(ctl, buf, size, offset);
+		goto out;
+	}
+	pattern = search_pattern(path);
+	if (pattern) {
+		do {
+			id = search_query(pattern);
+			err = id < 0 ? (int)id :
+				       search_file_read(id, buf, size, offset);
+		} while (err == -ESTALE);
+		goto out;
+	}
+
+	node = node_from_path(path);
+	if (!node) {
+		err = -EIO;
+		goto out;
+	}
+
+	err = node_read(node, buf, size, offset);
+
+out:
+	node_tree_unlock();
+	return err;
+}
+
+/* totals are listed for directories of a complete tree, node may be NULL */
+static int node_listxattr(const lsnode_t *node, char *buf, size_t size)
+{
+	bool sum = node && node_sum(node);
+	size_t len = sizeof(xattr_list);
+
+	if (sum) {
+		len += sizeof(sum_xattr_list);
+	}
+	if (size == 0) {
+		return (int)len;
+	}
+	if (size < len) {
+		return -ERANGE;
+	}
+
+	memcpy(buf, xattr_list, sizeof(xattr_list));
+	if (sum) {
+		memcpy(&buf[sizeof(xattr_list)], sum_xattr_list,
+		       sizeof(sum_xattr_list));
+	}
+
+	return (int)len;
+}
+
+static int fuse_listxattr(const char *path, char *buf, size_t size)
+{
+	int len;
+
+	node_tree_rdlock();
+	len = node_listxattr(node_from_path(path), buf, size);
+	node_tree_unlock();
+
+	return len;
+}
+
+/* values of totals are decimal numbers without the null byte */
+static int sum_getxattr(const node_sum_t *sum, const char *name, char *buf,
+			size_t size)
+{
+	unsigned long long value;
+	char str[24];
+	int len;
+
+	if (strcmp(name, SUM_XATTR("files")) == 0) {
+		value = sum->files;
+	} else if (strcmp(name, SUM_XATTR("dirs")) == 0) {
+		value = sum->dirs;
+	} else if (strcmp(name, SUM_XATTR("size")) == 0) {
+		value = (unsigned long long)sum->size;
+	} else if (strcmp(name, SUM_XATTR("blocks")) == 0) {
+		value = (unsigned long long)sum->blocks;
+	} else {
+		return -ENODATA;
+	}
+
+	len = snprintf(str, sizeof(str), "%llu", value);
+	if (size == 0) {
+		return len;
+	}
+	if ((size_t)len > size) {
+		return -ERANGE;
+	}
+	memcpy(buf, str, (size_t)len);
+
+	return len;
+}
+
+/*
+ * Returns length of the value, size 0 only finds it. The SELinux context
+ * is passed with the null byte.
+ */
+static int node_getxattr(const lsnode_t *node, const char *name, char *buf,
+			 size_t size)
+{
+	const node_sum_t *sum = node_sum(node);
+	struct lsnode_ext *ext;
+	long long summary;
+	size_t len;
+
+	if (sum && strncmp(name, SUM_XATTR(""), strlen(SUM_XATTR(""))) == 0 &&
+	    strcmp(name, SUMMARY_XATTR) != 0) {
+		return sum_getxattr(sum, name, buf, size);
+	}
+	if (strcmp(name, SUMMARY_XATTR) == 0) {
+		summary = node_render(node, buf, size, 0);
+		if (summary < 0) {
+			return -ENODATA;
+		}
+		if (size != 0 && (unsigned long long)summary > size) {
+			return -ERANGE;
+		}
+		return (int)summary;
+	}
+	if (strcmp(name, SELINUX_XATTR) != 0) {
+		return -ENODATA;
+	}
+
+	ext = node_ext(node);
+	if (!ext || !ext->selinux) {
+		return -ENODATA;
+	}
+
+	len = strlen(ext->selinux);
+	if (size == 0) {
+		return (int)len + 1;
+	}
+	if (len >= size) {
+		return -ERANGE;
+	}
+
+	strncpy(buf, ext->selinux, size);
+
+	return (int)len + 1;
+}
+
+static int fuse_getxattr(const char *path, const char *name, char *buf,
+			 size_t size)
+{
+	lsnode_t *node;
+	int err;
+
+	node_tree_rdlock();
+
+	node = node_from_path(path);
+	err = node ? node_getxattr(node, name, buf, size) : -ENOENT;
+
+	node_tree_unlock();
+	return err;
+}
+
+/* totals of the whole tree, the filesystem has no free space */
+static void tree_statfs(struct statvfs *st)
+{
+	const node_sum_t *sum;
+
+	memset(st, 0, sizeof(*st));
+	st->f_bsize = 4096;
+	st->f_frsize = 512;
+	st->f_namemax = NODE_NAME_MAX;
+
+	node_tree_rdlock();
+	sum = node_sum(node_get_root());
+	if (sum) {
+		st->f_blocks = (fsblkcnt_t)sum->blocks;
+		/* the root is counted too */
+		st->f_files = (fsfilcnt_t)(sum->files + sum->dirs + 1);
+	}
+	node_tree_unlock();
+}
+
+static int fuse_statfs(const char *path, struct statvfs *st)
+{
+	(void)path;
+
+	tree_statfs(st);
+
+	return 0;
+}
+
+#if FUSE_USE_VERSION >= 30
+static int fuse_getattr(const char *path, struct stat *stbuf,
+			struct fuse_file_info *fi)
+{
+	(void)fi;
+
+	return path_stat(path, stbuf);
+}
+
+static int fuse_readdir(const char *path, void *buf, fuse_fill_dir_t filler,
+			off_t offset, struct fuse_file_info *fi,
+			enum fuse_readdir_flags flags)
+{
+	return path_readdir(path, buf, filler, offset, dir_cursor(fi),
+			    flags & FUSE_READDIR_PLUS);
+}
+
+/* attributes are free to pass, so readdirplus is used for every listing */
+static void conn_init(struct fuse_conn_info *conn)
+{
+	if (conn->capable & FUSE_CAP_READDIRPLUS) {
+		conn->want |= FUSE_CAP_READDIRPLUS;
+		conn->want &= ~FUSE_CAP_READDIRPLUS_AUTO;
+	}
+}
+
+static void *fuse_init(struct fuse_conn_info *conn, struct fuse_config *cfg)
+{
+	conn_init(conn);
+	/* inodes are indices of nodes, the same as --lowlevel uses */
+	cfg->use_ino = 1;
+	cfg->entry_timeout = cache_timeout();
+	cfg->attr_timeout = cache_timeout();
+	if (ls_opts.immutable) {
+		cfg->negative_timeout = IMMUTABLE_TIMEOUT;
+		cfg->kernel_cache = 1;
+	}
+
+	content_init();
+	/* threads must be created after FUSE daemonizes */
+	parser_bg_start();
+
+	return NULL;
+}
+#else
+static int fuse_getattr(const char *path, struct stat *stbuf)
+{
+	return path_stat(path, stbuf);
+}
+
+static int fuse_readdir(const char *path, void *buf, fuse_fill_dir_t filler,
+			off_t offset, struct fuse_file_info *fi)
+{
+	return path_readdir(path, buf, filler, offset, dir_cursor(fi), false);
+}
+
+static void *fuse_init(struct fuse_conn_info *conn)
+{
+	(void)conn;
+
+	content_init();
+	/* threads must be created after FUSE daemonizes */
+	parser_bg_start();
+
+	return NULL;
+}
+#endif /* FUSE_USE_VERSION >= 30 */
+
 struct fuse_operations fuse_oper = {
+	.init = fuse_init,
 	.getattr = fuse_getattr,
+	.opendir = fuse_opendir,
 	.readdir = fuse_readdir,
+	.releasedir = fuse_releasedir,
 	.readlink = fuse_readlink,
 	.open = fuse_open,
 	.read = fuse_read,
 	.listxattr = fuse_listxattr,
 	.getxattr = fuse_getxattr,
+	.statfs = fuse_statfs,
+};
+
+/*
+ * Low-level backend, see --lowlevel. Inodes are indices of nodes, so a
+ * request finds its node without resolving a path. Nodes must not be freed
+ * while the filesystem is mounted, hence lazy mode uses the path-based one.
+ */
+
+/* fills attributes of the inode, returns -errno */
+static int ino_stat(fuse_ino_t ino, struct stat *stbuf)
+{
+	const ctl_file_t *ctl;
+	lsnode_t *node;
+	long id;
+
+	memset(stbuf, 0, sizeof(*stbuf));
+	if (ino == CTL_INO) {
+		ctl_dir_stat(stbuf);
+		return 0;
+	}
+	ctl = ino_ctl_file(ino);
+	if (ctl) {
+		ctl_file_stat(ctl, stbuf);
+		return 0;
+	}
+	if (ino == SEARCH_INO && search_enabled()) {
+		search_dir_stat(stbuf);
+		return 0;
+	}
+	id = ino_search(ino);
+	if (id >= 0) {
+		return search_file_stat(id, stbuf);
+	}
+	node = ino_node(ino);
+	if (!node) {
+		return -ENOENT;
+	}
+	node_stat(node, stbuf);
+
+	return 0;
+}
+
+static fuse_ino_t ll_lookup_ino(fuse_ino_t parent, const char *name)
+{
+	lsnode_t *dir;
+	lsnode_t *node;
+	long id;
+	size_t i;
+
+	if (parent == CTL_INO) {
+		for (i = 0; i < ARRAY_SIZE(ctl_files); i++) {
+			if (strcmp(name, ctl_files[i].name) == 0) {
+				return CTL_INO + 1 + i;
+			}
+		}
+		if (search_enabled() && strcmp(name, "search") == 0) {
+			return SEARCH_INO;
+		}
+		return 0;
+	}
+	if (parent == SEARCH_INO) {
+		if (SEARCH_INO_BASE == 0 || !search_enabled()) {
+			return 0;
+		}
+		id = search_query(name);
+		return id >= 0 ? search_ino(id) : 0;
+	}
+	if (parent == FUSE_ROOT_ID && strcmp(name, &CTL_DIR[1]) == 0) {
+		return CTL_INO;
+	}
+
+	dir = ino_node(parent);
+	if (!dir || !S_ISDIR(dir->mode)) {
+		return 0;
+	}
+	node = node_lookup_child(dir, name, strlen(name));
+
+	return node ? node_ino(node) : 0;
+}
+
+static void ll_lookup(fuse_req_t req, fuse_ino_t parent, const char *name)
+{
+	struct fuse_entry_param e;
+	int err = -ENOENT;
+
+	memset(&e, 0, sizeof(e));
+
+	node_tree_rdlock();
+	e.ino = ll_lookup_ino(parent, name);
+	if (e.ino != 0) {
+		err = ino_stat(e.ino, &e.attr);
+	}
+	node_tree_unlock();
+
+	if (err == -ENOENT) {
+		count_enoent();
+	}
+	if (err == -ENOENT && ls_opts.immutable) {
+		/* the kernel caches that the name doesn't exist */
+		memset(&e, 0, sizeof(e));
+		e.entry_timeout = cache_timeout();
+		fuse_reply_entry(req, &e);
+		return;
+	}
+	if (err != 0) {
+		fuse_reply_err(req, -err);
+		return;
+	}
+	e.attr_timeout = cache_timeout();
+	e.entry_timeout = cache_timeout();
+	fuse_reply_entry(req, &e);
+}
+
+/* nodes live until unmount, so lookup counts aren't kept */
+static void ll_forget(fuse_req_t req, fuse_ino_t ino, nlookup_t nlookup)
+{
+	(void)ino;
+	(void)nlookup;
+
+	fuse_reply_none(req);
+}
+
+static void ll_getattr(fuse_req_t req, fuse_ino_t ino,
+		       struct fuse_file_info *fi)
+{
+	struct stat stbuf;
+	int err;
+
+	(void)fi;
+
+	node_tree_rdlock();
+	err = ino_stat(ino, &stbuf);
+	node_tree_unlock();
+
+	if (err != 0) {
+		fuse_reply_err(req, -err);
+	} else {
+		fuse_reply_attr(req, &stbuf, cache_timeout());
+	}
+}
+
+/* a reply buffer of readdir */
+typedef struct {
+	fuse_req_t req;
+	char *buf;
+	size_t size;
+	size_t len;
+	/* entries carry attributes, see readdirplus */
+	bool plus;
+} ll_dirbuf_t;
+
+/* returns size of the entry, it isn't added if the size exceeds the room */
+static size_t ll_direntry(ll_dirbuf_t *d, const char *name,
+			  const struct stat *stbuf, bool dot, off_t next)
+{
+	char *buf = &d->buf[d->len];
+	size_t size = d->size - d->len;
+#if FUSE_USE_VERSION >= 30
+	struct fuse_entry_param e;
+
+	if (d->plus) {
+		memset(&e, 0, sizeof(e));
+		e.attr = *stbuf;
+		/* the kernel doesn't look "." and ".." up */
+		if (!dot) {
+			e.ino = stbuf->st_ino;
+			e.attr_timeout = cache_timeout();
+			e.entry_timeout = cache_timeout();
+		}
+		return fuse_add_direntry_plus(d->req, buf, size, name, &e,
+					      next);
+	}
+#else
+	(void)dot;
+#endif
+
+	return fuse_add_direntry(d->req, buf, size, name, stbuf, next);
+}
+
+/* returns false when the buffer is full */
+static bool ll_dirbuf_add(ll_dirbuf_t *d, const char *name, fuse_ino_t ino,
+			  mode_t mode, off_t next)
+{
+	struct stat stbuf;
+	bool dot = is_dot(name, strlen(name));
+	size_t len;
+
+	if (!d->plus || dot || ino_stat(ino, &stbuf) != 0) {
+		memset(&stbuf, 0, sizeof(stbuf));
+		stbuf.st_ino = ino;
+		stbuf.st_mode = mode;
+	}
+	len = ll_direntry(d, name, &stbuf, dot, next);
+	if (len > d->size - d->len) {
+		return false;
+	}
+	d->len += len;
+
+	return true;
+}
+
+/* dir_add_t for the low-level backend */
+static bool ll_dir_add(void *arg, const lsnode_t *node, const char *name,
+		       off_t next)
+{
+	return ll_dirbuf_add(arg, name, node_ino(node), node->mode, next);
+}
+
+static int ll_readdir_fill(ll_dirbuf_t *d, fuse_ino_t ino, off_t off,
+			   dir_cursor_t *cur)
+{
+	lsnode_t *parent;
+	size_t i;
+
+	if ((off < 1 && !ll_dirbuf_add(d, ".", ino, S_IFDIR, 1)) ||
+	    (off < 2 && !ll_dirbuf_add(d, "..", FUSE_ROOT_ID, S_IFDIR, 2))) {
+		return 0;
+	}
+
+	if (ino == CTL_INO) {
+		i = off > DIR_POS_FIRST ? (size_t)(off - DIR_POS_FIRST) : 0;
+		for (; i < ARRAY_SIZE(ctl_files); i++) {
+			if (!ll_dirbuf_add(d, ctl_files[i].name,
+					   CTL_INO + 1 + i, S_IFREG,
+					   (off_t)i + DIR_POS_FIRST + 1)) {
+				return 0;
+			}
+		}
+		if (search_enabled() && i == ARRAY_SIZE(ctl_files)) {
+			ll_dirbuf_add(d, "search", SEARCH_INO, S_IFDIR,
+				      (off_t)i + DIR_POS_FIRST + 1);
+		}
+		return 0;
+	}
+	if (ino == SEARCH_INO && search_enabled()) {
+		return 0;
+	}
+
+	parent = ino_node(ino);
+	if (!parent) {
+		return -ENOENT;
+	}
+	if (!S_ISDIR(parent->mode)) {
+		return -ENOTDIR;
+	}
+
+	dir_list(parent, off, cur, ll_dir_add, d);
+
+	return 0;
+}
+
+static void ll_readdir_reply(fuse_req_t req, fuse_ino_t ino, size_t size,
+			     off_t off, struct fuse_file_info *fi, bool plus)
+{
+	ll_dirbuf_t d;
+	int err;
+
+	memset(&d, 0, sizeof(d));
+	d.req = req;
+	d.size = size;
+	d.plus = plus;
+	d.buf = malloc(size);
+	if (!d.buf) {
+		fuse_reply_err(req, ENOMEM);
+		return;
+	}
+
+	node_tree_rdlock();
+	err = ll_readdir_fill(&d, ino, off, dir_cursor(fi));
+	node_tree_unlock();
+
+	if (err != 0) {
+		fuse_reply_err(req, -err);
+	} else {
+		fuse_reply_buf(req, d.buf, d.len);
+	}
+	free(d.buf);
+}
+
+static void ll_opendir(fuse_req_t req, fuse_ino_t ino,
+		       struct fuse_file_info *fi)
+{
+	(void)ino;
+
+	fi->fh = dir_cursor_new();
+	fuse_reply_open(req, fi);
+}
+
+static void ll_readdir(fuse_req_t req, fuse_ino_t ino, size_t size,
+		       off_t off, struct fuse_file_info *fi)
+{
+	ll_readdir_reply(req, ino, size, off, fi, false);
+}
+
+#if FUSE_USE_VERSION >= 30
+static void ll_readdirplus(fuse_req_t req, fuse_ino_t ino, size_t size,
+			   off_t off, struct fuse_file_info *fi)
+{
+	ll_readdir_reply(req, ino, size, off, fi, true);
+}
+#endif
+
+static void ll_releasedir(fuse_req_t req, fuse_ino_t ino,
+			  struct fuse_file_info *fi)
+{
+	(void)ino;
+
+	free(dir_cursor(fi));
+	fuse_reply_err(req, 0);
+}
+
+/* the target may be as long as the listing line, so it is copied to heap */
+static void ll_readlink(fuse_req_t req, fuse_ino_t ino)
+{
+	struct lsnode_ext *ext;
+	lsnode_t *node;
+	char *buf = NULL;
+	size_t size;
+	int err;
+
+	node_tree_rdlock();
+	node = ino_node(ino);
+	ext = node ? node_ext(node) : NULL;
+	size = ext ? ext->data_len + 1 : 1;
+	if (!node) {
+		err = -ENOENT;
+	} else if ((buf = malloc(size)) == NULL) {
+		err = -ENOMEM;
+	} else {
+		err = node_readlink(node, buf, size);
+	}
+	node_tree_unlock();
+
+	if (err != 0) {
+		fuse_reply_err(req, -err);
+	} else {
+		fuse_reply_readlink(req, buf);
+	}
+	free(buf);
+}
+
+static void ll_open(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi)
+{
+	if ((fi->flags & O_ACCMODE) != O_RDONLY) {
+		fuse_reply_err(req, EACCES);
+		return;
+	}
+	open_cache(fi, ino_ctl_file(ino) != NULL || ino_search(ino) >= 0);
+	fuse_reply_open(req, fi);
+}
+
+/* replies with pieces of the shared page, the content isn't copied */
+static void ll_read_content(fuse_req_t req, size_t size, off_t off)
+{
+	size_t pos = (size_t)(off % CONTENT_PAGE);
+	size_t count = (pos + size + CONTENT_PAGE - 1) / CONTENT_PAGE;
+	struct iovec *iov;
+	size_t n;
+	size_t i;
+
+	if (count == 0) {
+		fuse_reply_buf(req, NULL, 0);
+		return;
+	}
+	iov = malloc(count * sizeof(*iov));
+	if (!iov) {
+		fuse_reply_err(req, ENOMEM);
+		return;
+	}
+	for (i = 0; i < count; i++) {
+		n = CONTENT_PAGE - pos < size ? CONTENT_PAGE - pos : size;
+		iov[i].iov_base = &content_page[pos];
+		iov[i].iov_len = n;
+		size -= n;
+		pos = 0;
+	}
+	fuse_reply_iov(req, iov, (int)count);
+	free(iov);
+}
+
+static void ll_read(fuse_req_t req, fuse_ino_t ino, size_t size, off_t off,
+		    struct fuse_file_info *fi)
+{
+	const ctl_file_t *ctl;
+	lsnode_t *node;
+	char *buf;
+	long id;
+	int len;
+
+	(void)fi;
+
+	node_tree_rdlock();
+	ctl = ino_ctl_file(ino);
+	node = ctl ? NULL : ino_node(ino);
+	id = ino_search(ino);
+	if (node && is_content(node)) {
+		size = content_len(node, size, off);
+		node_tree_unlock();
+		ll_read_content(req, size, off);
+		return;
+	}
+
+	buf = malloc(size > CTL_BUFSIZ ? size : CTL_BUFSIZ);
+	if (!buf) {
+		len = -ENOMEM;
+	} else if (ctl) {
+		len = ctl_read(ctl, buf, size, off);
+	} else if (id >= 0) {
+		len = search_file_read(id, buf, size, off);
+	} else if (node) {
+		len = node_read(node, buf, size, off);
+	} else {
+		len = -EIO;
+	}
+	node_tree_unlock();
+
+	if (len < 0) {
+		fuse_reply_err(req, -len);
+	} else {
+		fuse_reply_buf(req, buf, (size_t)len);
+	}
+	free(buf);
+}
+
+static void ll_listxattr(fuse_req_t req, fuse_ino_t ino, size_t size)
+{
+	char buf[sizeof(xattr_list) + sizeof(sum_xattr_list)];
+	int len;
+
+	node_tree_rdlock();
+	len = node_listxattr(ino_node(ino), buf,
+			     size < sizeof(buf) ? size : sizeof(buf));
+	node_tree_unlock();
+
+	if (len < 0) {
+		fuse_reply_err(req, -len);
+	} else if (size == 0) {
+		fuse_reply_xattr(req, (size_t)len);
+	} else {
+		fuse_reply_buf(req, buf, (size_t)len);
+	}
+}
+
+static void ll_getxattr(fuse_req_t req, fuse_ino_t ino, const char *name,
+			size_t size)
+{
+	lsnode_t *node;
+	char *buf = NULL;
+	int len;
+
+	/* the size comes from the caller, so it isn't put on the stack */
+	if (size != 0 && (buf = malloc(size)) == NULL) {
+		fuse_reply_err(req, ENOMEM);
+		return;
+	}
+
+	node_tree_rdlock();
+	node = ino_node(ino);
+	len = node ? node_getxattr(node, name, buf, size) : -ENODATA;
+	node_tree_unlock();
+
+	if (len < 0) {
+		fuse_reply_err(req, -len);
+	} else if (size == 0) {
+		fuse_reply_xattr(req, (size_t)len);
+	} else {
+		fuse_reply_buf(req, buf, (size_t)len);
+	}
+	free(buf);
+}
+
+static void ll_statfs(fuse_req_t req, fuse_ino_t ino)
+{
+	struct statvfs st;
+
+	(void)ino;
+
+	tree_statfs(&st);
+	fuse_reply_statfs(req, &st);
+}
+
+static void ll_init(void *userdata, struct fuse_conn_info *conn)
+{
+	(void)userdata;
+#if FUSE_USE_VERSION >= 30
+	conn_init(conn);
+#else
+	(void)conn;
+#endif
+
+	content_init();
+	parser_bg_start();
+}
+
+static struct fuse_lowlevel_ops fuse_ll_oper = {
+	.init = ll_init,
+	.lookup = ll_lookup,
+	.forget = ll_forget,
+	.getattr = ll_getattr,
+	.readlink = ll_readlink,
+	.open = ll_open,
+	.read = ll_read,
+	.opendir = ll_opendir,
+	.readdir = ll_readdir,
+#if FUSE_USE_VERSION >= 30
+	.readdirplus = ll_readdirplus,
+#endif
+	.releasedir = ll_releasedir,
+	.listxattr = ll_listxattr,
+	.getxattr = ll_getxattr,
+	.statfs = ll_statfs,
 };
+
+/* like fuse_main(), but serves the tree with fuse_ll_oper */
+#if FUSE_USE_VERSION >= 30
+int fuse_ll_main(int argc, char **argv)
+{
+	struct fuse_args args = FUSE_ARGS_INIT(argc, argv);
+	struct fuse_cmdline_opts opts;
+	struct fuse_session *se;
+	int err = -1;
+
+	if (fuse_parse_cmdline(&args, &opts) != 0) {
+		return 1;
+	}
+	if (!opts.mountpoint) {
+		fuse_cmdline_help();
+		goto out_free;
+	}
+	se = fuse_session_new(&args, &fuse_ll_oper, sizeof(fuse_ll_oper),
+			      NULL);
+	if (!se) {
+		goto out_free;
+	}
+	if (fuse_set_signal_handlers(se) != 0) {
+		goto out_destroy;
+	}
+	if (fuse_session_mount(se, opts.mountpoint) == 0) {
+		if (fuse_daemonize(opts.foreground) == 0) {
+			err = opts.singlethread ? fuse_session_loop(se) :
+				fuse_session_loop_mt(se, opts.clone_fd);
+		}
+		fuse_session_unmount(se);
+	}
+	fuse_remove_signal_handlers(se);
+
+out_destroy:
+	fuse_session_destroy(se);
+out_free:
+	free(opts.mountpoint);
+	fuse_opt_free_args(&args);
+
+	return err == 0 ? 0 : 1;
+}
+#else
+int fuse_ll_main(int argc, char **argv)
+{
+	struct fuse_args args = FUSE_ARGS_INIT(argc, argv);
+	struct fuse_session *se;
+	struct fuse_chan *ch;
+	char *mountpoint;
+	int multithreaded;
+	int foreground;
+	int err = -1;
+
+	if (fuse_parse_cmdline(&args, &mountpoint, &multithreaded,
+			       &foreground) != 0) {
+		return 1;
+	}
+	ch = fuse_mount(mountpoint, &args);
+	if (!ch) {
+		goto out_free;
+	}
+	se = fuse_lowlevel_new(&args, &fuse_ll_oper, sizeof(fuse_ll_oper),
+			       NULL);
+	if (!se) {
+		goto out_unmount;
+	}
+	if (fuse_set_signal_handlers(se) == 0) {
+		fuse_session_add_chan(se, ch);
+		if (fuse_daemonize(foreground) == 0) {
+			err = multithreaded ? fuse_session_loop_mt(se) :
+					      fuse_session_loop(se);
+		}
+		fuse_remove_signal_handlers(se);
+		fuse_session_remove_chan(ch);
+	}
+	fuse_session_destroy(se);
+
+out_unmount:
+	fuse_unmount(mountpoint, ch);
+out_free:
+	free(mountpoint);
+	fuse_opt_free_args(&args);
+
+	return err == 0 ? 0 : 1;
+}
+#endif /* FUSE_USE_VERSION >= 30 */
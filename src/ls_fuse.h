@@ -22,6 +22,14 @@
 
 #include <fuse.h>
 
+/* seconds the kernel caches names and attributes with --immutable */
+#define IMMUTABLE_TIMEOUT 86400
+/* the same as mount options of the path-based backend of libfuse 2 */
+#define IMMUTABLE_OPTS "-oentry_timeout=86400,attr_timeout=86400," \
+		       "negative_timeout=86400,use_ino,kernel_cache"
+
 extern struct fuse_operations fuse_oper;
 
+int fuse_ll_main(int argc, char **argv);
+
 #endif /* LS_FUSE_LS_FUSE_H */
@@ -20,12 +20,16 @@
 #include <unistd.h>
 
 #include <fuse.h>
+#include <fuse_opt.h>
+#include <stddef.h>
 #include <stdio.h>
 #include <string.h>
 
 #include "ls_fuse.h"
 #include "node.h"
+#include "options.h"
 #include "parser.h"
+#include "search.h"
 #include "tools.h"
 #include "log.h"
 
@@ -33,18 +37,84 @@
 #define STDIN_FILENO 0
 #endif
 
+#define LS_OPT(t, p, v) { t, offsetof(struct ls_options, p), v }
+
+struct ls_options ls_opts = {
+	.threads = 1,
+};
+
+static const struct fuse_opt ls_fuse_opts[] = {
+	LS_OPT("--regex", regex, 1),
+	LS_OPT("--threads=%u", threads, 0),
+	LS_OPT("--tz=%s", tz, 0),
+	LS_OPT("--lazy", lazy, 1),
+	LS_OPT("--lazy-mem=%u", lazy_mem, 0),
+	LS_OPT("--progressive", progressive, PROGRESSIVE_PARTIAL),
+	LS_OPT("--progressive=wait", progressive, PROGRESSIVE_WAIT),
+	LS_OPT("--parse-stats", parse_stats, 1),
+	LS_OPT("--merge=last", merge, MERGE_LAST),
+	LS_OPT("--merge=first", merge, MERGE_FIRST),
+	LS_OPT("--merge=newest", merge, MERGE_NEWEST),
+	LS_OPT("--lowlevel", lowlevel, 1),
+	LS_OPT("--immutable", immutable, 1),
+	LS_OPT("--content=summary", content, CONTENT_SUMMARY),
+	LS_OPT("--content=zero", content, CONTENT_ZERO),
+	LS_OPT("--content=pattern", content, CONTENT_PATTERN),
+	LS_OPT("--search", search, 1),
+	FUSE_OPT_END
+};
+
 static void usage(const char * const name)
 {
 #ifdef PACKAGE_STRING
 	printf(PACKAGE_STRING "\n\n");
 #endif /* PACKAGE_STRING */
-	printf("Usage: %s [FILES ...] [FUSE_OPTIONS] MOUNT_POINT\n", name);
+	printf("Usage: %s [FILES ...] [OPTIONS] MOUNT_POINT\n\n", name);
+	printf("ls-fuse options:\n"
+	       "    --regex        parse lines with regular expressions only\n"
+	       "    --threads=N    parse a file with N threads "
+	       "(0 - number of CPUs)\n"
+	       "    --tz=[+-]HH[:MM]  times are in the fixed time zone "
+	       "(or UTC)\n"
+	       "    --lazy         parse directories on first access\n"
+	       "    --lazy-mem=N   keep at most N MiB of parsed entries "
+	       "(0 - unlimited)\n"
+	       "    --progressive  mount while standard input is parsed\n"
+	       "    --progressive=wait\n"
+	       "                   same, but wait for directories being parsed\n"
+	       "    --parse-stats  print a report on parsing of the input\n"
+	       "    --merge=last|first|newest\n"
+	       "                   which attributes an entry listed twice gets\n"
+	       "    --lowlevel     serve requests by inode, not by path\n"
+	       "    --immutable    let the kernel cache the tree and contents\n"
+	       "    --content=summary|zero|pattern\n"
+	       "                   what regular files read as, zero and pattern\n"
+	       "                   fill the listed size\n"
+	       "    --search       find names in /.lsfuse/search/PATTERN\n"
+	       "\nOther options are passed to FUSE.\n");
+}
+
+/* inserts a FUSE option after the files, argv points to the last one */
+static int insert_arg(struct fuse_args *args, int *argc, char ***argv,
+		      const char *arg)
+{
+	int pos = (int)(*argv - args->argv);
+
+	if (fuse_opt_insert_arg(args, pos + 1, arg) != 0) {
+		return -1;
+	}
+	*argv = args->argv + pos;
+	++*argc;
+
+	return 0;
 }
 
 int main(int argc, char **argv)
 {
+	struct fuse_args args = FUSE_ARGS_INIT(argc, argv);
 	int err = 0;
 	int count;
+	int fd;
 
 	if (argc < 2) {
 		usage(argv[0]);
@@ -58,6 +128,13 @@ int main(int argc, char **argv)
 		return 0;
 	}
 
+	/* removes ls-fuse options, so argv contains files and FUSE options */
+	if (fuse_opt_parse(&args, &ls_opts, ls_fuse_opts, NULL) != 0) {
+		return 1;
+	}
+	argc = args.argc;
+	argv = args.argv;
+
 	if (parser_init() != 0) {
 		return 1;
 	}
@@ -75,19 +152,100 @@ int main(int argc, char **argv)
 		--argc;
 	}
 
-	if (count == 0) {
+	if (count == 0 && ls_opts.progressive != PROGRESSIVE_OFF) {
+		/* FUSE replaces standard input with /dev/null */
+		fd = dup(STDIN_FILENO);
+		if (fd < 0) {
+			LOGE("Can't process <stdin>");
+			return 2;
+		}
+		parse_fd_bg(fd);
+	} else if (count == 0) {
 		err = parse_fd(STDIN_FILENO);
 		if (err != 0) {
 			LOGE("Can't process <stdin>");
 		}
 	}
 
-	parser_destroy();
-
 	if (err != 0) {
 		/* allocated memory will be freed on exit */
 		return 2;
 	}
 
-	return fuse_main(argc, argv, &fuse_oper, NULL);
+	if (count > 0 && ls_opts.progressive != PROGRESSIVE_OFF) {
+		/* files are parsed before mounting, like without the option */
+		LOGE("--progressive is ignored with files, only standard "
+		     "input is parsed in background");
+		ls_opts.progressive = PROGRESSIVE_OFF;
+	}
+
+	if (ls_opts.parse_stats && ls_opts.progressive == PROGRESSIVE_OFF) {
+		parser_print_report();
+	}
+
+	if (!ls_opts.lazy && ls_opts.progressive == PROGRESSIVE_OFF) {
+		/* the tree is complete */
+		parser_destroy();
+		if (node_tree_freeze() != 0) {
+			LOGE("Can't sort directories, lookups will be slower");
+		}
+		if (node_tree_sum() != 0) {
+			LOGE("Can't sum up directories, totals won't be known");
+		}
+		if (ls_opts.search && search_build() != 0) {
+			LOGE("Can't index names, /.lsfuse/search is disabled");
+		}
+	}
+
+	if (ls_opts.lowlevel && (ls_opts.lazy ||
+				 ls_opts.progressive == PROGRESSIVE_WAIT)) {
+		/* unloaded nodes are freed, waiting is done by path */
+		LOGE("--lowlevel isn't supported with --lazy and "
+		     "--progressive=wait, paths are used");
+		ls_opts.lowlevel = 0;
+	}
+
+	if (ls_opts.search && (ls_opts.lazy ||
+			       ls_opts.progressive != PROGRESSIVE_OFF)) {
+		/* the index is built once for the complete tree */
+		LOGE("--search isn't supported with --lazy and --progressive");
+		ls_opts.search = 0;
+	}
+
+	if (ls_opts.immutable && ls_opts.progressive != PROGRESSIVE_OFF) {
+		LOGE("--immutable isn't supported with --progressive, "
+		     "the tree grows while it's mounted");
+		ls_opts.immutable = 0;
+	}
+
+	if (ls_opts.lazy) {
+		/* lazy parsing changes the tree, so requests are serialized */
+		if (insert_arg(&args, &argc, &argv, "-s") != 0) {
+			return 1;
+		}
+	}
+#if FUSE_USE_VERSION < 30
+	/* libfuse 3 and the low-level backend are set up in ls_fuse.c */
+	if (ls_opts.immutable && !ls_opts.lowlevel &&
+	    insert_arg(&args, &argc, &argv, IMMUTABLE_OPTS) != 0) {
+		return 1;
+	}
+#endif
+
+	if (ls_opts.lowlevel) {
+		err = fuse_ll_main(argc, argv);
+	} else {
+		err = fuse_main(argc, argv, &fuse_oper, NULL);
+	}
+	if (ls_opts.lazy) {
+		parser_destroy();
+	}
+	if (ls_opts.progressive == PROGRESSIVE_OFF) {
+		/* otherwise the background parser may still use the tree */
+		search_destroy();
+		node_tree_destroy();
+	}
+	fuse_opt_free_args(&args);
+
+	return err;
 }
@@ -20,6 +20,9 @@
 #ifndef LS_FUSE_MONTHS_H
 #define LS_FUSE_MONTHS_H
 
+#include <sys/types.h>
+#include <stdint.h>
+
 static struct {
 	char *key;
 	int val;
@@ -53,4 +56,33 @@ static struct {
 	{"Дек", 11},
 };
 
+#define MONTH_HASH_SIZE 64
+
+/*
+ * Perfect hash of month_tbl keys: every key has its own slot in
+ * month_hash_tbl. Update the table when month_tbl is changed.
+ */
+static inline unsigned int month_hash(const char *s, size_t len)
+{
+	uint32_t h = 0;
+	size_t i;
+
+	for (i = 0; i < len; i++) {
+		h = h * 6 + (unsigned char)s[i];
+	}
+	return h & (MONTH_HASH_SIZE - 1);
+}
+
+/* index in month_tbl or -1 */
+static const signed char month_hash_tbl[MONTH_HASH_SIZE] = {
+	-1, -1, 15, -1, -1, -1, 13, -1,
+	10, 7, -1, -1, 2, -1, 23, -1,
+	-1, 11, 6, 4, 5, -1, 12, -1,
+	1, 16, -1, 19, 0, -1, -1, -1,
+	-1, 20, 9, -1, -1, -1, 14, -1,
+	-1, -1, -1, 18, -1, 17, -1, -1,
+	21, -1, -1, -1, -1, -1, 3, -1,
+	-1, -1, 8, -1, -1, 22, -1, -1,
+};
+
 #endif /* LS_FUSE_MONTHS_H */
@@ -19,22 +19,238 @@
 
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <pthread.h>
 
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
+#include "hash.h"
 #include "node.h"
 #include "tools.h"
 
+/*
+ * Nodes and ext records are allocated in chunks aligned to their size.
+ * The first slot of a chunk keeps its number, so index of a node can be
+ * found from its address.
+ */
+#define CHUNK_SIZE (1024 * 1024)
+#define NODES_PER_CHUNK ((uint32_t)(CHUNK_SIZE / sizeof(lsnode_t)))
+#define EXTS_PER_CHUNK ((uint32_t)(CHUNK_SIZE / sizeof(struct lsnode_ext)))
+#define NODE_CHUNKS_MAX (NODE_ID_RESERVED / NODES_PER_CHUNK)
+#define EXT_CHUNKS_MAX (UINT32_MAX / EXTS_PER_CHUNK)
+
+/* a regular file costs one node, keep it within half a cache line */
+_Static_assert(sizeof(lsnode_t) <= 32, "lsnode_t must fit 32 bytes");
+
+/* index of the ext record of the root */
+#define ROOT_EXT UINT32_MAX
+
+/* (uid, gid) pairs, nodes refer to them by 16bit index */
+#define OWNERS_MAX (UINT16_MAX + 1)
+
+typedef struct {
+	uint32_t no;
+} chunk_hdr_t;
+
+typedef struct {
+	void **chunks;
+	uint32_t nchunks;
+	uint32_t max;
+	uint32_t per_chunk;
+} pool_t;
+
+typedef struct {
+	uid_t uid;
+	gid_t gid;
+} owner_t;
+
+static void *node_chunks[NODE_CHUNKS_MAX];
+static void *ext_chunks[EXT_CHUNKS_MAX];
+static pool_t node_pool = {
+	.chunks = node_chunks,
+	.max = NODE_CHUNKS_MAX,
+	.per_chunk = NODES_PER_CHUNK,
+};
+static pool_t ext_pool = {
+	.chunks = ext_chunks,
+	.max = EXT_CHUNKS_MAX,
+	.per_chunk = EXTS_PER_CHUNK,
+};
+/* protects pools and the owner table, parsing threads share them */
+static pthread_mutex_t pool_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* the first owner is root:root, so zeroed node_cache_t is valid */
+static owner_t owners[OWNERS_MAX];
+static unsigned int owners_num = 1;
+static hash_tbl_t owners_tbl;
+
+static struct lsnode_ext root_ext;
 static lsnode_t root = {
 	.mode = S_IFDIR | 0755,
 	.name = "/",
+	.name_len = 1,
+	.ext = ROOT_EXT,
 };
 
-lsnode_t *node_alloc(void)
+/* memory of the tree, arenas of parsers are moved here */
+static arena_t tree_arena;
+/* directories by path, see node_tree_index() */
+static hash_tbl_t tree_index;
+
+/*
+ * Bloom filter of names of the frozen tree, a key is a name and the first
+ * entry of its directory. A key sets BLOOM_K bits of one 64-bit word, so
+ * a test reads one cache line. Most missing names are rejected by it
+ * without a search, see node_tree_freeze().
+ */
+#define BLOOM_BITS_PER_NAME 12
+#define BLOOM_K 4
+static uint64_t *tree_bloom;
+static size_t tree_bloom_words;
+/* lookups the filter rejected, it is updated by concurrent readers */
+static unsigned long bloom_rejected;
+/* totals of directories, see node_tree_sum() */
+static node_sum_t *tree_sums;
+static size_t tree_sums_num;
+
+static node_loader_t node_loader;
+/* changes when nodes of the mounted tree are freed, see node_tree_gen() */
+static unsigned long tree_gen;
+/* the tree may be modified while FUSE serves it, see --progressive */
+static pthread_rwlock_t tree_lock = PTHREAD_RWLOCK_INITIALIZER;
+
+/* returns the next index of the range, 0 if memory is exhausted */
+static uint32_t pool_alloc(pool_t *pool, node_range_t *range)
+{
+	chunk_hdr_t *chunk = NULL;
+	uint32_t no;
+
+	if (range->next == range->end) {
+		pthread_mutex_lock(&pool_lock);
+		no = pool->nchunks;
+		if (no < pool->max &&
+		    posix_memalign((void **)&chunk, CHUNK_SIZE,
+				   CHUNK_SIZE) == 0) {
+			chunk->no = no;
+			pool->chunks[no] = chunk;
+			++pool->nchunks;
+		} else {
+			chunk = NULL;
+		}
+		pthread_mutex_unlock(&pool_lock);
+		if (!chunk) {
+			return 0;
+		}
+		/* slot 0 is the header */
+		range->next = no * pool->per_chunk + 1;
+		range->end = (no + 1) * pool->per_chunk;
+	}
+
+	return range->next++;
+}
+
+/* frees chunks [from, to), their indices aren't used again */
+static void pool_free_chunks(pool_t *pool, uint32_t from, uint32_t to)
+{
+	uint32_t i;
+
+	for (i = from; i < to; i++) {
+		free(pool->chunks[i]);
+		pool->chunks[i] = NULL;
+	}
+}
+
+/* chunks freed by node_tree_freeze() aren't counted */
+static size_t pool_mem(const pool_t *pool)
+{
+	size_t mem = 0;
+	uint32_t i;
+
+	for (i = 0; i < pool->nchunks; i++) {
+		if (pool->chunks[i] != NULL) {
+			mem += CHUNK_SIZE;
+		}
+	}
+	return mem;
+}
+
+static void pool_destroy(pool_t *pool)
+{
+	pool_free_chunks(pool, 0, pool->nchunks);
+	pool->nchunks = 0;
+}
+
+lsnode_t *node_ptr(uint32_t id)
+{
+	if (id == 0) {
+		return NULL;
+	}
+	return &((lsnode_t *)node_chunks[id / NODES_PER_CHUNK])
+		[id % NODES_PER_CHUNK];
+}
+
+/* the root has no index */
+uint32_t node_id(const lsnode_t *node)
+{
+	const chunk_hdr_t *chunk;
+	uintptr_t base;
+
+	base = (uintptr_t)node & ~(uintptr_t)(CHUNK_SIZE - 1);
+	chunk = (const chunk_hdr_t *)base;
+
+	return chunk->no * NODES_PER_CHUNK +
+	       (uint32_t)(((uintptr_t)node - base) / sizeof(*node));
+}
+
+/*
+ * Returns index of the node k slots after the node id. Nodes allocated one
+ * after another from a single range are consecutive, only headers of chunks
+ * are skipped.
+ */
+static uint32_t node_id_add(uint32_t id, uint32_t k)
+{
+	const uint32_t per_chunk = NODES_PER_CHUNK - 1;
+	uint32_t pos;
+
+	pos = id / NODES_PER_CHUNK * per_chunk + id % NODES_PER_CHUNK - 1 + k;
+
+	return pos / per_chunk * NODES_PER_CHUNK + pos % per_chunk + 1;
+}
+
+static struct lsnode_ext *ext_ptr(uint32_t id)
+{
+	if (id == 0) {
+		return NULL;
+	}
+	if (id == ROOT_EXT) {
+		return &root_ext;
+	}
+	return &((struct lsnode_ext *)ext_chunks[id / EXTS_PER_CHUNK])
+		[id % EXTS_PER_CHUNK];
+}
+
+struct lsnode_ext *node_ext(const lsnode_t *node)
 {
-	lsnode_t *node = malloc(sizeof(*node));
+	return ext_ptr(node->ext);
+}
+
+lsnode_t *node_alloc(node_cache_t *cache)
+{
+	lsnode_t *node;
+	uint32_t id;
+
+	if (cache->nodes.free != 0) {
+		id = cache->nodes.free;
+		cache->nodes.free = node_ptr(id)->next;
+	} else {
+		id = pool_alloc(&node_pool, &cache->nodes);
+	}
+
+	node = node_ptr(id);
 	if (node) {
 		memset(node, 0, sizeof(*node));
 	}
@@ -42,14 +258,619 @@ lsnode_t *node_alloc(void)
 	return node;
 }
 
-void node_free(lsnode_t *node)
+/* returns the ext record of the node, it is allocated if needed */
+struct lsnode_ext *node_ext_alloc(node_cache_t *cache, lsnode_t *node)
+{
+	struct lsnode_ext *ext;
+	uint32_t id;
+
+	if (node->ext != 0) {
+		return node_ext(node);
+	}
+	if (cache->exts.free != 0) {
+		id = cache->exts.free;
+		cache->exts.free = ext_ptr(id)->entry;
+	} else {
+		id = pool_alloc(&ext_pool, &cache->exts);
+	}
+
+	ext = ext_ptr(id);
+	if (ext) {
+		memset(ext, 0, sizeof(*ext));
+		node->ext = id;
+	}
+
+	return ext;
+}
+
+/* the node and its ext record may be reused by the cache's thread */
+void node_free(node_cache_t *cache, lsnode_t *node)
+{
+	if (node == NULL) {
+		return;
+	}
+	if (node->ext != 0) {
+		ext_ptr(node->ext)->entry = cache->exts.free;
+		cache->exts.free = node->ext;
+	}
+	node->next = cache->nodes.free;
+	cache->nodes.free = node_id(node);
+}
+
+/* returns false if the table is full */
+static bool owner_id(node_cache_t *cache, uid_t uid, gid_t gid,
+		     uint16_t *id)
+{
+	owner_t key;
+	long value;
+
+	if (cache->uid == uid && cache->gid == gid) {
+		*id = cache->owner;
+		return true;
+	}
+
+	memset(&key, 0, sizeof(key));
+	key.uid = uid;
+	key.gid = gid;
+	pthread_mutex_lock(&pool_lock);
+	value = hash_get(&owners_tbl, (const char *)&key, sizeof(key));
+	if (value < 0 && owners_num < OWNERS_MAX &&
+	    hash_add(&owners_tbl, (const char *)&key, sizeof(key),
+		     (long)owners_num) == 0) {
+		value = (long)owners_num;
+		owners[owners_num++] = key;
+	}
+	pthread_mutex_unlock(&pool_lock);
+	if (value < 0) {
+		return false;
+	}
+
+	cache->uid = uid;
+	cache->gid = gid;
+	cache->owner = (uint16_t)value;
+	*id = cache->owner;
+
+	return true;
+}
+
+static bool is_dev(mode_t mode)
+{
+	return S_ISCHR(mode) || S_ISBLK(mode);
+}
+
+/* blocks a file of the size takes if ls -s doesn't tell otherwise */
+static blkcnt_t size_blocks(mode_t mode, off_t size)
+{
+	return is_dev(mode) ? 0 : (blkcnt_t)((size + 511) / 512);
+}
+
+/*
+ * Packs the attributes to the node. Entries, ndir and flags other than
+ * NODE_F_EXT_* are kept. name_len mustn't exceed NODE_NAME_MAX.
+ */
+int node_set_attr(node_cache_t *cache, lsnode_t *node,
+		  const node_attr_t *attr)
+{
+	struct lsnode_ext *ext = node_ext(node);
+	unsigned long long size;
+	uint16_t owner = 0;
+	bool big_size;
+	bool big_time;
+	bool big_owner;
+	bool own_blocks;
+
+	size = is_dev(attr->mode) ? (unsigned long long)attr->rdev :
+				    (unsigned long long)attr->size;
+	big_size = size > UINT32_MAX;
+	big_time = attr->time < 0 ||
+		   (unsigned long long)attr->time > UINT32_MAX;
+	big_owner = !owner_id(cache, attr->uid, attr->gid, &owner);
+	own_blocks = attr->blocks >= 0 &&
+		     attr->blocks != size_blocks(attr->mode, attr->size);
+
+	if (!ext && (S_ISDIR(attr->mode) || attr->data || attr->selinux ||
+		     big_size || big_time || big_owner || own_blocks)) {
+		ext = node_ext_alloc(cache, node);
+		if (!ext) {
+			return -ENOMEM;
+		}
+	}
+
+	node->name = attr->name;
+	node->name_len = (uint16_t)attr->name_len;
+	node->mode = (uint16_t)attr->mode;
+	node->size = big_size ? 0 : (uint32_t)size;
+	node->time = big_time ? 0 : (uint32_t)attr->time;
+	node->owner = owner;
+	node->flags &= ~(NODE_F_EXT_SIZE | NODE_F_EXT_TIME | NODE_F_EXT_OWNER |
+			 NODE_F_EXT_BLOCKS);
+	node->flags |= (big_size ? NODE_F_EXT_SIZE : 0) |
+		       (big_time ? NODE_F_EXT_TIME : 0) |
+		       (big_owner ? NODE_F_EXT_OWNER : 0) |
+		       (own_blocks ? NODE_F_EXT_BLOCKS : 0);
+	if (ext) {
+		ext->data = attr->data;
+		ext->data_len = attr->data_len;
+		ext->selinux = attr->selinux;
+		ext->size = (off_t)size;
+		ext->time = attr->time;
+		ext->uid = attr->uid;
+		ext->gid = attr->gid;
+		ext->blocks = attr->blocks;
+	}
+
+	return 0;
+}
+
+void node_get_attr(const lsnode_t *node, node_attr_t *attr)
+{
+	const struct lsnode_ext *ext = node_ext(node);
+	off_t size = node->flags & NODE_F_EXT_SIZE ? ext->size :
+						     (off_t)node->size;
+
+	memset(attr, 0, sizeof(*attr));
+	attr->mode = node->mode;
+	if (is_dev(node->mode)) {
+		attr->rdev = (dev_t)size;
+	} else {
+		attr->size = size;
+	}
+	attr->time = node->flags & NODE_F_EXT_TIME ? ext->time :
+						     (time_t)node->time;
+	if (node->flags & NODE_F_EXT_OWNER) {
+		attr->uid = ext->uid;
+		attr->gid = ext->gid;
+	} else {
+		attr->uid = owners[node->owner].uid;
+		attr->gid = owners[node->owner].gid;
+	}
+	attr->blocks = node->flags & NODE_F_EXT_BLOCKS ? ext->blocks :
+			size_blocks(node->mode, attr->size);
+	attr->name = node->name;
+	attr->name_len = node->name_len;
+	if (ext) {
+		attr->selinux = ext->selinux;
+		attr->data = ext->data;
+		attr->data_len = ext->data_len;
+	}
+}
+
+lsnode_t *node_entry(const lsnode_t *dir)
+{
+	const struct lsnode_ext *ext = node_ext(dir);
+
+	return ext ? node_ptr(ext->entry) : NULL;
+}
+
+lsnode_t *node_next(const lsnode_t *node)
+{
+	return node_ptr(node->next);
+}
+
+/* returns the k-th entry, a sorted directory doesn't walk the list */
+lsnode_t *node_entry_at(const lsnode_t *dir, uint32_t k)
+{
+	const struct lsnode_ext *ext = node_ext(dir);
+	lsnode_t *node;
+
+	if (!ext) {
+		return NULL;
+	}
+	if (dir->flags & NODE_F_SORTED) {
+		return k < ext->nentry ? node_ptr(node_id_add(ext->entry, k))
+				       : NULL;
+	}
+	for (node = node_ptr(ext->entry); node && k > 0; k--) {
+		node = node_next(node);
+	}
+
+	return node;
+}
+
+unsigned int node_ndir(const lsnode_t *dir)
+{
+	const struct lsnode_ext *ext = node_ext(dir);
+
+	return ext ? ext->ndir : 0;
+}
+
+/* parent must be a directory, node must have an index */
+void node_insert(lsnode_t *parent, lsnode_t *node)
+{
+	struct lsnode_ext *ext = node_ext(parent);
+
+	node->next = ext->entry;
+	ext->entry = node_id(node);
+	if (S_ISDIR(node->mode)) {
+		ext->ndir++;
+	}
+}
+
+/* the tree takes strings of the arena, caller must hold the write lock */
+void node_tree_adopt(arena_t *arena)
+{
+	arena_move(&tree_arena, arena);
+}
+
+/* names are compared bytewise, like ls does in the C locale */
+static int name_cmp(const char *a, size_t a_len, const char *b, size_t b_len)
+{
+	int res = 0;
+
+	if (a_len > 0 && b_len > 0) {
+		res = memcmp(a, b, a_len < b_len ? a_len : b_len);
+	}
+	if (res == 0 && a_len != b_len) {
+		res = a_len < b_len ? -1 : 1;
+	}
+
+	return res;
+}
+
+typedef struct {
+	const lsnode_t *node;
+	/* position in the list, entries of the same name keep their order */
+	uint32_t pos;
+} freeze_ent_t;
+
+/* new entries of a directory, they are set when the tree is built */
+typedef struct {
+	struct lsnode_ext *ext;
+	uint32_t entry;
+	uint32_t nentry;
+} freeze_dir_t;
+
+static int freeze_cmp(const void *a, const void *b)
+{
+	const freeze_ent_t *x = (const freeze_ent_t *)a;
+	const freeze_ent_t *y = (const freeze_ent_t *)b;
+	int res;
+
+	res = name_cmp(x->node->name, x->node->name_len,
+		       y->node->name, y->node->name_len);
+	if (res == 0) {
+		res = x->pos < y->pos ? -1 : 1;
+	}
+
+	return res;
+}
+
+/* mixes the name hash with the directory, like murmur3 finalizer */
+static uint64_t bloom_hash(uint32_t entry, const char *name, size_t len)
+{
+	uint64_t h = (uint64_t)hash_func(name, len) << 32 | entry;
+
+	h ^= h >> 33;
+	h *= 0xff51afd7ed558ccdULL;
+	h ^= h >> 33;
+	h *= 0xc4ceb9fe1a85ec53ULL;
+	h ^= h >> 33;
+
+	return h;
+}
+
+/* the word is chosen by the low half, bits are taken from the high one */
+static uint64_t bloom_bits(uint64_t h)
+{
+	uint64_t bits = 0;
+	int i;
+
+	for (i = 0; i < BLOOM_K; i++) {
+		bits |= 1ULL << ((h >> (32 + i * 6)) & 63);
+	}
+
+	return bits;
+}
+
+static bool bloom_test(uint32_t entry, const char *name, size_t len)
+{
+	uint64_t h;
+	uint64_t bits;
+
+	if (!tree_bloom) {
+		return true;
+	}
+	h = bloom_hash(entry, name, len);
+	bits = bloom_bits(h);
+
+	return (tree_bloom[h & (tree_bloom_words - 1)] & bits) == bits;
+}
+
+/* the filter is optional, without memory lookups just search */
+static void bloom_build(const freeze_dir_t *dirs, size_t ndirs, uint32_t n)
+{
+	size_t words = 1;
+	const lsnode_t *node;
+	uint64_t h;
+	size_t i;
+	uint32_t k;
+
+	free(tree_bloom);
+	tree_bloom = NULL;
+
+	while (words * 64 < (size_t)n * BLOOM_BITS_PER_NAME) {
+		words *= 2;
+	}
+	tree_bloom = (uint64_t *)calloc(words, sizeof(*tree_bloom));
+	if (!tree_bloom) {
+		return;
+	}
+	tree_bloom_words = words;
+
+	for (i = 0; i < ndirs; i++) {
+		for (k = 0; k < dirs[i].nentry; k++) {
+			node = node_ptr(node_id_add(dirs[i].entry, k));
+			if (node->name == NULL) {
+				continue;
+			}
+			h = bloom_hash(dirs[i].entry, node->name,
+				       node->name_len);
+			tree_bloom[h & (words - 1)] |= bloom_bits(h);
+		}
+	}
+}
+
+/*
+ * Sums up every directory of a complete tree. Directories are collected in
+ * BFS order and summed in reverse, so subdirectories are summed first and
+ * deep trees don't recurse. Hard links are counted as many times as they
+ * are listed, like du -l does.
+ */
+int node_tree_sum(void)
+{
+	const node_sum_t *sub;
+	lsnode_t **dirs = NULL;
+	node_sum_t *sums;
+	node_sum_t *sum;
+	node_attr_t attr;
+	lsnode_t *node;
+	size_t size = 0;
+	size_t n = 1;
+	size_t i;
+	void *tmp;
+
+	dirs = (lsnode_t **)grow(dirs, &size, n, sizeof(*dirs));
+	if (!dirs) {
+		return -ENOMEM;
+	}
+	dirs[0] = &root;
+	for (i = 0; i < n; i++) {
+		for (node = node_entry(dirs[i]); node != NULL;
+		     node = node_next(node)) {
+			if (!S_ISDIR(node->mode) || !node_ext(node)) {
+				continue;
+			}
+			tmp = grow(dirs, &size, n + 1, sizeof(*dirs));
+			if (!tmp) {
+				free(dirs);
+				return -ENOMEM;
+			}
+			dirs = (lsnode_t **)tmp;
+			dirs[n++] = node;
+		}
+	}
+
+	sums = (node_sum_t *)calloc(n, sizeof(*sums));
+	if (!sums) {
+		free(dirs);
+		return -ENOMEM;
+	}
+	free(tree_sums);
+	tree_sums = sums;
+	tree_sums_num = n;
+
+	for (i = n; i-- > 0;) {
+		sum = &sums[i];
+		for (node = node_entry(dirs[i]); node != NULL;
+		     node = node_next(node)) {
+			node_get_attr(node, &attr);
+			sum->size += attr.size;
+			sum->blocks += attr.blocks;
+			sub = node_sum(node);
+			if (!sub) {
+				sum->files += !S_ISDIR(node->mode);
+				sum->dirs += S_ISDIR(node->mode);
+				continue;
+			}
+			sum->files += sub->files;
+			sum->dirs += sub->dirs + 1;
+			sum->size += sub->size;
+			sum->blocks += sub->blocks;
+		}
+		node_ext(dirs[i])->sum = sum;
+	}
+	free(dirs);
+
+	return 0;
+}
+
+/* totals of the directory, NULL if the tree isn't summed up */
+const node_sum_t *node_sum(const lsnode_t *dir)
+{
+	const struct lsnode_ext *ext = node_ext(dir);
+
+	return S_ISDIR(dir->mode) && ext ? ext->sum : NULL;
+}
+
+/* lookups rejected by the filter and its size in bytes */
+void node_filter_stats(unsigned long *rejected, size_t *size)
+{
+	*rejected = __atomic_load_n(&bloom_rejected, __ATOMIC_RELAXED);
+	*size = tree_bloom ? tree_bloom_words * sizeof(*tree_bloom) : 0;
+}
+
+/* memory of the tree, chunks are counted whole */
+void node_mem_stats(node_mem_t *mem)
+{
+	pthread_mutex_lock(&pool_lock);
+	mem->nodes = pool_mem(&node_pool);
+	mem->exts = pool_mem(&ext_pool);
+	mem->owners = owners_num * sizeof(owner_t) + hash_mem(&owners_tbl);
+	pthread_mutex_unlock(&pool_lock);
+	mem->names = tree_arena.mem;
+	mem->index = hash_mem(&tree_index);
+	mem->filter = tree_bloom ? tree_bloom_words * sizeof(*tree_bloom) : 0;
+	mem->sums = tree_sums_num * sizeof(*tree_sums);
+}
+
+/*
+ * Symlinks and files with large attributes have ext records too. A header
+ * which names a file keeps entries under the file.
+ */
+static bool has_entries(const lsnode_t *node)
+{
+	return node->ext != 0 &&
+	       (S_ISDIR(node->mode) || ext_ptr(node->ext)->entry != 0);
+}
+
+/*
+ * Copies nodes to new chunks in BFS order, so entries of every directory
+ * are contiguous and sorted by name, node_lookup_child() uses binary search
+ * then. Old chunks are freed. The tree mustn't change after it, so it is
+ * done only when everything is parsed. If memory is exhausted the tree
+ * stays as it is.
+ */
+int node_tree_freeze(void)
 {
-	if (node != NULL) {
-		free(node->selinux);
-		free(node->name);
-		free(node->data);
-		free(node);
+	uint32_t old_nchunks = node_pool.nchunks;
+	uint32_t *moved = NULL;
+	node_cache_t cache;
+	freeze_ent_t *ents = NULL;
+	freeze_dir_t *dirs = NULL;
+	freeze_dir_t *fdir;
+	size_t ents_size = 0;
+	size_t dirs_size = 0;
+	size_t ndirs = 0;
+	uint32_t base = 0;
+	uint32_t placed = 0;
+	uint32_t visited = 0;
+	uint32_t n;
+	uint32_t i;
+	lsnode_t *dir = &root;
+	lsnode_t *node;
+	lsnode_t *copy;
+	lsnode_t *prev;
+	void *tmp;
+	int err = 0;
+
+	memset(&cache, 0, sizeof(cache));
+
+	if (tree_index.count > 0) {
+		/* new index of every node, values of the index are updated */
+		moved = (uint32_t *)calloc((size_t)old_nchunks *
+					   NODES_PER_CHUNK, sizeof(*moved));
+		if (!moved) {
+			return -ENOMEM;
+		}
+	}
+
+	while (dir != NULL) {
+		n = 0;
+		for (node = node_entry(dir); node != NULL;
+		     node = node_next(node)) {
+			tmp = grow(ents, &ents_size, n + 1, sizeof(*ents));
+			if (!tmp) {
+				err = -ENOMEM;
+				goto out;
+			}
+			ents = (freeze_ent_t *)tmp;
+			ents[n].node = node;
+			ents[n].pos = n;
+			++n;
+		}
+		qsort(ents, n, sizeof(*ents), freeze_cmp);
+
+		tmp = grow(dirs, &dirs_size, ndirs + 1, sizeof(*dirs));
+		if (!tmp) {
+			err = -ENOMEM;
+			goto out;
+		}
+		dirs = (freeze_dir_t *)tmp;
+		fdir = &dirs[ndirs++];
+		fdir->ext = node_ext(dir);
+		fdir->entry = 0;
+		fdir->nentry = n;
+
+		prev = NULL;
+		for (i = 0; i < n; i++) {
+			copy = node_alloc(&cache);
+			if (!copy) {
+				err = -ENOMEM;
+				goto out;
+			}
+			*copy = *ents[i].node;
+			copy->next = 0;
+			if (moved) {
+				moved[node_id(ents[i].node)] = node_id(copy);
+			}
+			if (has_entries(copy)) {
+				copy->flags |= NODE_F_SORTED;
+			}
+			if (prev) {
+				prev->next = node_id(copy);
+			} else {
+				fdir->entry = node_id(copy);
+			}
+			if (base == 0) {
+				base = node_id(copy);
+			}
+			prev = copy;
+		}
+		placed += n;
+
+		/* the next node with entries in BFS order */
+		dir = NULL;
+		while (dir == NULL && visited < placed) {
+			node = node_ptr(node_id_add(base, visited++));
+			if (has_entries(node)) {
+				dir = node;
+			}
+		}
+	}
+
+	for (i = 0; i < ndirs; i++) {
+		dirs[i].ext->entry = dirs[i].entry;
+		dirs[i].ext->nentry = dirs[i].nentry;
 	}
+	for (i = 0; moved && i < tree_index.size; i++) {
+		if (tree_index.slots[i].key != NULL) {
+			/* a node out of the tree isn't found anymore */
+			tree_index.slots[i].value =
+				moved[tree_index.slots[i].value];
+		}
+	}
+	root.flags |= NODE_F_SORTED;
+	pool_free_chunks(&node_pool, 0, old_nchunks);
+	bloom_build(dirs, ndirs, placed);
+
+out:
+	if (err != 0) {
+		pool_free_chunks(&node_pool, old_nchunks, node_pool.nchunks);
+		node_pool.nchunks = old_nchunks;
+	}
+	free(ents);
+	free(dirs);
+	free(moved);
+
+	return err;
+}
+
+/* releases the whole tree at once, it mustn't be used after it */
+void node_tree_destroy(void)
+{
+	pool_destroy(&node_pool);
+	pool_destroy(&ext_pool);
+	arena_destroy(&tree_arena);
+	hash_destroy(&tree_index);
+	hash_destroy(&owners_tbl);
+	free(tree_bloom);
+	tree_bloom = NULL;
+	free(tree_sums);
+	tree_sums = NULL;
+	tree_sums_num = 0;
+	owners_num = 1;
+	memset(&root_ext, 0, sizeof(root_ext));
+	root.flags &= ~NODE_F_SORTED;
 }
 
 lsnode_t *node_get_root(void)
@@ -57,99 +878,309 @@ lsnode_t *node_get_root(void)
 	return &root;
 }
 
-/* node_create_data must be thread safe */
-void node_create_data(lsnode_t *node)
+/*
+ * Directories of the tree by path without the leading '/', components are
+ * separated by a single '/'. Values are indices of nodes. The parser keeps
+ * it, readers must hold the tree lock.
+ */
+hash_tbl_t *node_tree_index(void)
+{
+	return &tree_index;
+}
+
+/* returns NULL if the path isn't indexed */
+lsnode_t *node_index_get(const hash_tbl_t *index, const char *path,
+			 size_t len)
+{
+	long id = hash_get(index, path, len);
+
+	return id > 0 ? node_ptr((uint32_t)id) : NULL;
+}
+
+/* a window of the rendered content, see node_render() */
+typedef struct {
+	char *buf;
+	size_t size;
+	unsigned long long offset;
+	unsigned long long len;
+} render_t;
+
+/* appends the string to the content, only its part in the window is copied */
+static void render_str(render_t *r, const char *s, size_t len)
+{
+	unsigned long long pos = r->len;
+	unsigned long long start = pos > r->offset ? pos : r->offset;
+	unsigned long long end = r->offset + r->size;
+
+	r->len += len;
+	if (r->len < end) {
+		end = r->len;
+	}
+	if (start < end) {
+		memcpy(&r->buf[start - r->offset], &s[start - pos],
+		       (size_t)(end - start));
+	}
+}
+
+static void render_line(render_t *r, const char *field, const char *s,
+			size_t len)
+{
+	render_str(r, field, strlen(field));
+	render_str(r, s, len);
+	render_str(r, "\n", 1);
+}
+
+/* permissions like ls prints them */
+static void mode_to_str(mode_t mode, char str[11])
+{
+	static const char rwx[] = "rwxrwxrwx";
+	int i;
+
+	str[0] = S_ISDIR(mode) ? 'd' : S_ISLNK(mode) ? 'l' :
+		 S_ISCHR(mode) ? 'c' : S_ISBLK(mode) ? 'b' :
+		 S_ISFIFO(mode) ? 'p' : S_ISSOCK(mode) ? 's' : '-';
+	for (i = 0; i < 9; i++) {
+		str[i + 1] = (mode & (0400 >> i)) ? rwx[i] : '-';
+	}
+	if (mode & S_ISUID) {
+		str[3] = str[3] == 'x' ? 's' : 'S';
+	}
+	if (mode & S_ISGID) {
+		str[6] = str[6] == 'x' ? 's' : 'S';
+	}
+	if (mode & S_ISVTX) {
+		str[9] = str[9] == 'x' ? 't' : 'T';
+	}
+	str[10] = '\0';
+}
+
+/*
+ * Renders content of a file: copies at most size bytes from the offset to
+ * buf and returns length of the whole content. Nothing is allocated, so it
+ * is thread safe under the tree lock. With size 0 only the length is found.
+ */
+long long node_render(const lsnode_t *node, char *buf, size_t size,
+		      off_t offset)
 {
-	static const char data[] = "File: %s\n"
-				   "Size: %s\n"
-				   "Mode: %s\n"
-				   "Owner: %s\n"
-				   "SELinux context: %s\n";
 	static const char units[] = {'\0', 'K', 'M', 'G', 'T', 'P'};
 
-	char *mode;
-	char *owner;
-	char *selinux;
-	char size[8];
+	node_attr_t attr;
+	render_t r;
+	char size_str[8];
+	char mode_str[11];
+	char owner_str[24];
 	size_t n;
 	int i;
 	off_t cut;
 
-	if (!node->name) {
-		return;
+	node_get_attr(node, &attr);
+	if (!attr.name || offset < 0) {
+		return -1;
 	}
 
-	/* TODO: implement mode and owner */
-	selinux = owner = mode = "";
-	if (node->selinux != NULL) {
-		selinux = node->selinux;
-	}
-	
-	cut = node->size;
+	cut = attr.size;
 	n = 0;
-	while (cut >= 10000 && n < ARRAY_SIZE(units)) {
+	while (cut >= 10000 && n < ARRAY_SIZE(units) - 1) {
 		cut /= 1024;
 		n++;
 	}
-	i = snprintf(size, sizeof(size), "%d%c", (int)cut, units[n]);
-	if (i < 0 || i >= (int)sizeof(size)) {
-		snprintf(size, sizeof(size), "NaN");
+	i = snprintf(size_str, sizeof(size_str), "%d%c", (int)cut, units[n]);
+	if (i < 0 || i >= (int)sizeof(size_str)) {
+		snprintf(size_str, sizeof(size_str), "NaN");
 	}
+	mode_to_str(attr.mode, mode_str);
+	snprintf(owner_str, sizeof(owner_str), "%u:%u", (unsigned)attr.uid,
+		 (unsigned)attr.gid);
+
+	r.buf = buf;
+	r.size = size;
+	r.offset = (unsigned long long)offset;
+	r.len = 0;
+	render_line(&r, "File: ", attr.name, attr.name_len);
+	render_line(&r, "Size: ", size_str, strlen(size_str));
+	render_line(&r, "Mode: ", mode_str, strlen(mode_str));
+	render_line(&r, "Owner: ", owner_str, strlen(owner_str));
+	render_line(&r, "SELinux context: ", attr.selinux ? attr.selinux : "",
+		    attr.selinux ? strlen(attr.selinux) : 0);
+
+	return (long long)r.len;
+}
 
-	n = strlen(node->name) + strlen(size) + strlen(mode) + strlen(owner) +
-	    strlen(selinux) + sizeof(data) - 10;
+/* returns the first entry of the name, like the list search does */
+static lsnode_t *lookup_sorted(const lsnode_t *parent, const char *name,
+			       size_t len)
+{
+	const struct lsnode_ext *ext = node_ext(parent);
+	uint32_t lo = 0;
+	uint32_t hi = ext->nentry;
+	uint32_t mid;
+	lsnode_t *node;
 
-	if (node->data) {
-		free(node->data);
+	if (!bloom_test(ext->entry, name, len)) {
+		__atomic_fetch_add(&bloom_rejected, 1, __ATOMIC_RELAXED);
+		return NULL;
 	}
-	node->data = malloc(n);
-	if (node->data != NULL) {
-		i = snprintf(node->data, n, data, node->name, size, mode, owner,
-			     selinux);
-		if (i != (int)n - 1) {
-			free(node->data);
-			node->data = NULL;
+
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		node = node_ptr(node_id_add(ext->entry, mid));
+		if (name_cmp(node->name, node->name_len, name, len) < 0) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
 		}
 	}
+	if (lo == ext->nentry) {
+		return NULL;
+	}
+
+	node = node_ptr(node_id_add(ext->entry, lo));
+	if (node->name && name_cmp(node->name, node->name_len,
+				   name, len) == 0) {
+		return node;
+	}
+
+	return NULL;
 }
 
-/* node_from_path must be thread safe */
-lsnode_t *node_from_path(const char * const path)
+lsnode_t *node_lookup_child(lsnode_t *parent, const char *name, size_t len)
 {
-	lsnode_t *parent;
 	lsnode_t *node;
-	char *tmp = strdup(path);
-	char *tok;
-	char *saveptr = NULL;
 
-	parent = node_get_root();
-	tok = strtok_r(tmp, "/", &saveptr);
+	if (parent->flags & NODE_F_SORTED) {
+		return lookup_sorted(parent, name, len);
+	}
+
+	for (node = node_entry(parent); node != NULL; node = node_next(node)) {
+		if (node->name && node->name_len == len &&
+		    !memcmp(name, node->name, len)) {
+			return node;
+		}
+	}
+
+	return NULL;
+}
+
+void node_tree_rdlock(void)
+{
+	pthread_rwlock_rdlock(&tree_lock);
+}
+
+void node_tree_wrlock(void)
+{
+	pthread_rwlock_wrlock(&tree_lock);
+}
 
-	while (tok) {
-		if (strcmp(tok, ".") == 0) {
+void node_tree_unlock(void)
+{
+	pthread_rwlock_unlock(&tree_lock);
+}
+
+void node_set_loader(node_loader_t loader)
+{
+	node_loader = loader;
+}
+
+/* makes sure entries of the directory are parsed */
+void node_load(lsnode_t *dir)
+{
+	const struct lsnode_ext *ext = node_ext(dir);
+
+	if (ext && ext->block != NULL && node_loader != NULL) {
+		node_loader(dir);
+	}
+}
+
+/*
+ * Readers which keep indices of nodes between requests compare it, the
+ * nodes may be freed and reused if it changed. Only lazy loading frees
+ * nodes of a mounted tree and it serves requests in a single thread.
+ */
+unsigned long node_tree_gen(void)
+{
+	return tree_gen;
+}
+
+void node_tree_changed(void)
+{
+	++tree_gen;
+}
+
+static lsnode_t *lookup(lsnode_t *root, const char *path, bool load)
+{
+	lsnode_t *parent = root;
+	const char *name;
+	size_t len;
+
+	while (parent) {
+		while (*path == '/') {
+			++path;
+		}
+		if (*path == '\0') {
+			break;
+		}
+		name = path;
+		while (*path != '\0' && *path != '/') {
+			++path;
+		}
+		len = (size_t)(path - name);
+
+		if (len == 1 && name[0] == '.') {
 			/* do nothing, parent remains the same */
-		} else if (strcmp(tok, "..") == 0) {
+		} else if (len == 2 && name[0] == '.' && name[1] == '.') {
 			/* TODO: not implemented yet (doubly linked list?) */
 		} else {
-			node = parent->entry;
-			parent = NULL;
-			while (node) {
-				if (node->name && !strcmp(tok, node->name)) {
-					parent = node;
-					break;
-				}
-				node = node->next;
-			}
-
-			if (!parent) {
-				break;
+			if (load) {
+				node_load(parent);
 			}
+			parent = node_lookup_child(parent, name, len);
 		}
+	}
+
+	return parent;
+}
+
+/* node_lookup must be thread safe */
+lsnode_t *node_lookup(lsnode_t *root, const char * const path)
+{
+	return lookup(root, path, false);
+}
 
-		tok = strtok_r(NULL, "/", &saveptr);
+/*
+ * node_from_path must be thread safe unless lazy parsing is used. The
+ * directory of the result is parsed if needed, but the result itself isn't.
+ */
+lsnode_t *node_from_path(const char * const path)
+{
+	const char *key = path;
+	const char *name;
+	lsnode_t *parent;
+	size_t name_len;
+	size_t len;
+
+	while (*key == '/') {
+		++key;
 	}
+	len = strlen(key);
+	if (len == 0) {
+		return &root;
+	}
+	name = &key[len];
+	while (name > key && name[-1] != '/') {
+		--name;
+	}
+	name_len = len - (size_t)(name - key);
 
-	free(tmp);
+	/* FUSE passes canonical paths, the rest is walked from the root */
+	parent = &root;
+	if (name > key) {
+		parent = node_index_get(&tree_index, key,
+					(size_t)(name - key) - 1);
+	}
+	if (!parent || name_len == 0 || is_dot(name, name_len)) {
+		return lookup(&root, path, true);
+	}
 
-	return parent;
+	node_load(parent);
+	return node_lookup_child(parent, name, name_len);
 }
@@ -21,31 +21,182 @@
 #define LS_FUSE_NODE_H
 
 #include <sys/types.h>
+#include <stdint.h>
 
+#include "arena.h"
+#include "hash.h"
+
+/* directory is created for a path of a header, it isn't listed itself */
+#define NODE_F_FAKE 0x1
+/* directory is created while indexing input for lazy parsing, it is kept */
+#define NODE_F_INDEX 0x2
+/* parser has left the directory's block, it won't get more entries */
+#define NODE_F_DONE 0x4
+/* size (or rdev), time or owner don't fit the node, they are in the ext */
+#define NODE_F_EXT_SIZE 0x8
+#define NODE_F_EXT_TIME 0x10
+#define NODE_F_EXT_OWNER 0x20
+/* entries of the directory are contiguous and sorted by name */
+#define NODE_F_SORTED 0x40
+/* listed blocks differ from the ones the size takes, they are in the ext */
+#define NODE_F_EXT_BLOCKS 0x80
+
+/* longer names aren't supported */
+#define NODE_NAME_MAX UINT16_MAX
+/* indices from it up aren't given to nodes, see fuse_ll_oper */
+#define NODE_ID_RESERVED (UINT32_MAX - 255)
+
+/* bytes of memory of the tree, see node_mem_stats() */
+typedef struct {
+	/* chunks of nodes and ext records, headers included */
+	size_t nodes;
+	size_t exts;
+	/* names, link targets and contexts which don't point to the input */
+	size_t names;
+	/* (uid, gid) pairs and their hash table */
+	size_t owners;
+	/* directory index with its keys */
+	size_t index;
+	size_t filter;
+	size_t sums;
+} node_mem_t;
+
+/* input of a directory which isn't parsed yet, see parser.c */
+struct lsblock;
+
+/* totals of entries below a directory, see node_tree_sum() */
+typedef struct {
+	uint64_t files;
+	uint64_t dirs;
+	/* apparent size in bytes */
+	off_t size;
+	/* 512-byte blocks */
+	blkcnt_t blocks;
+} node_sum_t;
+
+/*
+ * Attributes most entries don't have. Directories always have the record,
+ * other nodes only if they need it.
+ */
+struct lsnode_ext {
+	/* index of the first entry of a directory */
+	uint32_t entry;
+	/* number of subdirectories */
+	uint32_t ndir;
+	/* number of entries, it is valid if the directory is NODE_F_SORTED */
+	uint32_t nentry;
+	/* entries are parsed on first access if it isn't NULL */
+	struct lsblock *block;
+	/* symlink target, it isn't null-terminated */
+	char *data;
+	size_t data_len;
+	char *selinux;
+	off_t size;
+	time_t time;
+	uid_t uid;
+	gid_t gid;
+	blkcnt_t blocks;
+	/* NULL unless the tree is complete */
+	node_sum_t *sum;
+};
+
+/*
+ * Node takes 32 bytes on 64bit systems. Nodes and ext records are referred
+ * to by 32bit indices, 0 means none. Strings belong to mapped input or an
+ * arena. name isn't null-terminated when it points to mapped input, use
+ * name_len.
+ */
 struct lsnode {
+	char *name;
+	/* next entry of the same directory */
+	uint32_t next;
+	uint32_t ext;
+	/* size or rdev of a device file */
+	uint32_t size;
+	/* seconds since the Epoch */
+	uint32_t time;
+	uint16_t mode;
+	uint16_t name_len;
+	/* index in the table of (uid, gid) pairs */
+	uint16_t owner;
+	uint16_t flags;
+};
+
+typedef struct lsnode lsnode_t;
+
+/* attributes of an entry in the full form, see node_set_attr() */
+typedef struct {
 	mode_t mode;
 	uid_t uid;
 	gid_t gid;
 	off_t size;
 	dev_t rdev;
-	int month;
 	time_t time;
+	/* 512-byte blocks, negative means they are found from the size */
+	blkcnt_t blocks;
 	char *selinux;
 	char *name;
+	size_t name_len;
 	char *data;
-	/* number of subdirectories */
-	int ndir;
-	struct lsnode *entry;
-	struct lsnode *next;
-};
+	size_t data_len;
+} node_attr_t;
 
-typedef struct lsnode lsnode_t;
-typedef void (*handler_t)(lsnode_t *, const char *);
+/* range of indices reserved by a thread and recycled indices */
+typedef struct {
+	uint32_t next;
+	uint32_t end;
+	uint32_t free;
+} node_range_t;
+
+/* allocator state of a thread, zeroed cache is empty */
+typedef struct {
+	node_range_t nodes;
+	node_range_t exts;
+	/* the last owner */
+	uid_t uid;
+	gid_t gid;
+	uint16_t owner;
+} node_cache_t;
+
+/* parses entries of a directory with a block */
+typedef void (*node_loader_t)(lsnode_t *dir);
 
-lsnode_t *node_alloc(void);
-void node_free(lsnode_t *node);
+lsnode_t *node_alloc(node_cache_t *cache);
+void node_free(node_cache_t *cache, lsnode_t *node);
+int node_set_attr(node_cache_t *cache, lsnode_t *node,
+		  const node_attr_t *attr);
+void node_get_attr(const lsnode_t *node, node_attr_t *attr);
+uint32_t node_id(const lsnode_t *node);
+lsnode_t *node_ptr(uint32_t id);
+struct lsnode_ext *node_ext(const lsnode_t *node);
+struct lsnode_ext *node_ext_alloc(node_cache_t *cache, lsnode_t *node);
+lsnode_t *node_entry(const lsnode_t *dir);
+lsnode_t *node_next(const lsnode_t *node);
+lsnode_t *node_entry_at(const lsnode_t *dir, uint32_t k);
+unsigned int node_ndir(const lsnode_t *dir);
+void node_insert(lsnode_t *parent, lsnode_t *node);
+void node_tree_adopt(arena_t *arena);
+int node_tree_freeze(void);
+int node_tree_sum(void);
+const node_sum_t *node_sum(const lsnode_t *dir);
+void node_filter_stats(unsigned long *rejected, size_t *size);
+void node_mem_stats(node_mem_t *mem);
+void node_tree_destroy(void);
 lsnode_t *node_get_root(void);
+hash_tbl_t *node_tree_index(void);
+lsnode_t *node_index_get(const hash_tbl_t *index, const char *path,
+			 size_t len);
+lsnode_t *node_lookup_child(lsnode_t *parent, const char *name, size_t len);
+lsnode_t *node_lookup(lsnode_t *root, const char * const path);
 lsnode_t *node_from_path(const char * const path);
-void node_create_data(lsnode_t *node);
+void node_set_loader(node_loader_t loader);
+void node_load(lsnode_t *dir);
+unsigned long node_tree_gen(void);
+void node_tree_changed(void);
+void node_tree_rdlock(void);
+void node_tree_wrlock(void);
+void node_tree_unlock(void);
+long long node_render(const lsnode_t *node, char *buf, size_t size,
+		      off_t offset);
 
 #endif /* LS_FUSE_NODE_H */
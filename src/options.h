@@ -0,0 +1,80 @@
+/* options.h
+ * ls-fuse - ls -lR output mounter
+ *
+ * Copyright (C) 2013 Dmitry Podgorny <pasis.ua@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LS_FUSE_OPTIONS_H
+#define LS_FUSE_OPTIONS_H
+
+/* values of progressive */
+enum {
+	PROGRESSIVE_OFF = 0,
+	/* directories which are being parsed are listed partially */
+	PROGRESSIVE_PARTIAL,
+	/* readdir waits until a directory is parsed */
+	PROGRESSIVE_WAIT,
+};
+
+/* values of merge, they decide whose attributes an entry listed twice has */
+enum {
+	MERGE_LAST = 0,
+	MERGE_FIRST,
+	/* the entry with the later modification time */
+	MERGE_NEWEST,
+};
+
+/* values of content, what regular files read as */
+enum {
+	/* a short description of the entry */
+	CONTENT_SUMMARY = 0,
+	/* listed size of zero bytes */
+	CONTENT_ZERO,
+	/* listed size of a pattern which depends on the offset only */
+	CONTENT_PATTERN,
+};
+
+/* ls-fuse specific command line options, see main.c */
+struct ls_options {
+	/* parse lines with regexps only, don't use the lexer */
+	int regex;
+	/* number of threads for parsing a file, 0 means number of CPUs */
+	unsigned int threads;
+	/* fixed time zone as an offset from UTC, NULL for the local zone */
+	char *tz;
+	/* index input at startup and parse directories on first access */
+	int lazy;
+	/* memory for parsed directories in lazy mode in MiB, 0 - unlimited */
+	unsigned int lazy_mem;
+	/* mount before standard input is parsed, one of PROGRESSIVE_* */
+	int progressive;
+	/* measure parsing and print a report when input is parsed */
+	int parse_stats;
+	/* conflict policy for entries listed several times, one of MERGE_* */
+	int merge;
+	/* serve the tree with the inode-based low-level FUSE API */
+	int lowlevel;
+	/* the tree doesn't change when mounted, let the kernel cache it */
+	int immutable;
+	/* content of regular files, one of CONTENT_* */
+	int content;
+	/* index names of the tree for /.lsfuse/search */
+	int search;
+};
+
+extern struct ls_options ls_opts;
+
+#endif /* LS_FUSE_OPTIONS_H */
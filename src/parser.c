@@ -18,9 +18,11 @@
  */
 
 #include <sys/types.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <grp.h>
+#include <pthread.h>
 #include <pwd.h>
 #include <unistd.h>
 
@@ -28,23 +30,33 @@
 #include <errno.h>
 #include <regex.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
 
+#include "arena.h"
+#include "decomp.h"
 #include "hash.h"
+#include "lexer.h"
 #include "months.h"
 #include "node.h"
+#include "options.h"
 #include "parser.h"
+#include "scan.h"
+#include "stats.h"
 #include "tools.h"
 #include "log.h"
 
 #define MAX_READ_BUFSIZ (1024 * 1024)
 #define STR_BUFSIZ 4096
+#define REPORT_BUFSIZ 8192
+/* input isn't split into chunks smaller than this */
+#define MIN_CHUNK_SIZE (4 * 1024 * 1024)
+/* number of days whose start is remembered, must be a power of 2 */
+#define DAY_CACHE_SIZE 256
 
-/* maximum number of regex matches */
-#define MATCH_NUM 10
 /* parts of regexp */
 #define R_SPACE "[ \t]+"
 #define R_SPACE_OPT "[ \t]*"
@@ -66,22 +78,123 @@
 #define R_TIME_TOOLBOX "([0-2][0-9]:[0-5][0-9])"
 
 
-static void node_set_type(lsnode_t *, const char *);
-static void node_set_mode(lsnode_t *, const char *);
-static void node_set_usr(lsnode_t *, const char *);
-static void node_set_grp(lsnode_t *, const char *);
-static void node_set_size(lsnode_t *, const char *);
-static void node_set_month(lsnode_t *, const char *);
-static void node_set_time(lsnode_t *, const char *);
-static void node_set_time_toolbox(lsnode_t *, const char *);
-static void node_set_date_toolbox(lsnode_t *, const char *);
-static void node_set_selinux(lsnode_t *, const char *);
-static void node_set_name(lsnode_t *, const char *);
-
-static lsnode_t *cwd;
+/* cached start of a day, see day_start() */
+typedef struct {
+	int year;
+	int mon;
+	int mday;
+	int isdst;
+	time_t start;
+} day_t;
+
+/* growable path without the leading '/', see path_canon() */
+typedef struct {
+	char *ptr;
+	size_t len;
+	size_t size;
+} path_t;
+
+/* state of a single parsing thread */
+typedef struct {
+	/* root of the tree the lines are parsed to */
+	lsnode_t *root;
+	lsnode_t *cwd;
+	path_t cwd_path;
+	/* directories of the tree by path, see node_tree_index() */
+	hash_tbl_t *paths;
+	/* the index of a subtree which is merged to the tree later */
+	hash_tbl_t own_paths;
+	/* entries of cwd by name, built when a listing is merged */
+	hash_tbl_t cwd_names;
+	bool cwd_merge;
+	bool cwd_names_ok;
+	/* format of the last parsed line, tried first for the next line */
+	int fmt_cur;
+	/* FSM state */
+	int fsm_st;
+	/* tmp buffer for processing files line by line */
+	char *str_ptr;
+	size_t str_len;
+	size_t str_idx;
+	/*
+	 * true if the current line is a part of mapped input which is never
+	 * unmapped, so nodes may point to its strings instead of copying them
+	 */
+	bool str_ref;
+	/* directories are being created for the lazy index */
+	bool index;
+	/* entries of a single directory are being parsed on demand */
+	bool lazy;
+	/* input file for the report, NULL for standard input */
+	const char *file;
+	/* number of line feeds before the current line */
+	unsigned long line_no;
+	/* strings of the tree, nodes come from the pools of node.c */
+	arena_t arena;
+	/* strings of a lazily parsed block are allocated here if not NULL */
+	arena_t *block_arena;
+	node_cache_t cache;
+	/* month of the current line, it is needed to decode the day */
+	int month;
+	hash_tbl_t hash_usr;
+	hash_tbl_t hash_grp;
+	/* time when parsing started, broken down in the used time zone */
+	struct tm now;
+	day_t day_cache[DAY_CACHE_SIZE];
+	struct parser_stats stats;
+} parser_ctx_t;
+
+/*
+ * Handlers receive a field as a pointer to the line and a length. Fields are
+ * not null-terminated.
+ */
+typedef void (*handler_t)(parser_ctx_t *, node_attr_t *, const char *,
+			  size_t);
+
+static void node_set_type(parser_ctx_t *, node_attr_t *, const char *, size_t);
+static void node_set_mode(parser_ctx_t *, node_attr_t *, const char *, size_t);
+static void node_set_usr(parser_ctx_t *, node_attr_t *, const char *, size_t);
+static void node_set_grp(parser_ctx_t *, node_attr_t *, const char *, size_t);
+static void node_set_size(parser_ctx_t *, node_attr_t *, const char *, size_t);
+static void node_set_month(parser_ctx_t *, node_attr_t *, const char *,
+			   size_t);
+static void node_set_time(parser_ctx_t *, node_attr_t *, const char *, size_t);
+static void node_set_time_toolbox(parser_ctx_t *, node_attr_t *, const char *,
+				  size_t);
+static void node_set_date_toolbox(parser_ctx_t *, node_attr_t *, const char *,
+				  size_t);
+static void node_set_selinux(parser_ctx_t *, node_attr_t *, const char *,
+			     size_t);
+static void node_set_name(parser_ctx_t *, node_attr_t *, const char *, size_t);
+
+/* context of the sequential parser */
+static parser_ctx_t main_ctx;
+
+/* parsing after the filesystem is mounted, see --progressive */
+static struct {
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	pthread_t thread;
+	int fd;
+	bool running;
+	bool finished;
+	int err;
+	/* incremented when a block of input is parsed */
+	unsigned long gen;
+	time_t start;
+	time_t end;
+} bg = {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+	.cond = PTHREAD_COND_INITIALIZER,
+	.fd = -1,
+};
+/* --tz: times are in a zone with the fixed offset from UTC in seconds */
+static bool tz_fixed;
+static long tz_off;
+static struct parser_stats stats;
 
-static hash_tbl_t hash_usr;
-static hash_tbl_t hash_grp;
+/* getpwnam() and getgrnam() aren't reentrant */
+static pthread_mutex_t nss_lock = PTHREAD_MUTEX_INITIALIZER;
 
 /* lsreg - regex for ls -l and ls -lR */
 /* 1 - file type
@@ -143,35 +256,221 @@ static struct {
 	const char *str;
 	/* table of callback functions */
 	const handler_t *cb;
-} lsreg_tbl[] = {
-	{ &lsreg, lsreg_str, lsreg_cb },
-	{ &lsrega, lsrega_str, lsrega_cb },
-	{ &lsregx, lsregx_str, lsregx_cb },
+} lsreg_tbl[LS_FMT_NUM] = {
+	[LS_FMT_L] = { &lsreg, lsreg_str, lsreg_cb },
+	[LS_FMT_TOOLBOX] = { &lsrega, lsrega_str, lsrega_cb },
+	[LS_FMT_Z] = { &lsregx, lsregx_str, lsregx_cb },
 };
 
-/* FSM state */
-static int fsm_st;
-/* tmp buffer for processing files line by line */
-static char *str_ptr;
-static size_t str_len;
-static size_t str_idx;
+/*
+ * Reads decimal number from [*s, end). Moves *s to the first character after
+ * the number. Returns false if there are no digits.
+ */
+static bool str_to_num(const char **s, const char *end,
+		       unsigned long long *num)
+{
+	const char *p = *s;
+	unsigned long long n = 0;
+
+	while (p < end && *p >= '0' && *p <= '9') {
+		n = n * 10 + (unsigned long long)(*p - '0');
+		++p;
+	}
+	if (p == *s) {
+		return false;
+	}
+
+	*s = p;
+	*num = n;
+	return true;
+}
 
-static bool node_insert(lsnode_t *parent, lsnode_t *node)
+/* maps names of entries to nodes, the first one wins like in lookups */
+static int names_build(hash_tbl_t *names, const lsnode_t *dir)
 {
-	assert(cwd != NULL);
+	lsnode_t *node;
 
-	/*
-	 * TODO: check whether node exists in the cwd
-	 *       if yes, add absent information
-	 */
+	for (node = node_entry(dir); node; node = node_next(node)) {
+		if (node->name == NULL ||
+		    hash_get(names, node->name, node->name_len) >= 0) {
+			continue;
+		}
+		if (hash_add(names, node->name, node->name_len,
+			     (long)node_id(node)) != 0) {
+			return -ENOMEM;
+		}
+	}
+
+	return 0;
+}
 
-	node->next = parent->entry;
-	parent->entry = node;
+/* entries of a directory which has entries already are merged */
+static void cwd_enter(parser_ctx_t *ctx, lsnode_t *dir)
+{
+	ctx->cwd = dir;
+	ctx->cwd_merge = dir != NULL && node_entry(dir) != NULL;
+	ctx->cwd_names_ok = false;
+}
 
-	return true;
+/* finds an entry of cwd with the name, the table is built on first use */
+static int cwd_lookup(parser_ctx_t *ctx, const char *name, size_t len,
+		      lsnode_t **same)
+{
+	int err;
+
+	*same = NULL;
+	if (!ctx->cwd_merge) {
+		return 0;
+	}
+	if (!ctx->cwd_names_ok) {
+		hash_destroy(&ctx->cwd_names);
+		err = names_build(&ctx->cwd_names, ctx->cwd);
+		if (err != 0) {
+			return err;
+		}
+		ctx->cwd_names_ok = true;
+	}
+	*same = node_index_get(&ctx->cwd_names, name, len);
+
+	return 0;
+}
+
+/*
+ * Merges attributes of an entry which is listed again to the node of the
+ * same name according to --merge. A fake directory takes real attributes
+ * and a directory stays a directory, otherwise its entries would be lost.
+ * Strings the winner lacks are taken from the other side.
+ */
+static int merge_attrs(node_cache_t *cache, lsnode_t *parent, lsnode_t *dst,
+		       const node_attr_t *src, bool src_fake)
+{
+	const node_attr_t *other;
+	node_attr_t attr;
+	node_attr_t old;
+	bool was_dir = S_ISDIR(dst->mode);
+	bool take;
+	int err;
+
+	node_get_attr(dst, &old);
+	if (src_fake) {
+		take = false;
+	} else if (was_dir != S_ISDIR(src->mode)) {
+		take = !was_dir;
+	} else if (dst->flags & NODE_F_FAKE) {
+		take = true;
+	} else if (ls_opts.merge == MERGE_FIRST) {
+		take = false;
+	} else if (ls_opts.merge == MERGE_NEWEST) {
+		take = src->time > old.time;
+	} else {
+		take = true;
+	}
+
+	attr = take ? *src : old;
+	other = take ? &old : src;
+	if (take) {
+		dst->flags &= ~NODE_F_FAKE;
+	}
+	if (attr.selinux == NULL) {
+		attr.selinux = other->selinux;
+	}
+	if (S_ISLNK(attr.mode) && attr.data == NULL && S_ISLNK(other->mode)) {
+		attr.data = other->data;
+		attr.data_len = other->data_len;
+	}
+	attr.name = dst->name;
+	attr.name_len = dst->name_len;
+
+	err = node_set_attr(cache, dst, &attr);
+	if (err == 0 && !was_dir && S_ISDIR(dst->mode)) {
+		node_ext(parent)->ndir++;
+	}
+
+	return err;
+}
+
+static arena_t *ctx_arena(parser_ctx_t *ctx)
+{
+	return ctx->block_arena != NULL ? ctx->block_arena : &ctx->arena;
+}
+
+/*
+ * Writes a component after the first len bytes of the path and returns
+ * length of the result in key_len. The path's own length isn't changed.
+ */
+static int path_key(path_t *path, size_t len, const char *name,
+		    size_t name_len, size_t *key_len)
+{
+	size_t need = len + 1 + name_len + 1;
+	size_t size = path->size ? path->size : STR_BUFSIZ;
+	char *ptr;
+
+	if (need > path->size) {
+		while (size < need) {
+			size *= 2;
+		}
+		ptr = (char *)realloc(path->ptr, size);
+		if (!ptr) {
+			return -ENOMEM;
+		}
+		path->ptr = ptr;
+		path->size = size;
+	}
+
+	if (len > 0) {
+		path->ptr[len++] = '/';
+	}
+	memcpy(&path->ptr[len], name, name_len);
+	len += name_len;
+	path->ptr[len] = '\0';
+	*key_len = len;
+
+	return 0;
+}
+
+/*
+ * Sets the canonical form of a header path: components are separated by
+ * a single '/', "." and ".." are dropped like node_lookup() does.
+ */
+static int path_canon(path_t *path, const char *s)
+{
+	const char *name;
+	size_t len;
+
+	path->len = 0;
+	while (1) {
+		while (*s == '/') {
+			++s;
+		}
+		if (*s == '\0') {
+			break;
+		}
+		name = s;
+		while (*s != '\0' && *s != '/') {
+			++s;
+		}
+		len = (size_t)(s - name);
+		if (!is_dot(name, len) &&
+		    path_key(path, path->len, name, len, &path->len) != 0) {
+			return -ENOMEM;
+		}
+	}
+
+	return 0;
+}
+
+/* in lazy mode only directories which are never dropped are indexed */
+static int path_add(hash_tbl_t *paths, const char *path, size_t len,
+		    lsnode_t *node)
+{
+	if (len == 0 || (ls_opts.lazy && !(node->flags & NODE_F_INDEX))) {
+		return 0;
+	}
+	return hash_add(paths, path, len, (long)node_id(node));
 }
 
-static void node_set_type(lsnode_t *node, const char * const type)
+static void node_set_type(parser_ctx_t *ctx, node_attr_t *attr,
+			  const char * const type, size_t len)
 {
 	static const struct {
 		char key;
@@ -190,11 +489,12 @@ static void node_set_type(lsnode_t *node, const char * const type)
 	mode_t s_if;
 	char c;
 
+	(void)ctx;
+
 	assert(type != NULL);
-	assert(cwd != NULL);
-	assert((node->mode & S_IFMT) == 0);
+	assert((attr->mode & S_IFMT) == 0);
 
-	if (strlen(type) != 1) {
+	if (len != 1) {
 		/* wrong string format */
 		return;
 	}
@@ -208,21 +508,19 @@ static void node_set_type(lsnode_t *node, const char * const type)
 		}
 	}
 
-	if (s_if != 0) {
-		node->mode |= s_if;
-		if ((s_if & S_IFDIR) == S_IFDIR) {
-			cwd->ndir++;
-		}
-	}
+	attr->mode |= s_if;
 }
 
-static void node_set_mode(lsnode_t *node, const char * const mode)
+static void node_set_mode(parser_ctx_t *ctx, node_attr_t *attr,
+			  const char * const mode, size_t len)
 {
 	mode_t st_mode = 0;
 
+	(void)ctx;
+
 	assert(mode != NULL);
 
-	if (strlen(mode) != 9) {
+	if (len != 9) {
 		/* wrong string format */
 		return;
 	}
@@ -272,314 +570,474 @@ static void node_set_mode(lsnode_t *node, const char * const mode)
 		st_mode |= S_ISVTX;
 	}
 
-	node->mode &= S_IFMT;
-	node->mode |= st_mode;
+	attr->mode &= S_IFMT;
+	attr->mode |= st_mode;
 }
 
-static void node_set_usr(lsnode_t *node, const char * const owner)
+static void node_set_usr(parser_ctx_t *ctx, node_attr_t *attr,
+			 const char * const owner, size_t len)
 {
 	struct passwd *pwd;
-	char *endptr;
-	long uid;
+	char name[len + 1];
+	const char *p = owner;
+	unsigned long long uid;
+	long cached;
 
 	assert(owner != NULL);
 
-	uid = hash_get(hash_usr, owner);
-	if (uid != -1) {
-		node->uid = (uid_t)uid;
+	cached = hash_get(&ctx->hash_usr, owner, len);
+	if (cached != -1) {
+		attr->uid = (uid_t)cached;
 	} else {
-		pwd = getpwnam(owner);
+		memcpy(name, owner, len);
+		name[len] = '\0';
+		pthread_mutex_lock(&nss_lock);
+		pwd = getpwnam(name);
 		if (pwd) {
-			node->uid = pwd->pw_uid;
-		} else {
-			/* if owner is numeric */
-			uid = strtol(owner, &endptr, 10);
-			assert(endptr != NULL);
-			if (*endptr == '\0') {
-				node->uid = (uid_t)uid;
-			}
+			attr->uid = pwd->pw_uid;
 		}
-		hash_add(hash_usr, owner, (long)node->uid);
+		pthread_mutex_unlock(&nss_lock);
+		if (!pwd && str_to_num(&p, owner + len, &uid) &&
+		    p == owner + len) {
+			/* owner is numeric */
+			attr->uid = (uid_t)uid;
+		}
+		hash_add(&ctx->hash_usr, owner, len, (long)attr->uid);
 	}
 }
 
-static void node_set_grp(lsnode_t *node, const char * const group)
+static void node_set_grp(parser_ctx_t *ctx, node_attr_t *attr,
+			 const char * const group, size_t len)
 {
 	struct group *grp;
-	char *endptr;
-	long gid;
+	char name[len + 1];
+	const char *p = group;
+	unsigned long long gid;
+	long cached;
 
 	assert(group != NULL);
 
-	gid = hash_get(hash_grp, group);
-	if (gid != -1) {
-		node->gid = (gid_t)gid;
+	cached = hash_get(&ctx->hash_grp, group, len);
+	if (cached != -1) {
+		attr->gid = (gid_t)cached;
 	} else {
-		grp = getgrnam(group);
+		memcpy(name, group, len);
+		name[len] = '\0';
+		pthread_mutex_lock(&nss_lock);
+		grp = getgrnam(name);
 		if (grp) {
-			node->gid = grp->gr_gid;
-		} else {
-			/* if group is numeric */
-			gid = strtol(group, &endptr, 10);
-			assert(endptr != NULL);
-			if (*endptr == '\0') {
-				node->gid = (gid_t)gid;
-			}
+			attr->gid = grp->gr_gid;
+		}
+		pthread_mutex_unlock(&nss_lock);
+		if (!grp && str_to_num(&p, group + len, &gid) &&
+		    p == group + len) {
+			/* group is numeric */
+			attr->gid = (gid_t)gid;
 		}
-		hash_add(hash_grp, group, (long)node->gid);
+		hash_add(&ctx->hash_grp, group, len, (long)attr->gid);
 	}
 }
 
-static void node_set_size(lsnode_t *node, const char * const size)
+static void node_set_size(parser_ctx_t *ctx, node_attr_t *attr,
+			  const char * const size, size_t len)
 {
-	char *endptr = NULL;
-	long long st_size;
-	unsigned long st_rdev;
+	const char *end = size + len;
+	const char *p = size;
+	unsigned long long st_size;
+	unsigned long long st_rdev;
+
+	(void)ctx;
 
 	assert(size != NULL);
 
-	st_size = strtoll(size, &endptr, 10);
-	assert(endptr != NULL);
+	if (!str_to_num(&p, end, &st_size)) {
+		return;
+	}
 
-	if (*endptr == '\0') {
-		node->size = (off_t)st_size;
-	} else if (*endptr == ',') {
+	if (p == end) {
+		attr->size = (off_t)st_size;
+	} else if (*p == ',') {
 		/* assume this is major, minor */
 		do {
-			++endptr;
-		} while (*endptr == ' ' || *endptr == '\t');
-
-		if (*endptr != '\0' && st_size < (1 << 8)) {
-			st_rdev = (unsigned long)st_size;
-			node->rdev = st_rdev << 8;
-			st_rdev = strtoul(endptr, &endptr, 10);
-			if (*endptr == '\0' && st_rdev < (1U << 8)) {
-				node->rdev |= st_rdev;
+			++p;
+		} while (p < end && (*p == ' ' || *p == '\t'));
+
+		if (p != end && st_size < (1 << 8)) {
+			attr->rdev = (dev_t)(st_size << 8);
+			if (str_to_num(&p, end, &st_rdev) && p == end &&
+			    st_rdev < (1U << 8)) {
+				attr->rdev |= (dev_t)st_rdev;
 			} else {
-				node->rdev = 0;
+				attr->rdev = 0;
 			}
 		}
 	}
 }
 
-static void node_set_month(lsnode_t *node, const char * const month)
+static void node_set_month(parser_ctx_t *ctx, node_attr_t *attr,
+			   const char * const month, size_t len)
 {
-	size_t i;
+	int i;
+
+	(void)attr;
 
 	assert(month != NULL);
 
 	/* see months.h for month_tbl */
-	for (i = 0; i < ARRAY_SIZE(month_tbl); i++) {
-		if (strcmp(month, month_tbl[i].key) == 0) {
-			node->month = month_tbl[i].val;
-			break;
-		}
+	i = month_hash_tbl[month_hash(month, len)];
+	if (i >= 0 && strncmp(month, month_tbl[i].key, len) == 0 &&
+	    month_tbl[i].key[len] == '\0') {
+		ctx->month = month_tbl[i].val;
 	}
 }
 
-static void node_set_time(lsnode_t *node, const char * const time2)
+/* days since 1970-01-01 in the proleptic Gregorian calendar, mon is 1..12 */
+static long days_from_civil(long year, int mon, int mday)
+{
+	long era;
+	long yoe;
+	long doy;
+
+	year -= mon <= 2;
+	era = (year >= 0 ? year : year - 399) / 400;
+	yoe = year - era * 400;
+	doy = (153 * (mon > 2 ? mon - 3 : mon + 9) + 2) / 5 + mday - 1;
+
+	return era * 146097 + yoe * 365 + yoe / 4 - yoe / 100 + doy - 719468;
+}
+
+/*
+ * Returns time of 00:00:00 of the day. Fields have the same meaning as in
+ * struct tm. In the local time zone the result equals to mktime() and is
+ * remembered, so mktime() is called once per day.
+ */
+static time_t day_start(parser_ctx_t *ctx, int year, int mon, int mday,
+			int isdst)
 {
 	struct tm t;
+	day_t *day;
+	unsigned int idx;
+
+	if (tz_fixed) {
+		/* mon may be out of range as mktime() allows */
+		year += mon / 12;
+		mon %= 12;
+		if (mon < 0) {
+			mon += 12;
+			--year;
+		}
+		return (time_t)days_from_civil(year + 1900L, mon + 1, mday) *
+		       86400 - tz_off;
+	}
+
+	idx = (unsigned int)(year * 372 + mon * 31 + mday) &
+	      (DAY_CACHE_SIZE - 1);
+	day = &ctx->day_cache[idx];
+	if (day->start != (time_t)-1 && day->year == year &&
+	    day->mon == mon && day->mday == mday && day->isdst == isdst) {
+		return day->start;
+	}
+
+	memset(&t, 0, sizeof(t));
+	t.tm_year = year;
+	t.tm_mon = mon;
+	t.tm_mday = mday;
+	t.tm_isdst = isdst;
+	day->year = year;
+	day->mon = mon;
+	day->mday = mday;
+	day->isdst = isdst;
+	day->start = mktime(&t);
+
+	return day->start;
+}
+
+static void node_set_time(parser_ctx_t *ctx, node_attr_t *attr,
+			  const char * const time2, size_t len)
+{
+	const char *end = time2 + len;
+	const char *p = time2;
+	unsigned long long num;
+	struct tm t = ctx->now;
 	time_t unix_time;
-	char *tmp_time;
-	char *tmp_part;
-	size_t len;
-	int year;
 
 	assert(time2 != NULL);
 
-	if (time(&unix_time) == (time_t)-1) {
+	if (t.tm_mday == 0) {
+		/* current time is unknown */
 		return;
 	}
+	/* only the year and DST come from the current time */
+	t.tm_hour = 0;
+	t.tm_min = 0;
+	t.tm_sec = 0;
 
-	if (localtime_r(&unix_time, &t) == NULL) {
+	/* day */
+	if (!str_to_num(&p, end, &num)) {
 		return;
 	}
-
-	tmp_time = strdup(time2);
-	tmp_part = strtok(tmp_time, " ");
-	if (!tmp_part) {
-		goto out;
+	t.tm_mday = (int)num;
+	while (p < end && (*p == ' ' || *p == '\t')) {
+		++p;
 	}
 
-	t.tm_mday = atoi(tmp_part);
-	tmp_part = strtok(NULL, " ");
-	if (!tmp_part) {
-		goto out;
+	/* hh:mm or year */
+	if (!str_to_num(&p, end, &num)) {
+		return;
 	}
-
-	len = strlen(tmp_part);
-	if (len == 5 && tmp_part[2] == ':') {
-		tmp_part[2] = '\0';
-		t.tm_hour = atoi(tmp_part);
-		t.tm_min = atoi(&tmp_part[3]);
-	} else if (len == 4) {
-		year = atoi(tmp_part);
-		if (year >= 1970) {
-			t.tm_year = year - 1900;
-		} else {
-			goto out;
+	if (p < end && *p == ':') {
+		t.tm_hour = (int)num;
+		++p;
+		if (!str_to_num(&p, end, &num) || p != end) {
+			return;
 		}
+		t.tm_min = (int)num;
+	} else if (p == end && num >= 1970) {
+		t.tm_year = (int)num - 1900;
 	} else {
-		goto out;
+		return;
 	}
 
 	/* assume month is set before */
-	t.tm_mon = node->month;
-	unix_time = mktime(&t);
+	unix_time = day_start(ctx, t.tm_year, ctx->month, t.tm_mday,
+			      t.tm_isdst);
+	if (unix_time == (time_t)-1) {
+		return;
+	}
+	unix_time += t.tm_hour * 3600 + t.tm_min * 60 + t.tm_sec;
 	if (unix_time >= 0) {
-		node->time = unix_time;
+		attr->time = unix_time;
 	}
-
-out:
-	free(tmp_time);
 }
 
-static void node_set_time_toolbox(lsnode_t *node, const char * const time2)
+static void node_set_time_toolbox(parser_ctx_t *ctx, node_attr_t *attr,
+				  const char * const time2, size_t len)
 {
-	char *endptr = NULL;
-	long hour, min;
+	const char *end = time2 + len;
+	const char *p = time2;
+	unsigned long long hour, min;
+
+	(void)ctx;
 
 	assert(time2 != NULL);
-	assert(strlen(time2) == 5);
+	assert(len == 5);
 
-	hour = strtol(time2, &endptr, 10);
-	if (endptr - time2 != 2 || *endptr != ':') {
+	if (!str_to_num(&p, end, &hour) || p - time2 != 2 || *p != ':') {
 		return;
 	}
 
-	min = strtol(time2 + 3, &endptr, 10);
-	if (*endptr != '\0') {
+	++p;
+	if (!str_to_num(&p, end, &min) || p != end) {
 		return;
 	}
 
-	node->time += (time_t)(hour * 3600 + min * 60);
+	attr->time += (time_t)(hour * 3600 + min * 60);
 }
 
-static void node_set_date_toolbox(lsnode_t *node, const char * const date)
+static void node_set_date_toolbox(parser_ctx_t *ctx, node_attr_t *attr,
+				  const char * const date, size_t len)
 {
-	struct tm t;
+	const char *end = date + len;
+	const char *p = date;
+	unsigned long long num;
+	int year, mon, mday;
 	time_t unix_time;
-	char *endptr = NULL;
 
 	assert(date != NULL);
-	assert(strlen(date) == 10);
-
-	memset(&t, 0, sizeof(t));
+	assert(len == 10);
 
-	t.tm_year = strtol(date, &endptr, 10);
-	if (endptr - date != 4) {
+	if (!str_to_num(&p, end, &num) || p - date != 4) {
 		return;
 	}
-	t.tm_mon = strtol(date + 5, &endptr, 10);
-	if (endptr - date != 7) {
+	year = (int)num;
+	p = date + 5;
+	if (!str_to_num(&p, end, &num) || p - date != 7) {
 		return;
 	}
-	--t.tm_mon;
-	t.tm_mday = strtol(date + 8, &endptr, 10);
-	if (*endptr != '\0') {
+	mon = (int)num - 1;
+	p = date + 8;
+	if (!str_to_num(&p, end, &num) || p != end) {
 		return;
 	}
+	mday = (int)num;
 
 	/* according to mktime(3), tm_year is "Year - 1900" */
-	assert(t.tm_year > 1900);
-	t.tm_year -= 1900;
+	assert(year > 1900);
 
-	unix_time = mktime(&t);
+	unix_time = day_start(ctx, year - 1900, mon, mday, 0);
 	if (unix_time >= 0) {
-		node->time += unix_time;
+		attr->time += unix_time;
 	}
 }
 
-static void node_set_selinux(lsnode_t *node, const char * const ctx)
+static void node_set_selinux(parser_ctx_t *ctx, node_attr_t *attr,
+			     const char * const context, size_t len)
 {
-	assert(ctx != NULL);
+	assert(context != NULL);
 
-	node->selinux = strdup(ctx);
+	attr->selinux = arena_strndup(ctx_arena(ctx), context, len);
 }
 
-static void node_set_name(lsnode_t *node, const char * const name)
+static void node_set_str(parser_ctx_t *ctx, char **str, size_t *str_len,
+			 const char *s, size_t len)
 {
-	char *sub;
-	char *tmp;
-	size_t len;
+	if (ctx->str_ref) {
+		/* mapped input outlives the tree */
+		*str = (char *)s;
+	} else {
+		*str = arena_strndup(ctx_arena(ctx), s, len);
+	}
+	*str_len = *str != NULL ? len : 0;
+}
+
+static void node_set_name(parser_ctx_t *ctx, node_attr_t *attr,
+			  const char * const name, size_t len)
+{
+	#define LNK_DELIM " -> "
+	const size_t delim_len = sizeof(LNK_DELIM) - 1;
+	size_t i;
 
 	assert(name != NULL);
 
-	if ((node->mode & S_IFLNK) == S_IFLNK) {
-		#define LNK_DELIM " -> "
-		sub = strstr(name, LNK_DELIM);
-		if (sub) {
-			len = sub - name;
-			tmp = (char *)malloc(len + 1);
-			memcpy(tmp, name, len);
-			tmp[len] = '\0';
-			node->name = tmp;
-			tmp = sub + strlen(LNK_DELIM);
-			if (*tmp != '\0') {
-				node->data = strdup(tmp);
+	if ((attr->mode & S_IFLNK) == S_IFLNK) {
+		for (i = 0; i + delim_len <= len; i++) {
+			if (memcmp(&name[i], LNK_DELIM, delim_len) == 0) {
+				break;
 			}
-		} else {
-			node->name = strdup(name);
 		}
-	} else {
-		node->name = strdup(name);
+		if (i + delim_len <= len) {
+			node_set_str(ctx, &attr->name, &attr->name_len, name,
+				     i);
+			i += delim_len;
+			if (i < len) {
+				node_set_str(ctx, &attr->data, &attr->data_len,
+					     &name[i], len - i);
+			}
+			return;
+		}
 	}
+
+	node_set_str(ctx, &attr->name, &attr->name_len, name, len);
 }
 
-static int parse_line(const char * const s, const regex_t * const reg,
-		      const handler_t h_tbl[])
+/* the optional first column of ls -s, GNU ls counts 1 KiB blocks */
+static void node_set_blocks(parser_ctx_t *ctx, node_attr_t *attr,
+			    const char * const s, size_t len)
 {
-	regmatch_t match[MATCH_NUM];
-	int i;
-	size_t len = strlen(s);
-	size_t sub_len;
-	char tmp[len + 1];
-	lsnode_t *node;
+	const char *end = s + len;
+	const char *p = s;
+	unsigned long long blocks;
 
-	if (regexec(reg, s, MATCH_NUM, match, 0) == REG_NOMATCH) {
-		return -EINVAL;
+	(void)ctx;
+
+	while (p < end && (*p == ' ' || *p == '\t')) {
+		++p;
 	}
+	if (p < end && str_to_num(&p, end, &blocks) &&
+	    blocks <= (unsigned long long)INT64_MAX / 2) {
+		attr->blocks = (blkcnt_t)(blocks * 2);
+	}
+}
 
-	LOGD("parsed: %s", s);
+/* creates node from fields found by either lexer or regexp */
+static int parse_fields(parser_ctx_t *ctx, const char * const s,
+			const regmatch_t match[], const handler_t h_tbl[])
+{
+	node_attr_t attr;
+	struct lsnode_ext *ext;
+	lsnode_t *node;
+	lsnode_t *same;
+	unsigned long long start = stats_clock();
+	size_t key_len = 0;
+	int err;
+	int i;
 
-	node = node_alloc();
-	if (!node) {
-		return -ENOMEM;
+	memset(&attr, 0, sizeof(attr));
+	attr.blocks = -1;
+	ctx->month = 0;
+	for (i = 1; i < MATCH_NUM; i++) {
+		if (match[i].rm_so >= 0 && match[i].rm_eo >= match[i].rm_so &&
+		    h_tbl[i] != NULL) {
+			h_tbl[i](ctx, &attr, &s[match[i].rm_so],
+				 (size_t)(match[i].rm_eo - match[i].rm_so));
+		}
+	}
+	/* every format starts with the file type, blocks precede it */
+	if (match[1].rm_so > 0) {
+		node_set_blocks(ctx, &attr, s, (size_t)match[1].rm_so);
+	}
+	if (attr.name_len > NODE_NAME_MAX) {
+		LOGD("name is too long: %.*s...", 64, attr.name);
+		return 0;
 	}
 
-	for (i = 1; i < MATCH_NUM; i++) {
-		if (match[i].rm_so >= 0 && match[i].rm_eo >= match[i].rm_so) {
-			sub_len = match[i].rm_eo - match[i].rm_so;
-			if (sub_len > len) {
-				continue;
-			}
-			strncpy(tmp, &s[match[i].rm_so], sub_len);
-			tmp[sub_len] = '\0';
+	same = NULL;
+	if (attr.name != NULL) {
+		err = cwd_lookup(ctx, attr.name, attr.name_len, &same);
+		if (err != 0) {
+			return err;
+		}
+	}
+	if (same && (same->flags & NODE_F_INDEX)) {
+		/* the index outlives the block's arena */
+		ext = node_ext(same);
+		if (attr.selinux != NULL && ext->selinux == NULL) {
+			ext->selinux = arena_strndup(&ctx->arena,
+				attr.selinux, strlen(attr.selinux));
+		}
+		attr.selinux = ext->selinux;
+	}
+	if (same && !ctx->lazy && !(same->flags & NODE_F_FAKE)) {
+		++ctx->stats.merged;
+	}
 
-			LOGD("%d: %s", i, tmp);
+	if (!ctx->lazy && S_ISDIR(attr.mode) && attr.name != NULL &&
+	    !is_dot(attr.name, attr.name_len)) {
+		err = path_key(&ctx->cwd_path, ctx->cwd_path.len, attr.name,
+			       attr.name_len, &key_len);
+		if (err != 0) {
+			return err;
+		}
+	}
 
-			if (h_tbl[i] != NULL) {
-				h_tbl[i](node, tmp);
-			}
+	if (same) {
+		/* a header came first or the entry is listed again */
+		err = merge_attrs(&ctx->cache, ctx->cwd, same, &attr, false);
+		if (err == 0 && key_len > 0 &&
+		    node_index_get(ctx->paths, ctx->cwd_path.ptr,
+				   key_len) == NULL) {
+			/* a file is replaced by a directory */
+			err = path_add(ctx->paths, ctx->cwd_path.ptr, key_len,
+				       same);
 		}
+		ctx->stats.ns_fields += stats_clock() - start;
+		return err;
+	}
+
+	node = node_alloc(&ctx->cache);
+	if (!node) {
+		return -ENOMEM;
+	}
+	err = node_set_attr(&ctx->cache, node, &attr);
+	if (err != 0) {
+		node_free(&ctx->cache, node);
+		return err;
 	}
 
-	if (!node_insert(cwd, node)) {
-		/* this object already exists in the tree */
-		node_free(node);
+	++ctx->stats.nodes;
+	node_insert(ctx->cwd, node);
+	if (key_len > 0) {
+		err = path_add(ctx->paths, ctx->cwd_path.ptr, key_len, node);
 	}
+	ctx->stats.ns_fields += stats_clock() - start;
 
-	return 0;
+	return err;
 }
 
-static bool is_dir(const char * const s)
+static bool is_dir(const char * const s, size_t len)
 {
-	size_t len;
-
 	assert(s != NULL);
 
-	len = strlen(s);
 	if (len < 2) {
 		return false;
 	}
@@ -587,113 +1045,200 @@ static bool is_dir(const char * const s)
 	return s[len - 1] == ':';
 }
 
-static lsnode_t *create_fake_dir(const char * const name)
+static lsnode_t *create_fake_dir(parser_ctx_t *ctx, const char * const name,
+				 size_t len)
 {
+	node_attr_t attr;
 	lsnode_t *node;
-	
-	node = node_alloc();
+
+	memset(&attr, 0, sizeof(attr));
+	node_set_name(ctx, &attr, name, len);
+	node_set_type(ctx, &attr, "d", 1);
+	node_set_mode(ctx, &attr, "rwxr-xr-x", 9);
+	if (attr.name_len > NODE_NAME_MAX) {
+		attr.name_len = NODE_NAME_MAX;
+	}
+
+	node = node_alloc(&ctx->cache);
 	if (!node) {
 		return NULL;
 	}
-	node_set_name(node, name);
-	node_set_type(node, "d");
-	node_set_mode(node, "rwxr-xr-x");
+	if (node_set_attr(&ctx->cache, node, &attr) != 0) {
+		node_free(&ctx->cache, node);
+		return NULL;
+	}
+	node->flags |= NODE_F_FAKE;
+	if (ctx->index) {
+		node->flags |= NODE_F_INDEX;
+	}
 
 	return node;
 }
 
-static lsnode_t *create_path(const char * const path)
+/*
+ * Finds or creates directories of the cwd path from the root, they are added
+ * to the index. A node which isn't indexed is looked up among entries.
+ */
+static lsnode_t *create_path(parser_ctx_t *ctx)
 {
-	lsnode_t *parent;
-	lsnode_t *node = NULL;
-	lsnode_t *result = NULL;
-	char *tmp = strdup(path);
-	char *name;
-	size_t len;
-
-	len = strlen(tmp);
-
-	while (1) {
-		while (len > 0 && tmp[len - 1] == '/') {
-			tmp[len - 1] = '\0';
-			--len;
-		}
-
-		parent = len == 0 ? node_get_root() : node_from_path(tmp);
-
-		if (parent) {
-			if (!result) {
-				result = parent;
-			} else {
-				node_insert(parent, node);
-			}
-			break;
-		}
+	const char *path = ctx->cwd_path.ptr;
+	size_t len = ctx->cwd_path.len;
+	lsnode_t *parent = ctx->root;
+	lsnode_t *node;
+	size_t start = 0;
+	size_t end;
 
-		name = strrchr(tmp, '/');
-		if (!name) {
-			len = 0;
-			name = tmp;
-		} else {
-			len = (size_t)(name - tmp);
-			*name = '\0';
-			++name;
+	while (start < len) {
+		end = start;
+		while (end < len && path[end] != '/') {
+			++end;
 		}
 
-		parent = create_fake_dir(name);
-		if (!parent) {
-			result = NULL;
-			break;
+		node = node_index_get(ctx->paths, path, end);
+		if (!node) {
+			node = node_lookup_child(parent, &path[start],
+						 end - start);
 		}
-
-		if (node) {
+		if (!node) {
+			/* a header may name a file, it gets entries too */
+			node = create_fake_dir(ctx, &path[start], end - start);
+			if (!node || !node_ext_alloc(&ctx->cache, parent)) {
+				return NULL;
+			}
 			node_insert(parent, node);
-		} else {
-			result = parent;
+		}
+		if (path_add(ctx->paths, path, end, node) != 0) {
+			return NULL;
 		}
 
-		node = parent;
+		parent = node;
+		start = end + 1;
 	}
 
-	free(tmp);
-	return result;
+	return parent;
 }
 
-static int chcwd(const char * const path)
+static int chcwd(parser_ctx_t *ctx, const char * const path)
 {
+	unsigned long long start = stats_clock();
 	lsnode_t *node;
 
-	node = node_from_path(path);
+	if (path_canon(&ctx->cwd_path, path) != 0) {
+		return -ENOMEM;
+	}
+	node = ctx->cwd_path.len == 0 ? ctx->root :
+	       node_index_get(ctx->paths, ctx->cwd_path.ptr, ctx->cwd_path.len);
 	if (!node) {
-		node = create_path(path);
+		node = create_path(ctx);
 		if (!node) {
 			return -ENOMEM;
 		}
 	}
-
-	cwd = node;
+	/* entries of a header which names a file are kept under the file */
+	if (!node_ext_alloc(&ctx->cache, node)) {
+		return -ENOMEM;
+	}
+	ctx->stats.ns_path += stats_clock() - start;
+
+	/* the previous block is over */
+	ctx->cwd->flags |= NODE_F_DONE;
+	cwd_enter(ctx, node);
+	++ctx->stats.dirs;
+	/* new block may come from a different listing */
+	ctx->fmt_cur = -1;
 	return 0;
 }
 
-static int parse(char *line)
+static int buf_to_str(parser_ctx_t *ctx, const char * const buf,
+		      size_t start, size_t end);
+
+/* line is null-terminated unless it is a part of mapped input */
+static int parse(parser_ctx_t *ctx, const char *line, size_t len)
 {
-	size_t i;
+	regmatch_t match[MATCH_NUM];
+	unsigned long long start;
+	int first;
+	int weak = -1;
+	int fmt = -1;
+	int i, k;
 	int err;
 
-	for (i = 0; i < ARRAY_SIZE(lsreg_tbl); i++) {
-		err = parse_line(line, lsreg_tbl[i].reg, lsreg_tbl[i].cb);
-		if (err == 0) {
-			return 0;
+	++ctx->stats.lines;
+
+	/*
+	 * All lines of a block have the same format, so the format of the
+	 * previous line is tried first. The rest is tried only on mismatch.
+	 */
+	first = ctx->fmt_cur < 0 ? LS_FMT_L : ctx->fmt_cur;
+
+	if (!ls_opts.regex) {
+		fmt = lex_line(line, len, match, first);
+	}
+
+	if (fmt < 0 && line != ctx->str_ptr) {
+		/* regexec() and chcwd() need a null-terminated copy */
+		ctx->str_idx = 0;
+		err = buf_to_str(ctx, line, 0, len);
+		if (err != 0) {
+			return err;
 		}
+		ctx->str_ptr[len] = '\0';
+		ctx->str_idx = 0;
+		line = ctx->str_ptr;
+		ctx->str_ref = false;
 	}
 
-	if (is_dir(line)) {
+	/* regexps catch lines the lexer doesn't recognize */
+	if (fmt < 0) {
+		start = stats_clock();
+		for (i = 0; fmt < 0 && i < LS_FMT_NUM; i++) {
+			k = ls_fmt_nth(first, i);
+			if (regexec(lsreg_tbl[k].reg, line, MATCH_NUM, match,
+				    0) != 0) {
+				continue;
+			}
+			if (i == 0 && ls_fmt_weak(k, line, match)) {
+				weak = k;
+				continue;
+			}
+			fmt = k;
+		}
+		if (fmt < 0 && weak >= 0 &&
+		    regexec(lsreg_tbl[weak].reg, line, MATCH_NUM, match,
+			    0) == 0) {
+			fmt = weak;
+		}
+		ctx->stats.ns_regex += stats_clock() - start;
+	}
+
+	if (fmt >= 0) {
+		if (fmt == first) {
+			++ctx->stats.fmt_hit[fmt];
+		} else {
+			++ctx->stats.fmt_miss[fmt];
+		}
+		ctx->fmt_cur = fmt;
+		return parse_fields(ctx, line, match, lsreg_tbl[fmt].cb);
+	}
+
+	assert(line == ctx->str_ptr);
+
+	if (ctx->lazy && is_dir(ctx->str_ptr, len)) {
+		/* blocks are split at headers by index_map() */
+		LOGD("header inside of a block: %s", ctx->str_ptr);
+		err = 0;
+	} else if (is_dir(ctx->str_ptr, len)) {
 		/* remove last ':' */
-		i = strlen(line);
-		line[i - 1] = '\0';
-		err = chcwd(line);
+		ctx->str_ptr[len - 1] = '\0';
+		err = chcwd(ctx, ctx->str_ptr);
+	} else if (strncmp(ctx->str_ptr, "total ", 6) == 0) {
+		/* block size summary of a directory */
+		err = 0;
 	} else {
-		LOGD("not parsed: %s", line);
+		LOGD("not parsed: %s", ctx->str_ptr);
+		stats_add_unmatched(&ctx->stats, ctx->file,
+				    ctx->lazy ? 0 : ctx->line_no + 1,
+				    ctx->str_ptr, len);
 		/*
 		 * ls-lR output can contain some extra output that should be
 		 * ignored. Just return success in this case.
@@ -704,71 +1249,77 @@ static int parse(char *line)
 	return err;
 }
 
-static int buf_to_str(const char * const buf, size_t start, size_t end)
+static int buf_to_str(parser_ctx_t *ctx, const char * const buf,
+		      size_t start, size_t end)
 {
 	size_t len;
 	void *tmp_ptr;
 
 	assert(start <= end);
 	len = end - start;
-	if (str_len - str_idx <= len) {
-		tmp_ptr = realloc(str_ptr, str_len + len + 1);
+	if (ctx->str_len - ctx->str_idx <= len) {
+		tmp_ptr = realloc(ctx->str_ptr, ctx->str_len + len + 1);
 		if (!tmp_ptr) {
 			return -ENOMEM;
 		}
-		str_ptr = (char *)tmp_ptr;
-		str_len += len + 1;
+		ctx->str_ptr = (char *)tmp_ptr;
+		ctx->str_len += len + 1;
 	}
 
-	memcpy(str_ptr + str_idx, buf + start, len);
-	str_idx += len;
+	memcpy(ctx->str_ptr + ctx->str_idx, buf + start, len);
+	ctx->str_idx += len;
 
 	return 0;
 }
 
-static int process_buf(const char * const buf, size_t size)
+static int process_buf(parser_ctx_t *ctx, const char * const buf,
+		       size_t size)
 {
-	size_t i;
-	char c;
+	size_t i = 0;
 	size_t last = 0;
 	int err;
 
 	assert(size != 0);
 
 	/* FSM */
-	for (i = 0; i < size; i++) {
-		c = buf[i];
-		switch (fsm_st) {
+	while (i < size) {
+		switch (ctx->fsm_st) {
 		case 0:
-			if (c == 10 || c == 13) {
-				assert(str_idx < str_len);
-				fsm_st = 1;
-				err = buf_to_str(buf, last, i);
-				if (err != 0) {
-					return err;
-				}
-				str_ptr[str_idx] = '\0';
-				err = parse(str_ptr);
-				if (err != 0) {
-					return err;
-				}
-				str_idx = 0;
+			i += scan_eol(&buf[i], size - i);
+			if (i == size) {
+				break;
+			}
+			assert(ctx->str_idx < ctx->str_len);
+			ctx->fsm_st = 1;
+			err = buf_to_str(ctx, buf, last, i);
+			if (err != 0) {
+				return err;
+			}
+			ctx->str_ptr[ctx->str_idx] = '\0';
+			err = parse(ctx, ctx->str_ptr, ctx->str_idx);
+			if (err != 0) {
+				return err;
 			}
+			ctx->str_idx = 0;
 			break;
 		case 1:
-			if (c != 10 && c != 13) {
+			if (buf[i] != 10 && buf[i] != 13) {
 				last = i;
-				fsm_st = 0;
+				ctx->fsm_st = 0;
+			} else {
+				ctx->line_no += buf[i] == 10;
+				++i;
 			}
 			break;
 		default:
 			/* this shouldn't happen */
 			assert(0);
+			return -EINVAL;
 		}
 	}
 
-	if (fsm_st == 0) {
-		err = buf_to_str(buf, last, size);
+	if (ctx->fsm_st == 0) {
+		err = buf_to_str(ctx, buf, last, size);
 		if (err != 0) {
 			return err;
 		}
@@ -777,22 +1328,427 @@ static int process_buf(const char * const buf, size_t size)
 	return 0;
 }
 
-static void clear_state(void)
+/* remembers current time, so it is requested once per parsing */
+static void set_now(parser_ctx_t *ctx)
+{
+	time_t now;
+	size_t i;
+
+	memset(&ctx->now, 0, sizeof(ctx->now));
+	if (time(&now) != (time_t)-1) {
+		if (tz_fixed) {
+			now += tz_off;
+			(void)gmtime_r(&now, &ctx->now);
+		} else {
+			(void)localtime_r(&now, &ctx->now);
+		}
+	}
+
+	/* time zone may be changed since the last parsing */
+	for (i = 0; i < ARRAY_SIZE(ctx->day_cache); i++) {
+		ctx->day_cache[i].start = (time_t)-1;
+	}
+}
+
+static void clear_state(parser_ctx_t *ctx)
+{
+	set_now(ctx);
+	cwd_enter(ctx, ctx->root);
+	ctx->cwd_path.len = 0;
+	ctx->fmt_cur = -1;
+	ctx->fsm_st = 0;
+	ctx->str_idx = 0;
+	ctx->str_ref = false;
+	ctx->line_no = 0;
+}
+
+static int ctx_init(parser_ctx_t *ctx, lsnode_t *root)
+{
+	memset(ctx, 0, sizeof(*ctx));
+	ctx->str_ptr = (char *)malloc(STR_BUFSIZ);
+	if (!ctx->str_ptr) {
+		return -ENOMEM;
+	}
+	ctx->str_len = STR_BUFSIZ;
+	ctx->root = root;
+	ctx->paths = root == node_get_root() ? node_tree_index() :
+					       &ctx->own_paths;
+	clear_state(ctx);
+
+	return 0;
+}
+
+static void ctx_destroy(parser_ctx_t *ctx)
+{
+	/* the parsed nodes belong to the tree from now on */
+	node_tree_adopt(&ctx->arena);
+	free(ctx->str_ptr);
+	ctx->str_ptr = NULL;
+	free(ctx->cwd_path.ptr);
+	memset(&ctx->cwd_path, 0, sizeof(ctx->cwd_path));
+	hash_destroy(&ctx->own_paths);
+	hash_destroy(&ctx->cwd_names);
+	hash_destroy(&ctx->hash_usr);
+	hash_destroy(&ctx->hash_grp);
+}
+
+/* adds statistics of the context to the global one */
+static void ctx_flush_stats(parser_ctx_t *ctx)
+{
+	stats_merge(&stats, &ctx->stats);
+	memset(&ctx->stats, 0, sizeof(ctx->stats));
+}
+
+static void log_stats(void)
+{
+	int i;
+
+	for (i = 0; i < LS_FMT_NUM; i++) {
+		LOGD("format #%d: %lu first-choice hits, %lu misses", i,
+		     stats.fmt_hit[i], stats.fmt_miss[i]);
+	}
+}
+
+/* parses lines in place, nodes keep pointers to the mapping */
+static int parse_lines(parser_ctx_t *ctx, const char * const map, size_t size)
+{
+	size_t i = 0;
+	size_t start;
+	int err = 0;
+
+	while (i < size) {
+		while (i < size && (map[i] == 10 || map[i] == 13)) {
+			ctx->line_no += map[i] == 10;
+			++i;
+		}
+		start = i;
+		i += scan_eol(&map[i], size - i);
+		if (i > start) {
+			ctx->str_ref = true;
+			err = parse(ctx, &map[start], i - start);
+			if (err != 0) {
+				break;
+			}
+		}
+	}
+
+	return err;
+}
+
+static int parse_map(parser_ctx_t *ctx, const char * const map, size_t size)
+{
+	clear_state(ctx);
+	ctx->stats.bytes += size;
+
+	return parse_lines(ctx, map, size);
+}
+
+/*
+ * Returns offset of the first header line which follows an empty line and
+ * starts at pos or later. Returns size if there is no such line.
+ */
+static size_t find_block(const char * const map, size_t size, size_t pos)
+{
+	const char *p;
+	size_t start;
+
+	while (pos < size) {
+		p = memchr(&map[pos], '\n', size - pos);
+		if (!p) {
+			break;
+		}
+		pos = (size_t)(p - map) + 1;
+		if (pos < size && map[pos] == '\r') {
+			++pos;
+		}
+		if (pos >= size || map[pos] != '\n') {
+			continue;
+		}
+
+		/* empty line is found, check the next one */
+		while (pos < size && (map[pos] == 10 || map[pos] == 13)) {
+			++pos;
+		}
+		start = pos;
+		p = memchr(&map[pos], '\n', size - pos);
+		pos = p != NULL ? (size_t)(p - map) : size;
+		if (pos > start && map[pos - 1] == '\r') {
+			--pos;
+		}
+		if (is_dir(&map[start], pos - start)) {
+			return start;
+		}
+	}
+
+	return size;
+}
+
+/* adds directories of a subtree moved to the tree, path is the node's one */
+static void index_subtree(path_t *path, size_t len, lsnode_t *node)
+{
+	hash_tbl_t *paths = node_tree_index();
+	lsnode_t *child;
+	size_t key_len;
+
+	/* the tree stays complete without the index, lookups walk it */
+	if (path_add(paths, path->ptr, len, node) != 0) {
+		return;
+	}
+	for (child = node_entry(node); child; child = node_next(child)) {
+		if (S_ISDIR(child->mode) &&
+		    !is_dot(child->name, child->name_len) &&
+		    path_key(path, len, child->name, child->name_len,
+			     &key_len) == 0) {
+			index_subtree(path, key_len, child);
+		}
+	}
+}
+
+/*
+ * Moves children of a subtree parsed by another thread to the tree. path
+ * keeps path of dst in its first len bytes. Entries of the same name are
+ * merged, as it happens when blocks are parsed sequentially.
+ */
+static void merge_dir(node_cache_t *cache, unsigned long *merged,
+		      path_t *path, size_t len, lsnode_t *dst, lsnode_t *src)
+{
+	struct lsnode_ext *ext = node_ext(src);
+	node_attr_t attr;
+	hash_tbl_t names;
+	uint32_t list = 0;
+	uint32_t id;
+	size_t key_len;
+	lsnode_t *node;
+	lsnode_t *same;
+	bool merge;
+
+	memset(&names, 0, sizeof(names));
+	/* without the table entries are added twice, but none is lost */
+	merge = node_entry(dst) != NULL && names_build(&names, dst) == 0;
+
+	/* children are stored in reverse order, restore it */
+	while (ext->entry) {
+		id = ext->entry;
+		node = node_ptr(id);
+		ext->entry = node->next;
+		node->next = list;
+		list = id;
+	}
+	ext->ndir = 0;
+
+	while (list) {
+		node = node_ptr(list);
+		list = node->next;
+		node->next = 0;
+
+		key_len = 0;
+		if ((S_ISDIR(node->mode) || node_entry(node)) &&
+		    !is_dot(node->name, node->name_len) &&
+		    path_key(path, len, node->name, node->name_len,
+			     &key_len) != 0) {
+			/* the index can't be updated, keep the subtree */
+			same = NULL;
+		} else {
+			same = merge ? node_index_get(&names, node->name,
+						      node->name_len) : NULL;
+		}
+		if (same && node_entry(node) && !node_ext(same) &&
+		    !node_ext_alloc(cache, same)) {
+			same = NULL;
+		}
+		if (!same) {
+			node_insert(dst, node);
+			if (key_len > 0) {
+				index_subtree(path, key_len, node);
+			}
+			continue;
+		}
+
+		if (!((same->flags | node->flags) & NODE_F_FAKE)) {
+			++*merged;
+		}
+		node_get_attr(node, &attr);
+		(void)merge_attrs(cache, dst, same, &attr,
+				  node->flags & NODE_F_FAKE);
+		if (key_len > 0 && node_index_get(node_tree_index(),
+						  path->ptr, key_len) == NULL) {
+			/* a file is replaced by the directory */
+			(void)path_add(node_tree_index(), path->ptr, key_len,
+				       same);
+		}
+		if (node_entry(node)) {
+			merge_dir(cache, merged, path, key_len, same, node);
+		}
+		node_free(cache, node);
+	}
+
+	hash_destroy(&names);
+}
+
+typedef struct {
+	parser_ctx_t ctx;
+	const char *ptr;
+	size_t size;
+	pthread_t thread;
+	bool started;
+	int err;
+} chunk_t;
+
+static void *parse_chunk(void *arg)
+{
+	chunk_t *chunk = (chunk_t *)arg;
+
+	chunk->err = parse_map(&chunk->ctx, chunk->ptr, chunk->size);
+
+	return NULL;
+}
+
+/*
+ * Splits mapped input at directory headers and parses the parts in parallel.
+ * The first part is parsed to the tree directly, the rest are parsed to
+ * separate subtrees and merged in the input order.
+ */
+static int parse_map_parallel(const char * const map, size_t size,
+			      unsigned int nthreads)
+{
+	chunk_t *chunks;
+	node_attr_t attr;
+	path_t path;
+	lsnode_t *root;
+	size_t pos = 0;
+	size_t next;
+	unsigned long lines = 0;
+	unsigned int n = 0;
+	unsigned int i;
+	int err = 0;
+
+	chunks = (chunk_t *)calloc(nthreads, sizeof(*chunks));
+	if (!chunks) {
+		return -ENOMEM;
+	}
+	memset(&path, 0, sizeof(path));
+
+	while (pos < size && n < nthreads) {
+		next = size;
+		if (n + 1 < nthreads) {
+			next = size / nthreads * (n + 1);
+			next = find_block(map, size, next > pos ? next : pos);
+		}
+		if (ctx_init(&chunks[n].ctx, NULL) != 0) {
+			err = -ENOMEM;
+			break;
+		}
+		memset(&attr, 0, sizeof(attr));
+		attr.mode = S_IFDIR | 0755;
+		root = n == 0 ? node_get_root() :
+				node_alloc(&chunks[n].ctx.cache);
+		if (!root || (n != 0 && node_set_attr(&chunks[n].ctx.cache,
+						      root, &attr) != 0)) {
+			ctx_destroy(&chunks[n].ctx);
+			err = -ENOMEM;
+			break;
+		}
+		chunks[n].ctx.root = root;
+		cwd_enter(&chunks[n].ctx, root);
+		chunks[n].ctx.paths = n == 0 ? node_tree_index() :
+					       &chunks[n].ctx.own_paths;
+		chunks[n].ctx.file = main_ctx.file;
+		chunks[n].ptr = &map[pos];
+		chunks[n].size = next - pos;
+		++n;
+		pos = next;
+	}
+	LOGD("input is split to %u chunk(s)", n);
+
+	if (err == 0) {
+		for (i = 1; i < n; i++) {
+			chunks[i].started = pthread_create(&chunks[i].thread,
+							   NULL, parse_chunk,
+							   &chunks[i]) == 0;
+		}
+		parse_chunk(&chunks[0]);
+		for (i = 1; i < n; i++) {
+			if (chunks[i].started) {
+				pthread_join(chunks[i].thread, NULL);
+			} else {
+				/* no more threads, parse it here */
+				parse_chunk(&chunks[i]);
+			}
+		}
+	}
+
+	for (i = 0; i < n; i++) {
+		if (err == 0) {
+			err = chunks[i].err;
+		}
+		if (i > 0) {
+			if (err == 0) {
+				merge_dir(&main_ctx.cache,
+					  &chunks[i].ctx.stats.merged, &path,
+					  0, node_get_root(),
+					  chunks[i].ctx.root);
+			}
+		}
+		/* a chunk counts lines from its start */
+		stats_shift_lines(&chunks[i].ctx.stats, lines);
+		lines += chunks[i].ctx.line_no;
+		ctx_flush_stats(&chunks[i].ctx);
+		ctx_destroy(&chunks[i].ctx);
+	}
+	free(chunks);
+	free(path.ptr);
+
+	return err;
+}
+
+/* FUSE may read the tree while it is parsed in background */
+static int parse_block(void *arg, const char *buf, size_t size)
 {
-	cwd = node_get_root();
-	fsm_st = 0;
-	str_idx = 0;
+	parser_ctx_t *ctx = (parser_ctx_t *)arg;
+	int err;
+
+	node_tree_wrlock();
+	err = process_buf(ctx, buf, size);
+	ctx->stats.bytes += size;
+	node_tree_unlock();
+
+	pthread_mutex_lock(&bg.lock);
+	++bg.gen;
+	pthread_cond_broadcast(&bg.cond);
+	pthread_mutex_unlock(&bg.lock);
+
+	return err;
 }
 
 int parse_fd(int fd)
 {
+	parser_ctx_t *ctx = &main_ctx;
+	unsigned long long start = stats_clock();
 	ssize_t size;
 	char buf[MAX_READ_BUFSIZ];
+	int type;
 	int err = 0;
 
-	clear_state();
+	clear_state(ctx);
+
+	size = decomp_read_head(fd, buf, sizeof(buf));
+	if (size < 0) {
+		return (int)size;
+	}
+
+	type = decomp_detect(buf, (size_t)size);
+	if (type != DECOMP_NONE) {
+		err = decomp_parse(fd, type, buf, (size_t)size, parse_block,
+				   ctx);
+		size = 0;
+	}
+
+	while (size > 0) {
+		err = parse_block(ctx, buf, (size_t)size);
+		if (err != 0) {
+			break;
+		}
 
-	while (1) {
 		/* TODO: handle EINTR */
 		size = read(fd, buf, sizeof(buf));
 		if (size < 0) {
@@ -800,23 +1756,439 @@ int parse_fd(int fd)
 			err = -errno;
 			break;
 		}
+	}
+
+	node_tree_wrlock();
+	if (err == 0 && ctx->fsm_st == 0 && ctx->str_idx > 0) {
+		/* the last line isn't terminated */
+		ctx->str_ptr[ctx->str_idx] = '\0';
+		err = parse(ctx, ctx->str_ptr, ctx->str_idx);
+		ctx->str_idx = 0;
+	}
+	ctx->cwd->flags |= NODE_F_DONE;
+	ctx->stats.ns_total += stats_clock() - start;
+	ctx_flush_stats(ctx);
+	node_tree_unlock();
+	log_stats();
+
+	return err;
+}
+
+static void *parse_bg(void *arg)
+{
+	int err;
 
-		if (size == 0) {
-			/* EOF */
+	(void)arg;
+
+	err = parse_fd(bg.fd);
+	if (err != 0) {
+		LOGE("Can't process input: %s", strerror(-err));
+	}
+	close(bg.fd);
+	if (ls_opts.parse_stats) {
+		parser_print_report();
+	}
+
+	pthread_mutex_lock(&bg.lock);
+	bg.finished = true;
+	bg.err = err;
+	bg.end = time(NULL);
+	pthread_cond_broadcast(&bg.cond);
+	pthread_mutex_unlock(&bg.lock);
+
+	return NULL;
+}
+
+/* fd is parsed by parser_bg_start() when the filesystem is mounted */
+void parse_fd_bg(int fd)
+{
+	bg.fd = fd;
+}
+
+void parser_bg_start(void)
+{
+	if (bg.fd < 0 || bg.running) {
+		return;
+	}
+
+	bg.start = time(NULL);
+	bg.running = true;
+	if (pthread_create(&bg.thread, NULL, parse_bg, NULL) != 0) {
+		LOGE("Can't create a thread, parsing in foreground");
+		parse_bg(NULL);
+	} else {
+		pthread_detach(bg.thread);
+	}
+}
+
+/*
+ * Returns when the parser has left the directory's block or when parsing is
+ * over. Returns immediately if the directory doesn't exist yet.
+ */
+void parser_wait_dir(const char * const path)
+{
+	lsnode_t *dir;
+	unsigned long gen;
+	bool done;
+
+	while (1) {
+		pthread_mutex_lock(&bg.lock);
+		gen = bg.gen;
+		done = !bg.running || bg.finished;
+		pthread_mutex_unlock(&bg.lock);
+		if (done) {
+			return;
+		}
+
+		node_tree_rdlock();
+		dir = node_from_path(path);
+		done = !dir || (dir->flags & NODE_F_DONE);
+		node_tree_unlock();
+		if (done) {
+			return;
+		}
+
+		pthread_mutex_lock(&bg.lock);
+		while (bg.gen == gen && !bg.finished) {
+			pthread_cond_wait(&bg.cond, &bg.lock);
+		}
+		pthread_mutex_unlock(&bg.lock);
+	}
+}
+
+/* caller must hold the tree lock */
+int parser_status(char *buf, size_t size)
+{
+	const char *state = "done";
+	time_t end = time(NULL);
+	int err = 0;
+
+	pthread_mutex_lock(&bg.lock);
+	if (bg.running && !bg.finished) {
+		state = "parsing";
+	} else if (bg.running) {
+		end = bg.end;
+		err = bg.err;
+		state = err == 0 ? "done" : "failed";
+	}
+	pthread_mutex_unlock(&bg.lock);
+
+	return snprintf(buf, size,
+			"state: %s\n"
+			"error: %s\n"
+			"bytes: %llu\n"
+			"entries: %lu\n"
+			"directories: %lu\n"
+			"seconds: %ld\n",
+			state, err == 0 ? "none" : strerror(-err),
+			stats.bytes + main_ctx.stats.bytes,
+			stats.nodes + main_ctx.stats.nodes,
+			stats.dirs + main_ctx.stats.dirs,
+			bg.running ? (long)(end - bg.start) : 0L);
+}
+
+/* caller must hold the tree lock */
+int parser_report(char *buf, size_t size)
+{
+	struct parser_stats st = stats;
+
+	/* the context is being parsed in background */
+	stats_merge(&st, &main_ctx.stats);
+
+	return stats_report(&st, buf, size);
+}
+
+void parser_print_report(void)
+{
+	char buf[REPORT_BUFSIZ];
+	int len;
+
+	node_tree_rdlock();
+	len = parser_report(buf, sizeof(buf));
+	node_tree_unlock();
+	printf("%.*s", len < (int)sizeof(buf) ? len : (int)sizeof(buf) - 1,
+	       buf);
+}
+
+/* range of mapped input with entries of a directory */
+typedef struct _range_t {
+	const char *ptr;
+	size_t size;
+	struct _range_t *next;
+} range_t;
+
+struct lsblock {
+	lsnode_t *dir;
+	range_t range;
+	range_t *last;
+	/* strings of the parsed entries */
+	arena_t arena;
+	/* memory of the parsed entries, it counts against --lazy-mem */
+	size_t mem;
+	bool loaded;
+	/* list of loaded blocks, the most recently used first */
+	struct lsblock *prev;
+	struct lsblock *next;
+	/* list of all blocks, see blocks_free() */
+	struct lsblock *all;
+};
+
+static struct lsblock *blocks;
+static struct lsblock *lru_head;
+static struct lsblock *lru_tail;
+static size_t lru_mem;
+
+static int block_add(lsnode_t *dir, const char *ptr, size_t size)
+{
+	struct lsnode_ext *ext = node_ext(dir);
+	struct lsblock *block = ext->block;
+	range_t *range;
+
+	if (!block) {
+		block = (struct lsblock *)calloc(1, sizeof(*block));
+		if (!block) {
+			return -ENOMEM;
+		}
+		block->dir = dir;
+		range = &block->range;
+		ext->block = block;
+		block->all = blocks;
+		blocks = block;
+	} else {
+		/* a directory may be listed several times */
+		range = (range_t *)calloc(1, sizeof(*range));
+		if (!range) {
+			return -ENOMEM;
+		}
+		block->last->next = range;
+	}
+	range->ptr = ptr;
+	range->size = size;
+	block->last = range;
+
+	return 0;
+}
+
+/*
+ * Scans mapped input for directory headers and creates the directories. Lines
+ * between headers are remembered in blocks and parsed by lazy_load().
+ */
+static int index_map(parser_ctx_t *ctx, const char * const map, size_t size)
+{
+	lsnode_t *dir;
+	size_t start = 0;
+	size_t next;
+	size_t end;
+	int err = 0;
+
+	clear_state(ctx);
+	ctx->index = true;
+	dir = ctx->root;
+
+	/* the first header doesn't follow an empty line */
+	end = scan_eol(map, size);
+	next = is_dir(map, end) ? 0 : find_block(map, size, 0);
+
+	while (1) {
+		if (next > start) {
+			err = block_add(dir, &map[start], next - start);
+			if (err != 0) {
+				break;
+			}
+		}
+		if (next >= size) {
 			break;
 		}
 
-		err = process_buf(buf, (size_t)size);
+		/* header line without ':' */
+		end = next + scan_eol(&map[next], size - next);
+		ctx->str_idx = 0;
+		err = buf_to_str(ctx, map, next, end - 1);
+		if (err != 0) {
+			break;
+		}
+		ctx->str_ptr[ctx->str_idx] = '\0';
+		ctx->str_idx = 0;
+		err = chcwd(ctx, ctx->str_ptr);
 		if (err != 0) {
 			break;
 		}
+		dir = ctx->cwd;
+
+		start = end;
+		next = find_block(map, size, end);
 	}
 
+	ctx->index = false;
+
 	return err;
 }
 
+static void lru_remove(struct lsblock *block)
+{
+	if (block->prev) {
+		block->prev->next = block->next;
+	} else {
+		lru_head = block->next;
+	}
+	if (block->next) {
+		block->next->prev = block->prev;
+	} else {
+		lru_tail = block->prev;
+	}
+	block->prev = NULL;
+	block->next = NULL;
+}
+
+static void lru_push(struct lsblock *block)
+{
+	block->next = lru_head;
+	if (lru_head) {
+		lru_head->prev = block;
+	} else {
+		lru_tail = block;
+	}
+	lru_head = block;
+}
+
+/* nodes and ext records of the entries come from the pools, see node.c */
+static size_t block_mem(const struct lsblock *block)
+{
+	const lsnode_t *node;
+	size_t mem = block->arena.mem;
+
+	for (node = node_entry(block->dir); node != NULL;
+	     node = node_next(node)) {
+		if (node->flags & NODE_F_INDEX) {
+			continue;
+		}
+		mem += sizeof(*node);
+		if (node->ext != 0) {
+			mem += sizeof(struct lsnode_ext);
+		}
+	}
+
+	return mem;
+}
+
+/* frees parsed entries, directories of the index are kept */
+static void lazy_unload(struct lsblock *block)
+{
+	struct lsnode_ext *ext = node_ext(block->dir);
+	uint32_t *link = &ext->entry;
+	lsnode_t *node;
+
+	while (*link) {
+		node = node_ptr(*link);
+		if (node->flags & NODE_F_INDEX) {
+			link = &node->next;
+			continue;
+		}
+		*link = node->next;
+		if (S_ISDIR(node->mode)) {
+			ext->ndir--;
+		}
+		node_free(&main_ctx.cache, node);
+	}
+
+	lru_remove(block);
+	lru_mem -= block->mem;
+	arena_destroy(&block->arena);
+	block->loaded = false;
+	/* readdir cursors may point to the freed nodes */
+	node_tree_changed();
+}
+
+/* directories of the index must still exist */
+static void blocks_free(void)
+{
+	struct lsblock *block;
+	range_t *range;
+
+	while (blocks) {
+		block = blocks;
+		blocks = block->all;
+		while (block->range.next) {
+			range = block->range.next;
+			block->range.next = range->next;
+			free(range);
+		}
+		node_ext(block->dir)->block = NULL;
+		arena_destroy(&block->arena);
+		free(block);
+	}
+	lru_head = NULL;
+	lru_tail = NULL;
+	lru_mem = 0;
+}
+
+/* node_loader_t for lazy mode, FUSE calls it from a single thread */
+static void lazy_load(lsnode_t *dir)
+{
+	struct lsblock *block = node_ext(dir)->block;
+	parser_ctx_t *ctx = &main_ctx;
+	size_t budget = (size_t)ls_opts.lazy_mem * 1024 * 1024;
+	range_t *range;
+	int err = 0;
+
+	if (block->loaded) {
+		lru_remove(block);
+		lru_push(block);
+		return;
+	}
+
+	clear_state(ctx);
+	ctx->lazy = true;
+	ctx->block_arena = &block->arena;
+	for (range = &block->range; range != NULL && err == 0;
+	     range = range->next) {
+		/* a directory listed again is merged */
+		cwd_enter(ctx, dir);
+		err = parse_lines(ctx, range->ptr, range->size);
+	}
+	ctx->block_arena = NULL;
+	ctx->lazy = false;
+	ctx_flush_stats(ctx);
+	if (err != 0) {
+		LOGE("Can't parse directory %.*s", (int)dir->name_len,
+		     dir->name);
+	}
+
+	block->loaded = true;
+	block->mem = block_mem(block);
+	lru_mem += block->mem;
+	lru_push(block);
+
+	/* the block which is being accessed is never dropped */
+	while (budget != 0 && lru_mem > budget && lru_tail != block) {
+		LOGD("dropping %.*s", (int)lru_tail->dir->name_len,
+		     lru_tail->dir->name);
+		lazy_unload(lru_tail);
+	}
+}
+
+/* number of threads for input of the size */
+static unsigned int parse_threads(size_t size)
+{
+	long n = (long)ls_opts.threads;
+
+	if (n == 0) {
+		n = sysconf(_SC_NPROCESSORS_ONLN);
+	}
+	if (n > 1 && (size_t)n > size / MIN_CHUNK_SIZE) {
+		n = (long)(size / MIN_CHUNK_SIZE);
+	}
+
+	return n > 1 ? (unsigned int)n : 1;
+}
+
 int parse_file(const char * const file)
 {
+	struct stat st;
+	void *map = MAP_FAILED;
+	size_t size = 0;
+	unsigned long long start = stats_clock();
+	unsigned int nthreads;
 	int err;
 	int fd;
 
@@ -826,12 +2198,102 @@ int parse_file(const char * const file)
 		return -errno;
 	}
 
-	err = parse_fd(fd);
+	if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0 &&
+	    (unsigned long long)st.st_size <= SIZE_MAX) {
+		size = (size_t)st.st_size;
+		/* the mapping is never unmapped, the tree points to it */
+		map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	}
+
+	if (map != MAP_FAILED &&
+	    decomp_detect((const char *)map, size) != DECOMP_NONE) {
+		/* compressed files are parsed as a stream */
+		munmap(map, size);
+		map = MAP_FAILED;
+		if (lseek(fd, 0, SEEK_SET) != 0) {
+			err = -errno;
+			LOGE("lseek: %s", strerror(-err));
+			close(fd);
+			return err;
+		}
+	}
+
+	main_ctx.file = file;
+	if (map != MAP_FAILED && ls_opts.lazy) {
+		err = index_map(&main_ctx, (const char *)map, size);
+		/* blocks are parsed in the order of access */
+		(void)posix_madvise(map, size, POSIX_MADV_RANDOM);
+	} else if (map != MAP_FAILED) {
+		(void)posix_madvise(map, size, POSIX_MADV_SEQUENTIAL);
+		nthreads = parse_threads(size);
+		if (nthreads > 1) {
+			err = parse_map_parallel((const char *)map, size,
+						 nthreads);
+		} else {
+			err = parse_map(&main_ctx, (const char *)map, size);
+			ctx_flush_stats(&main_ctx);
+		}
+		/* from now on only names are accessed and in random order */
+		(void)posix_madvise(map, size, POSIX_MADV_RANDOM);
+		log_stats();
+	} else {
+		/*
+		 * pipes, character devices, compressed or too large files
+		 * for 32bit
+		 */
+		err = parse_fd(fd);
+	}
+	if (map != MAP_FAILED) {
+		/* parse_fd() accounts its time itself */
+		stats.ns_total += stats_clock() - start;
+	}
+	main_ctx.file = NULL;
 	close(fd);
 
 	return err;
 }
 
+/* parses UTC, Z or [+-]HH[[:]MM] to an offset in seconds */
+static int parse_tz(const char * const tz, long *off)
+{
+	const char *end = tz + strlen(tz);
+	const char *p = tz;
+	const char *digits;
+	unsigned long long hour;
+	unsigned long long min = 0;
+	int sign = 1;
+
+	if (strcmp(tz, "UTC") == 0 || strcmp(tz, "Z") == 0) {
+		*off = 0;
+		return 0;
+	}
+
+	if (*p == '+' || *p == '-') {
+		sign = *p == '-' ? -1 : 1;
+		++p;
+	}
+	digits = p;
+	if (!str_to_num(&p, end, &hour)) {
+		return -EINVAL;
+	}
+	if (p - digits == 4 && p == end) {
+		/* HHMM */
+		min = hour % 100;
+		hour /= 100;
+	} else if (p < end && *p == ':') {
+		++p;
+		if (!str_to_num(&p, end, &min)) {
+			return -EINVAL;
+		}
+	}
+	if (p != end || hour > 14 || min > 59) {
+		return -EINVAL;
+	}
+
+	*off = sign * (long)(hour * 3600 + min * 60);
+	return 0;
+}
+
 int parser_init(void)
 {
 	int err = 0;
@@ -854,17 +2316,33 @@ int parser_init(void)
 		return -ENOMEM;
 	}
 
-	str_ptr = (char *)malloc(STR_BUFSIZ);
-	if (!str_ptr) {
+	tz_fixed = ls_opts.tz != NULL;
+	if (tz_fixed && parse_tz(ls_opts.tz, &tz_off) != 0) {
+		LOGE("Invalid time zone %s", ls_opts.tz);
+		parser_destroy();
+		return -EINVAL;
+	}
+
+	scan_init();
+
+	if (ls_opts.lazy) {
+		node_set_loader(lazy_load);
+	}
+
+	if (ctx_init(&main_ctx, node_get_root()) != 0) {
 		LOGE("Can't allocate memory");
 		parser_destroy();
 		return -ENOMEM;
 	}
-	str_len = STR_BUFSIZ;
 
 	return 0;
 }
 
+const struct parser_stats *parser_get_stats(void)
+{
+	return &stats;
+}
+
 void parser_destroy(void)
 {
 	size_t i;
@@ -873,10 +2351,6 @@ void parser_destroy(void)
 		regfree(lsreg_tbl[i].reg);
 	}
 
-	if (str_ptr) {
-		free(str_ptr);
-	}
-
-	hash_destroy(hash_usr);
-	hash_destroy(hash_grp);
+	ctx_destroy(&main_ctx);
+	blocks_free();
 }
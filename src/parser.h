@@ -20,9 +20,56 @@
 #ifndef LS_FUSE_PARSER_H
 #define LS_FUSE_PARSER_H
 
+#include "lexer.h"
+
+/* size of the sample of unmatched lines and maximum length of a line in it */
+#define STATS_SAMPLE_NUM 16
+#define STATS_SAMPLE_LEN 120
+
+struct stats_sample {
+	/* NULL for standard input */
+	const char *file;
+	/* 0 if unknown */
+	unsigned long line;
+	char text[STATS_SAMPLE_LEN + 1];
+};
+
+struct parser_stats {
+	/* lines matched by the format that was tried first */
+	unsigned long fmt_hit[LS_FMT_NUM];
+	/* lines matched only after the first choice had failed */
+	unsigned long fmt_miss[LS_FMT_NUM];
+	/* parsed bytes of input */
+	unsigned long long bytes;
+	/* created nodes and directory headers */
+	unsigned long nodes;
+	unsigned long dirs;
+	/* entries merged to a node of the same name, see --merge */
+	unsigned long merged;
+	/* non-empty lines and lines which aren't recognized */
+	unsigned long lines;
+	unsigned long unmatched;
+	/* nanoseconds, measured with --parse-stats only */
+	unsigned long long ns_total;
+	unsigned long long ns_regex;
+	unsigned long long ns_fields;
+	unsigned long long ns_path;
+	/* reservoir sample of unmatched lines */
+	struct stats_sample sample[STATS_SAMPLE_NUM];
+	unsigned int nsample;
+	unsigned int seed;
+};
+
 int parser_init(void);
 void parser_destroy(void);
 int parse_fd(int fd);
 int parse_file(const char * const file);
+const struct parser_stats *parser_get_stats(void);
+void parse_fd_bg(int fd);
+void parser_bg_start(void);
+void parser_wait_dir(const char * const path);
+int parser_status(char *buf, size_t size);
+int parser_report(char *buf, size_t size);
+void parser_print_report(void);
 
 #endif /* LS_FUSE_PARSER_H */
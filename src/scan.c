@@ -0,0 +1,207 @@
+/* scan.c
+ * ls-fuse - ls -lR output mounter
+ *
+ * Copyright (C) 2013 Dmitry Podgorny <pasis.ua@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <sys/types.h>
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "scan.h"
+#include "log.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define SCAN_X86
+#include <immintrin.h>
+#endif
+
+static inline size_t eol_scalar(const char *buf, size_t i, size_t size)
+{
+	while (i < size && buf[i] != '\n' && buf[i] != '\r') {
+		++i;
+	}
+	return i;
+}
+
+static inline uint64_t spaces_scalar(const char *s, size_t i, size_t len)
+{
+	uint64_t mask = 0;
+
+	for (; i < len; i++) {
+		if (s[i] == ' ' || s[i] == '\t') {
+			mask |= (uint64_t)1 << i;
+		}
+	}
+	return mask;
+}
+
+static size_t scan_eol_scalar(const char *buf, size_t size)
+{
+	return eol_scalar(buf, 0, size);
+}
+
+static uint64_t scan_spaces_scalar(const char *s, size_t len)
+{
+	if (len > SCAN_MASK_BITS) {
+		len = SCAN_MASK_BITS;
+	}
+	return spaces_scalar(s, 0, len);
+}
+
+#ifdef SCAN_X86
+
+/*
+ * Vector code loads only whole blocks inside the buffer, because the buffer
+ * may end right at the end of a mapping. Tails are handled by scalar code.
+ */
+
+__attribute__((target("sse2")))
+static size_t scan_eol_sse2(const char *buf, size_t size)
+{
+	const __m128i lf = _mm_set1_epi8('\n');
+	const __m128i cr = _mm_set1_epi8('\r');
+	__m128i v;
+	unsigned int bits;
+	size_t i;
+
+	for (i = 0; i + 16 <= size; i += 16) {
+		v = _mm_loadu_si128((const __m128i *)&buf[i]);
+		bits = (unsigned int)_mm_movemask_epi8(
+			_mm_or_si128(_mm_cmpeq_epi8(v, lf),
+				     _mm_cmpeq_epi8(v, cr)));
+		if (bits != 0) {
+			return i + __builtin_ctz(bits);
+		}
+	}
+	return eol_scalar(buf, i, size);
+}
+
+__attribute__((target("sse2")))
+static uint64_t scan_spaces_sse2(const char *s, size_t len)
+{
+	const __m128i sp = _mm_set1_epi8(' ');
+	const __m128i tab = _mm_set1_epi8('\t');
+	__m128i v;
+	uint64_t mask = 0;
+	size_t i;
+
+	if (len > SCAN_MASK_BITS) {
+		len = SCAN_MASK_BITS;
+	}
+	for (i = 0; i + 16 <= len; i += 16) {
+		v = _mm_loadu_si128((const __m128i *)&s[i]);
+		mask |= (uint64_t)(unsigned int)_mm_movemask_epi8(
+			_mm_or_si128(_mm_cmpeq_epi8(v, sp),
+				     _mm_cmpeq_epi8(v, tab))) << i;
+	}
+	return mask | spaces_scalar(s, i, len);
+}
+
+__attribute__((target("avx2")))
+static size_t scan_eol_avx2(const char *buf, size_t size)
+{
+	const __m256i lf = _mm256_set1_epi8('\n');
+	const __m256i cr = _mm256_set1_epi8('\r');
+	__m256i v;
+	unsigned int bits;
+	size_t i;
+
+	for (i = 0; i + 32 <= size; i += 32) {
+		v = _mm256_loadu_si256((const __m256i *)&buf[i]);
+		bits = (unsigned int)_mm256_movemask_epi8(
+			_mm256_or_si256(_mm256_cmpeq_epi8(v, lf),
+					_mm256_cmpeq_epi8(v, cr)));
+		if (bits != 0) {
+			return i + __builtin_ctz(bits);
+		}
+	}
+	return eol_scalar(buf, i, size);
+}
+
+__attribute__((target("avx2")))
+static uint64_t scan_spaces_avx2(const char *s, size_t len)
+{
+	const __m256i sp = _mm256_set1_epi8(' ');
+	const __m256i tab = _mm256_set1_epi8('\t');
+	__m256i v;
+	uint64_t mask = 0;
+	size_t i;
+
+	if (len > SCAN_MASK_BITS) {
+		len = SCAN_MASK_BITS;
+	}
+	for (i = 0; i + 32 <= len; i += 32) {
+		v = _mm256_loadu_si256((const __m256i *)&s[i]);
+		mask |= (uint64_t)(unsigned int)_mm256_movemask_epi8(
+			_mm256_or_si256(_mm256_cmpeq_epi8(v, sp),
+					_mm256_cmpeq_epi8(v, tab))) << i;
+	}
+	return mask | spaces_scalar(s, i, len);
+}
+
+#endif /* SCAN_X86 */
+
+static scan_eol_t scan_eol_impl = scan_eol_scalar;
+static scan_spaces_t scan_spaces_impl = scan_spaces_scalar;
+
+size_t scan_eol(const char *buf, size_t size)
+{
+	return scan_eol_impl(buf, size);
+}
+
+uint64_t scan_spaces(const char *s, size_t len)
+{
+	return scan_spaces_impl(s, len);
+}
+
+/* every next implementation needs the CPU features of the previous one */
+static const struct scan_impl scan_impl_tbl[] = {
+	{"scalar", scan_eol_scalar, scan_spaces_scalar},
+#ifdef SCAN_X86
+	{"SSE2", scan_eol_sse2, scan_spaces_sse2},
+	{"AVX2", scan_eol_avx2, scan_spaces_avx2},
+#endif
+};
+
+size_t scan_impls(const struct scan_impl **impls)
+{
+	size_t n = 1;
+
+#ifdef SCAN_X86
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("sse2")) {
+		n = 2;
+		if (__builtin_cpu_supports("avx2")) {
+			n = 3;
+		}
+	}
+#endif
+	*impls = scan_impl_tbl;
+	return n;
+}
+
+void scan_init(void)
+{
+	const struct scan_impl *impls;
+	size_t n;
+
+	n = scan_impls(&impls);
+	scan_eol_impl = impls[n - 1].eol;
+	scan_spaces_impl = impls[n - 1].spaces;
+	LOGD("using %s line scanner", impls[n - 1].name);
+}
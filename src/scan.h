@@ -0,0 +1,65 @@
+/* scan.h
+ * ls-fuse - ls -lR output mounter
+ *
+ * Copyright (C) 2013 Dmitry Podgorny <pasis.ua@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LS_FUSE_SCAN_H
+#define LS_FUSE_SCAN_H
+
+#include <sys/types.h>
+#include <stdint.h>
+
+/* number of bytes scan_spaces() looks at */
+#define SCAN_MASK_BITS 64
+
+/*
+ * Returns offset of the first '\n' or '\r' in buf or size if there is no
+ * line terminator.
+ */
+size_t scan_eol(const char *buf, size_t size);
+
+/*
+ * Returns a bitmap of spaces and tabs among the first
+ * min(len, SCAN_MASK_BITS) bytes of s. Bit i is set if s[i] is a space or a
+ * tab.
+ */
+uint64_t scan_spaces(const char *s, size_t len);
+
+/*
+ * Selects the fastest implementation the CPU supports. Scalar code is used
+ * until this is called.
+ */
+void scan_init(void);
+
+typedef size_t (*scan_eol_t)(const char *, size_t);
+typedef uint64_t (*scan_spaces_t)(const char *, size_t);
+
+struct scan_impl {
+	const char *name;
+	scan_eol_t eol;
+	scan_spaces_t spaces;
+};
+
+/*
+ * Points impls to the implementations the CPU supports, scalar first and
+ * the fastest last, and returns their number. Tests and benchmarks call
+ * them directly, the rest of the code goes through scan_eol() and
+ * scan_spaces().
+ */
+size_t scan_impls(const struct scan_impl **impls);
+
+#endif /* LS_FUSE_SCAN_H */
@@ -0,0 +1,738 @@
+/* search.c
+ * ls-fuse - ls -lR output mounter
+ *
+ * Copyright (C) 2013 Dmitry Podgorny <pasis.ua@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include <errno.h>
+#include <fnmatch.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "hash.h"
+#include "node.h"
+#include "search.h"
+#include "tools.h"
+
+/* trigrams are hashed to buckets, collisions only add candidates */
+#define GRAM_BITS 20
+#define GRAM_BUCKETS (1U << GRAM_BITS)
+/* results of the last queries are kept, older ones are found again */
+#define RESULT_CACHE 4
+/* patterns of the last queries are kept, older ones get new ids */
+#define QUERY_MAX 64
+/* the parent of an entry in the root and the end of a chain */
+#define NO_ENTRY UINT32_MAX
+
+typedef struct {
+	uint32_t node;
+	uint32_t parent;
+	/* the next entry of the same name */
+	uint32_t same;
+} entry_t;
+
+/*
+ * Entries of the tree in BFS order, each one refers to its parent, so a
+ * full path is built without parent pointers in nodes. Distinct names are
+ * in a hash table, trigrams of distinct names are in buckets which narrow
+ * down glob patterns.
+ */
+typedef struct {
+	entry_t *entries;
+	uint32_t n;
+	size_t size;
+	/* the first entry of every distinct name */
+	uint32_t *names;
+	uint32_t nnames;
+	/* indices of distinct names + 1, 0 is an empty slot */
+	uint32_t *slots;
+	size_t nslots;
+	/* names of bucket b are gram_names[gram_off[b]..gram_off[b + 1]) */
+	uint32_t *gram_off;
+	uint32_t *gram_names;
+} index_t;
+
+/* a slot is free if pattern is NULL */
+typedef struct {
+	long id;
+	char *pattern;
+	char *result;
+	size_t len;
+	bool done;
+	/* the least recently used query is replaced */
+	unsigned long used;
+} query_t;
+
+/*
+ * Literal parts of a pattern, every matching name has them. Names without
+ * them aren't passed to fnmatch(), it is much slower than memcmp().
+ */
+typedef struct {
+	/* the pattern starts with prefix bytes of literal text */
+	size_t prefix;
+	const char *suffix;
+	size_t suffix_len;
+	/* the longest literal part */
+	const char *run;
+	size_t run_len;
+} literals_t;
+
+/* a running query and its output */
+typedef struct {
+	const char *pattern;
+	literals_t lit;
+	char *buf;
+	size_t len;
+	size_t size;
+	/* SEARCH_RESULT_MAX is reached */
+	bool full;
+	/* entries from a match up to the root */
+	uint32_t *path;
+	size_t path_size;
+	char *name;
+} result_t;
+
+static index_t idx;
+static bool idx_ready;
+
+/* the last queries, the table is small enough to be scanned */
+static pthread_mutex_t query_lock = PTHREAD_MUTEX_INITIALIZER;
+static query_t queries[QUERY_MAX];
+/* ids aren't reused, a replaced query isn't mistaken for a newer one */
+static long query_seq;
+static unsigned long query_clock;
+
+static const lsnode_t *entry_node(uint32_t e)
+{
+	return node_ptr(idx.entries[e].node);
+}
+
+static uint32_t gram_bucket(const char *s)
+{
+	uint32_t g = (uint32_t)(unsigned char)s[0] << 16 |
+		     (uint32_t)(unsigned char)s[1] << 8 |
+		     (uint32_t)(unsigned char)s[2];
+
+	return (g * 2654435761U) >> (32 - GRAM_BITS);
+}
+
+static int add_entries(const lsnode_t *dir, uint32_t parent)
+{
+	const lsnode_t *node;
+	void *tmp;
+
+	for (node = node_entry(dir); node != NULL; node = node_next(node)) {
+		if (node->name == NULL || is_dot(node->name, node->name_len)) {
+			continue;
+		}
+		if (idx.n == NO_ENTRY) {
+			return -EOVERFLOW;
+		}
+		tmp = grow(idx.entries, &idx.size, (size_t)idx.n + 1,
+			   sizeof(*idx.entries));
+		if (!tmp) {
+			return -ENOMEM;
+		}
+		idx.entries = (entry_t *)tmp;
+		idx.entries[idx.n].node = node_id(node);
+		idx.entries[idx.n].parent = parent;
+		idx.entries[idx.n].same = NO_ENTRY;
+		++idx.n;
+	}
+
+	return 0;
+}
+
+/* returns the slot of the name, it is empty if the name isn't there */
+static uint32_t *name_slot(const char *name, size_t len)
+{
+	size_t mask = idx.nslots - 1;
+	size_t i = hash_func(name, len) & mask;
+	const lsnode_t *node;
+	uint32_t *slot;
+
+	while (1) {
+		slot = &idx.slots[i];
+		if (*slot == 0) {
+			return slot;
+		}
+		node = entry_node(idx.names[*slot - 1]);
+		if (node->name_len == len &&
+		    memcmp(node->name, name, len) == 0) {
+			return slot;
+		}
+		i = (i + 1) & mask;
+	}
+}
+
+static int build_names(void)
+{
+	const lsnode_t *node;
+	uint32_t *slot;
+	uint32_t e;
+
+	idx.nslots = HASH_TBL_MIN_SIZE;
+	while (idx.nslots < (size_t)idx.n * 2) {
+		idx.nslots *= 2;
+	}
+	idx.slots = (uint32_t *)calloc(idx.nslots, sizeof(*idx.slots));
+	idx.names = (uint32_t *)malloc(((size_t)idx.n + 1) *
+				       sizeof(*idx.names));
+	if (!idx.slots || !idx.names) {
+		return -ENOMEM;
+	}
+
+	for (e = 0; e < idx.n; e++) {
+		node = entry_node(e);
+		slot = name_slot(node->name, node->name_len);
+		if (*slot == 0) {
+			idx.names[idx.nnames++] = e;
+			*slot = idx.nnames;
+		} else {
+			/* the chain goes from the last entry of the name */
+			idx.entries[e].same = idx.names[*slot - 1];
+			idx.names[*slot - 1] = e;
+		}
+	}
+
+	return 0;
+}
+
+/*
+ * Two passes over the names: the first one counts names of every bucket,
+ * the second one fills them in. A trigram repeated in a name is taken once.
+ */
+static int build_grams(void)
+{
+	const lsnode_t *node;
+	uint32_t *pos;
+	uint64_t total = 0;
+	uint32_t count;
+	uint32_t b;
+	uint32_t k;
+	size_t i;
+
+	idx.gram_off = (uint32_t *)calloc(GRAM_BUCKETS + 1,
+					  sizeof(*idx.gram_off));
+	pos = (uint32_t *)malloc(GRAM_BUCKETS * sizeof(*pos));
+	if (!idx.gram_off || !pos) {
+		free(pos);
+		return -ENOMEM;
+	}
+
+	memset(pos, 0xff, GRAM_BUCKETS * sizeof(*pos));
+	for (k = 0; k < idx.nnames; k++) {
+		node = entry_node(idx.names[k]);
+		for (i = 0; i + 3 <= node->name_len; i++) {
+			b = gram_bucket(&node->name[i]);
+			if (pos[b] != k) {
+				pos[b] = k;
+				++idx.gram_off[b];
+			}
+		}
+	}
+	for (b = 0; b < GRAM_BUCKETS; b++) {
+		count = idx.gram_off[b];
+		idx.gram_off[b] = (uint32_t)total;
+		total += count;
+		if (total > UINT32_MAX) {
+			free(pos);
+			return -EOVERFLOW;
+		}
+	}
+	idx.gram_off[GRAM_BUCKETS] = (uint32_t)total;
+
+	idx.gram_names = (uint32_t *)malloc((size_t)(total ? total : 1) *
+					    sizeof(*idx.gram_names));
+	if (!idx.gram_names) {
+		free(pos);
+		return -ENOMEM;
+	}
+	memcpy(pos, idx.gram_off, GRAM_BUCKETS * sizeof(*pos));
+	for (k = 0; k < idx.nnames; k++) {
+		node = entry_node(idx.names[k]);
+		for (i = 0; i + 3 <= node->name_len; i++) {
+			b = gram_bucket(&node->name[i]);
+			if (pos[b] == idx.gram_off[b] ||
+			    idx.gram_names[pos[b] - 1] != k) {
+				idx.gram_names[pos[b]++] = k;
+			}
+		}
+	}
+	free(pos);
+
+	return 0;
+}
+
+int search_build(void)
+{
+	uint32_t e;
+	int err;
+
+	search_destroy();
+
+	err = add_entries(node_get_root(), NO_ENTRY);
+	for (e = 0; err == 0 && e < idx.n; e++) {
+		if (S_ISDIR(entry_node(e)->mode)) {
+			err = add_entries(entry_node(e), e);
+		}
+	}
+	if (err == 0) {
+		err = build_names();
+	}
+	if (err == 0) {
+		err = build_grams();
+	}
+	if (err != 0) {
+		search_destroy();
+		return err;
+	}
+	idx_ready = true;
+
+	return 0;
+}
+
+void search_destroy(void)
+{
+	size_t i;
+
+	free(idx.entries);
+	free(idx.names);
+	free(idx.slots);
+	free(idx.gram_off);
+	free(idx.gram_names);
+	memset(&idx, 0, sizeof(idx));
+	idx_ready = false;
+
+	for (i = 0; i < QUERY_MAX; i++) {
+		free(queries[i].pattern);
+		free(queries[i].result);
+	}
+	memset(queries, 0, sizeof(queries));
+}
+
+bool search_enabled(void)
+{
+	return idx_ready;
+}
+
+static bool result_put(result_t *r, const char *s, size_t len)
+{
+	void *tmp;
+
+	tmp = grow(r->buf, &r->size, r->len + len, 1);
+	if (!tmp) {
+		return false;
+	}
+	r->buf = (char *)tmp;
+	memcpy(&r->buf[r->len], s, len);
+	r->len += len;
+
+	return true;
+}
+
+/* adds full paths of the entry and the entries of the same name */
+static int result_add(result_t *r, uint32_t e)
+{
+	const lsnode_t *node;
+	size_t depth;
+	size_t start;
+	size_t i;
+	void *tmp;
+
+	for (; e != NO_ENTRY && !r->full; e = idx.entries[e].same) {
+		depth = 0;
+		for (i = e; i != NO_ENTRY; i = idx.entries[i].parent) {
+			tmp = grow(r->path, &r->path_size, depth + 1,
+				   sizeof(*r->path));
+			if (!tmp) {
+				return -ENOMEM;
+			}
+			r->path = (uint32_t *)tmp;
+			r->path[depth++] = (uint32_t)i;
+		}
+
+		start = r->len;
+		while (depth > 0) {
+			node = entry_node(r->path[--depth]);
+			if (!result_put(r, "/", 1) ||
+			    !result_put(r, node->name, node->name_len)) {
+				return -ENOMEM;
+			}
+		}
+		if (!result_put(r, "\n", 1)) {
+			return -ENOMEM;
+		}
+		if (r->len > SEARCH_RESULT_MAX) {
+			r->len = start;
+			r->full = true;
+		}
+	}
+
+	return 0;
+}
+
+/* returns the end of a bracket expression, p follows '[' */
+static const char *skip_bracket(const char *p)
+{
+	char delim;
+
+	if (*p == '!' || *p == '^') {
+		++p;
+	}
+	if (*p == ']') {
+		++p;
+	}
+	while (*p != '\0' && *p != ']') {
+		if (p[0] == '[' &&
+		    (p[1] == ':' || p[1] == '.' || p[1] == '=')) {
+			/* a class like [:alpha:] has ']' in it */
+			delim = p[1];
+			p += 2;
+			while (*p != '\0' && (p[0] != delim || p[1] != ']')) {
+				++p;
+			}
+			p += *p != '\0' ? 2 : 0;
+			continue;
+		}
+		p += p[0] == '\\' && p[1] != '\0' ? 2 : 1;
+	}
+
+	return *p != '\0' ? p + 1 : p;
+}
+
+/* escaped patterns aren't split, fnmatch() checks every name then */
+static void find_literals(const char *pattern, literals_t *lit)
+{
+	const char *start = pattern;
+	const char *p = pattern;
+
+	memset(lit, 0, sizeof(*lit));
+	lit->suffix = pattern;
+	if (strchr(pattern, '\\') != NULL) {
+		return;
+	}
+
+	lit->prefix = strcspn(pattern, "*?[");
+	while (1) {
+		if (*p != '\0' && *p != '*' && *p != '?' && *p != '[') {
+			++p;
+			continue;
+		}
+		if ((size_t)(p - start) > lit->run_len) {
+			lit->run = start;
+			lit->run_len = (size_t)(p - start);
+		}
+		if (*p == '\0') {
+			lit->suffix = start;
+			lit->suffix_len = (size_t)(p - start);
+			break;
+		}
+		p = *p == '[' ? skip_bracket(p + 1) : p + 1;
+		start = p;
+	}
+}
+
+static bool has_run(const char *s, size_t len, const char *run, size_t n)
+{
+	const char *end = s + len;
+	const char *p;
+
+	for (p = s; (size_t)(end - p) >= n; p++) {
+		p = memchr(p, run[0], (size_t)(end - p) - n + 1);
+		if (!p || memcmp(p, run, n) == 0) {
+			return p != NULL;
+		}
+	}
+
+	return false;
+}
+
+static bool has_literals(const literals_t *lit, const char *pattern,
+			 const char *name, size_t len)
+{
+	return len >= lit->prefix + lit->suffix_len &&
+	       memcmp(name, pattern, lit->prefix) == 0 &&
+	       memcmp(&name[len - lit->suffix_len], lit->suffix,
+		      lit->suffix_len) == 0 &&
+	       (lit->run_len == 0 ||
+		has_run(name, len, lit->run, lit->run_len));
+}
+
+/* the name has to be null-terminated for fnmatch() */
+static int result_match(result_t *r, uint32_t k)
+{
+	const lsnode_t *node = entry_node(idx.names[k]);
+
+	if (!has_literals(&r->lit, r->pattern, node->name, node->name_len)) {
+		return 0;
+	}
+	memcpy(r->name, node->name, node->name_len);
+	r->name[node->name_len] = '\0';
+	if (fnmatch(r->pattern, r->name, 0) != 0) {
+		return 0;
+	}
+
+	return result_add(r, idx.names[k]);
+}
+
+/*
+ * Finds the trigram of literal parts of the pattern with the fewest names.
+ * Every name which matches has all of them, so others aren't checked.
+ */
+static bool best_bucket(const char *pattern, uint32_t *best)
+{
+	const char *p = pattern;
+	uint32_t min = UINT32_MAX;
+	uint32_t count;
+	uint32_t b;
+	char gram[3];
+	size_t n = 0;
+	char c;
+
+	while (*p != '\0') {
+		c = *p++;
+		if (c == '*' || c == '?' || c == '[') {
+			if (c == '[') {
+				p = skip_bracket(p);
+			}
+			n = 0;
+			continue;
+		}
+		if (c == '\\' && *p != '\0') {
+			c = *p++;
+		}
+		if (n == 3) {
+			gram[0] = gram[1];
+			gram[1] = gram[2];
+			n = 2;
+		}
+		gram[n++] = c;
+		if (n == 3) {
+			b = gram_bucket(gram);
+			count = idx.gram_off[b + 1] - idx.gram_off[b];
+			if (count < min) {
+				min = count;
+				*best = b;
+			}
+		}
+	}
+
+	return min != UINT32_MAX;
+}
+
+static int run_query(const char *pattern, result_t *r)
+{
+	size_t len = strlen(pattern);
+	uint32_t *slot;
+	uint32_t b;
+	uint32_t i;
+	int err = 0;
+
+	r->name = (char *)malloc(NODE_NAME_MAX + 1);
+	if (!r->name) {
+		return -ENOMEM;
+	}
+	r->pattern = pattern;
+	find_literals(pattern, &r->lit);
+
+	if (strpbrk(pattern, "*?[\\") == NULL) {
+		/* an exact name is looked up in the table */
+		slot = name_slot(pattern, len);
+		if (*slot != 0) {
+			err = result_add(r, idx.names[*slot - 1]);
+		}
+	} else if (best_bucket(pattern, &b)) {
+		for (i = idx.gram_off[b];
+		     err == 0 && !r->full && i < idx.gram_off[b + 1]; i++) {
+			err = result_match(r, idx.gram_names[i]);
+		}
+	} else {
+		for (i = 0; err == 0 && !r->full && i < idx.nnames; i++) {
+			err = result_match(r, i);
+		}
+	}
+
+	free(r->name);
+	free(r->path);
+
+	return err;
+}
+
+/* returns NULL if the query was replaced */
+static query_t *query_find(long id)
+{
+	size_t i;
+
+	for (i = 0; i < QUERY_MAX; i++) {
+		if (queries[i].pattern != NULL && queries[i].id == id) {
+			return &queries[i];
+		}
+	}
+
+	return NULL;
+}
+
+/* returns a free slot, the least recently used query is dropped for it */
+static query_t *query_slot(void)
+{
+	query_t *lru = &queries[0];
+	size_t i;
+
+	for (i = 0; i < QUERY_MAX; i++) {
+		if (queries[i].pattern == NULL) {
+			return &queries[i];
+		}
+		if (queries[i].used < lru->used) {
+			lru = &queries[i];
+		}
+	}
+	free(lru->pattern);
+	free(lru->result);
+	memset(lru, 0, sizeof(*lru));
+
+	return lru;
+}
+
+/* drops the least recent result if there are more than RESULT_CACHE */
+static void query_drop_result(void)
+{
+	query_t *lru = NULL;
+	size_t n = 0;
+	size_t i;
+
+	for (i = 0; i < QUERY_MAX; i++) {
+		if (!queries[i].done) {
+			continue;
+		}
+		++n;
+		if (!lru || queries[i].used < lru->used) {
+			lru = &queries[i];
+		}
+	}
+	if (n > RESULT_CACHE) {
+		free(lru->result);
+		lru->result = NULL;
+		lru->len = 0;
+		lru->done = false;
+	}
+}
+
+long search_query(const char *pattern)
+{
+	query_t *q;
+	long id;
+	size_t i;
+
+	pthread_mutex_lock(&query_lock);
+	for (i = 0; i < QUERY_MAX; i++) {
+		q = &queries[i];
+		if (q->pattern != NULL && strcmp(q->pattern, pattern) == 0) {
+			q->used = ++query_clock;
+			id = q->id;
+			goto out;
+		}
+	}
+
+	q = query_slot();
+	q->pattern = strdup(pattern);
+	if (!q->pattern) {
+		id = -ENOMEM;
+		goto out;
+	}
+	q->id = query_seq++;
+	q->used = ++query_clock;
+	id = q->id;
+
+out:
+	pthread_mutex_unlock(&query_lock);
+	return id;
+}
+
+static long long result_copy(const char *result, size_t len, char *buf,
+			     size_t size, off_t offset)
+{
+	if (offset < (off_t)len && size > 0) {
+		memcpy(buf, &result[offset], MIN(size, len - (size_t)offset));
+	}
+
+	return (long long)len;
+}
+
+/*
+ * The query runs without query_lock, so other queries aren't blocked by it.
+ * Concurrent first reads of a pattern may run it twice, one result is kept.
+ */
+long long search_read(long id, char *buf, size_t size, off_t offset)
+{
+	query_t *q;
+	result_t r;
+	char *pattern;
+	long long len;
+	int err;
+
+	if (!idx_ready || offset < 0) {
+		return -EINVAL;
+	}
+
+	pthread_mutex_lock(&query_lock);
+	q = query_find(id);
+	if (!q) {
+		len = -ESTALE;
+		goto out;
+	}
+	q->used = ++query_clock;
+	if (!q->done) {
+		pattern = strdup(q->pattern);
+		pthread_mutex_unlock(&query_lock);
+		if (!pattern) {
+			return -ENOMEM;
+		}
+		memset(&r, 0, sizeof(r));
+		err = run_query(pattern, &r);
+		free(pattern);
+		if (err != 0) {
+			free(r.buf);
+			return err;
+		}
+
+		pthread_mutex_lock(&query_lock);
+		q = query_find(id);
+		if (!q || q->done) {
+			/* replaced or run by another thread meanwhile */
+			len = result_copy(r.buf, r.len, buf, size, offset);
+			free(r.buf);
+			goto out;
+		}
+		/* others were used while it ran, it mustn't be dropped */
+		q->used = ++query_clock;
+		q->result = r.buf;
+		q->len = r.len;
+		q->done = true;
+		query_drop_result();
+	}
+	len = result_copy(q->result, q->len, buf, size, offset);
+
+out:
+	pthread_mutex_unlock(&query_lock);
+	return len;
+}
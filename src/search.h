@@ -0,0 +1,47 @@
+/* search.h
+ * ls-fuse - ls -lR output mounter
+ *
+ * Copyright (C) 2013 Dmitry Podgorny <pasis.ua@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LS_FUSE_SEARCH_H
+#define LS_FUSE_SEARCH_H
+
+#include <sys/types.h>
+#include <stdbool.h>
+
+/* results are cut at this size, only whole paths are kept */
+#define SEARCH_RESULT_MAX (64 * 1024 * 1024)
+
+/* indexes names of the complete tree, it mustn't change afterwards */
+int search_build(void);
+void search_destroy(void);
+bool search_enabled(void);
+/*
+ * Returns id of the query, the same pattern gets the same id while it is
+ * among the last queries. Patterns are globs like find -name takes.
+ * Returns -errno on error.
+ */
+long search_query(const char *pattern);
+/*
+ * Copies at most size bytes of the result from the offset to buf and returns
+ * length of the whole result, like node_render() does. The result is a list
+ * of full paths, one per line. Callers hold the tree lock. Returns -ESTALE
+ * if the query was replaced by newer ones, it is to be made again.
+ */
+long long search_read(long id, char *buf, size_t size, off_t offset);
+
+#endif /* LS_FUSE_SEARCH_H */
@@ -0,0 +1,235 @@
+/* stats.c
+ * ls-fuse - ls -lR output mounter
+ *
+ * Copyright (C) 2013 Dmitry Podgorny <pasis.ua@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <sys/types.h>
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "options.h"
+#include "parser.h"
+#include "stats.h"
+#include "tools.h"
+
+static const char * const fmt_names[LS_FMT_NUM] = {
+	[LS_FMT_L] = "ls -l",
+	[LS_FMT_TOOLBOX] = "toolbox",
+	[LS_FMT_Z] = "ls -lZ",
+};
+
+unsigned long long stats_clock(void)
+{
+	struct timespec ts;
+
+	if (!ls_opts.parse_stats ||
+	    clock_gettime(CLOCK_MONOTONIC, &ts) != 0) {
+		return 0;
+	}
+
+	return (unsigned long long)ts.tv_sec * 1000000000ULL +
+	       (unsigned long long)ts.tv_nsec;
+}
+
+/* xorshift, good enough for sampling */
+static unsigned int stats_rand(struct parser_stats *st)
+{
+	unsigned int x = st->seed != 0 ? st->seed : 2463534242U;
+
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	st->seed = x;
+
+	return x;
+}
+
+static void sample_set(struct stats_sample *sample, const char *file,
+		       unsigned long line, const char *s, size_t len)
+{
+	len = MIN(len, (size_t)STATS_SAMPLE_LEN);
+	sample->file = file;
+	sample->line = line;
+	memcpy(sample->text, s, len);
+	sample->text[len] = '\0';
+}
+
+void stats_add_unmatched(struct parser_stats *st, const char *file,
+			 unsigned long line, const char *s, size_t len)
+{
+	unsigned long i;
+
+	++st->unmatched;
+	if (!ls_opts.parse_stats) {
+		return;
+	}
+
+	/* every unmatched line gets into the sample with equal chance */
+	if (st->nsample < STATS_SAMPLE_NUM) {
+		i = st->nsample++;
+	} else {
+		i = stats_rand(st) % st->unmatched;
+		if (i >= STATS_SAMPLE_NUM) {
+			return;
+		}
+	}
+	sample_set(&st->sample[i], file, line, s, len);
+}
+
+void stats_shift_lines(struct parser_stats *st, unsigned long base)
+{
+	unsigned int i;
+
+	for (i = 0; i < st->nsample; i++) {
+		if (st->sample[i].line != 0) {
+			st->sample[i].line += base;
+		}
+	}
+}
+
+/*
+ * Samples are merged so that every unmatched line of both sides keeps equal
+ * chance to be in the result: a sample from a side stands for
+ * unmatched / nsample lines of it.
+ */
+static void merge_samples(struct parser_stats *dst,
+			  const struct parser_stats *src)
+{
+	struct stats_sample a[STATS_SAMPLE_NUM];
+	struct stats_sample b[STATS_SAMPLE_NUM];
+	unsigned int na = dst->nsample;
+	unsigned int nb = src->nsample;
+	double wa, wb;
+	unsigned int i;
+
+	if (nb == 0) {
+		return;
+	}
+	memcpy(a, dst->sample, sizeof(a));
+	memcpy(b, src->sample, sizeof(b));
+	wa = na != 0 ? (double)dst->unmatched / na : 0;
+	wb = (double)src->unmatched / nb;
+
+	dst->nsample = 0;
+	while (dst->nsample < STATS_SAMPLE_NUM && na + nb > 0) {
+		if ((double)(stats_rand(dst) % 1000000) / 1000000 *
+		    (wa * na + wb * nb) < wa * na) {
+			i = stats_rand(dst) % na;
+			dst->sample[dst->nsample++] = a[i];
+			a[i] = a[--na];
+		} else {
+			i = stats_rand(dst) % nb;
+			dst->sample[dst->nsample++] = b[i];
+			b[i] = b[--nb];
+		}
+	}
+}
+
+void stats_merge(struct parser_stats *dst, const struct parser_stats *src)
+{
+	int i;
+
+	for (i = 0; i < LS_FMT_NUM; i++) {
+		dst->fmt_hit[i] += src->fmt_hit[i];
+		dst->fmt_miss[i] += src->fmt_miss[i];
+	}
+	dst->bytes += src->bytes;
+	dst->nodes += src->nodes;
+	dst->dirs += src->dirs;
+	dst->merged += src->merged;
+	dst->lines += src->lines;
+	dst->ns_total += src->ns_total;
+	dst->ns_regex += src->ns_regex;
+	dst->ns_fields += src->ns_fields;
+	dst->ns_path += src->ns_path;
+	/* counts of unmatched lines are used as weights */
+	merge_samples(dst, src);
+	dst->unmatched += src->unmatched;
+}
+
+/* appends to buf like snprintf(), *len may exceed size */
+static void report(char *buf, size_t size, size_t *len, const char *fmt, ...)
+{
+	va_list ap;
+	int n;
+
+	va_start(ap, fmt);
+	n = vsnprintf(*len < size ? buf + *len : NULL,
+		      *len < size ? size - *len : 0, fmt, ap);
+	va_end(ap);
+	if (n > 0) {
+		*len += (size_t)n;
+	}
+}
+
+int stats_report(const struct parser_stats *st, char *buf, size_t size)
+{
+	double sec = (double)st->ns_total / 1e9;
+	const struct stats_sample *sample;
+	size_t len = 0;
+	unsigned int i;
+
+	report(buf, size, &len, "bytes: %llu\n", st->bytes);
+	report(buf, size, &len, "lines: %lu\n", st->lines);
+	report(buf, size, &len, "nodes: %lu\n", st->nodes);
+	report(buf, size, &len, "directories: %lu\n", st->dirs);
+	report(buf, size, &len, "merged: %lu entries\n", st->merged);
+	for (i = 0; i < LS_FMT_NUM; i++) {
+		report(buf, size, &len,
+		       "format %s: %lu lines, %lu first-choice\n",
+		       fmt_names[i], st->fmt_hit[i] + st->fmt_miss[i],
+		       st->fmt_hit[i]);
+	}
+	report(buf, size, &len, "unmatched: %lu lines\n", st->unmatched);
+
+	if (!ls_opts.parse_stats) {
+		report(buf, size, &len,
+		       "timings and sample: use --parse-stats\n");
+		return (int)len;
+	}
+
+	report(buf, size, &len, "time: %.3f s\n", sec);
+	if (sec > 0) {
+		report(buf, size, &len, "throughput: %.1f MB/s, %.0f lines/s\n",
+		       (double)st->bytes / sec / 1e6,
+		       (double)st->lines / sec);
+	}
+	report(buf, size, &len, "time in regex: %.3f s\n",
+	       (double)st->ns_regex / 1e9);
+	report(buf, size, &len, "time in handlers: %.3f s\n",
+	       (double)st->ns_fields / 1e9);
+	report(buf, size, &len, "time in path creation: %.3f s\n",
+	       (double)st->ns_path / 1e9);
+
+	for (i = 0; i < st->nsample; i++) {
+		sample = &st->sample[i];
+		if (sample->line != 0) {
+			report(buf, size, &len, "unmatched %s:%lu: %s\n",
+			       sample->file ? sample->file : "<stdin>",
+			       sample->line, sample->text);
+		} else {
+			report(buf, size, &len, "unmatched %s: %s\n",
+			       sample->file ? sample->file : "<stdin>",
+			       sample->text);
+		}
+	}
+
+	return (int)len;
+}
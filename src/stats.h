@@ -0,0 +1,36 @@
+/* stats.h
+ * ls-fuse - ls -lR output mounter
+ *
+ * Copyright (C) 2013 Dmitry Podgorny <pasis.ua@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LS_FUSE_STATS_H
+#define LS_FUSE_STATS_H
+
+#include <sys/types.h>
+
+#include "parser.h"
+
+/* monotonic time in nanoseconds, 0 unless --parse-stats is given */
+unsigned long long stats_clock(void);
+void stats_add_unmatched(struct parser_stats *st, const char *file,
+			 unsigned long line, const char *s, size_t len);
+/* adds base to line numbers of the sample */
+void stats_shift_lines(struct parser_stats *st, unsigned long base);
+void stats_merge(struct parser_stats *dst, const struct parser_stats *src);
+int stats_report(const struct parser_stats *st, char *buf, size_t size);
+
+#endif /* LS_FUSE_STATS_H */
@@ -20,10 +20,50 @@
 #ifndef LS_FUSE_TOOLS_H
 #define LS_FUSE_TOOLS_H
 
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdlib.h>
+
 #ifndef NULL
 #define NULL ((void*)0)
 #endif
 
 #define ARRAY_SIZE(arr) (sizeof(arr) / sizeof((arr)[0]))
 
+#ifndef MIN
+#define MIN(a, b) ((a) < (b) ? (a) : (b))
+#endif
+
+/*
+ * Makes room for need elements of elem bytes, size is the capacity and it
+ * doubles. Returns NULL if memory is exhausted, ptr stays valid then.
+ */
+static inline void *grow(void *ptr, size_t *size, size_t need, size_t elem)
+{
+	size_t new_size = *size;
+
+	if (need <= *size) {
+		return ptr;
+	}
+	while (new_size < need) {
+		new_size = new_size ? new_size * 2 : 64;
+	}
+	ptr = realloc(ptr, new_size * elem);
+	if (ptr) {
+		*size = new_size;
+	}
+
+	return ptr;
+}
+
+/*
+ * "." and "..", listings may have them but they are never a part of
+ * a canonical path
+ */
+static inline bool is_dot(const char *name, size_t len)
+{
+	return (len == 1 && name[0] == '.') ||
+	       (len == 2 && name[0] == '.' && name[1] == '.');
+}
+
 #endif /* LS_FUSE_TOOLS_H */
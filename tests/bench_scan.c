@@ -0,0 +1,99 @@
+/* bench_scan.c
+ * ls-fuse - ls -lR output mounter
+ *
+ * Copyright (C) 2013 Dmitry Podgorny <pasis.ua@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Times every scan_eol() and scan_spaces() implementation the CPU supports
+ * over a buffer of ls -l lines: bench_scan [MiB]
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../src/scan.h"
+
+static const char * const lines[] = {
+	"-rw-r--r--  1 root root      123 Mar 15 10:30 file\n",
+	"drwxr-xr-x  2 user users    4096 Jan  1  2020 directory name\n",
+	"lrwxrwxrwx  1 root root       11 Feb 29  2016 lib.so -> lib.so.1.2\n",
+	"-rw-r--r--. 1 user users 1048576 Dec 31 23:59 "
+		"a/rather/long/file/name/that/needs/several/blocks.tar.gz\n",
+};
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static void report(const char *name, const char *what, size_t size,
+		   double t, uint64_t sum)
+{
+	printf("%-6s %-11s %8.1f MiB/s (%llx)\n", name, what,
+	       (double)size / t / (1024 * 1024), (unsigned long long)sum);
+}
+
+int main(int argc, char **argv)
+{
+	const struct scan_impl *impls;
+	size_t size, len, off, n, i;
+	uint64_t sum;
+	char *buf;
+	double t;
+
+	size = (argc > 1 ? strtoul(argv[1], NULL, 10) : 64) << 20;
+	buf = malloc(size);
+	if (buf == NULL) {
+		perror("malloc");
+		return 1;
+	}
+	for (off = 0, i = 0; off < size; off += len, i++) {
+		len = strlen(lines[i % 4]);
+		if (len > size - off) {
+			len = size - off;
+		}
+		memcpy(&buf[off], lines[i % 4], len);
+	}
+
+	n = scan_impls(&impls);
+	for (i = 0; i < n; i++) {
+		sum = 0;
+		t = now();
+		for (off = 0; off < size; off += len + 1) {
+			len = impls[i].eol(&buf[off], size - off);
+			sum += len;
+		}
+		report(impls[i].name, "scan_eol", size, now() - t, sum);
+
+		/* the lexer asks for a bitmap every SCAN_MASK_BITS bytes */
+		sum = 0;
+		t = now();
+		for (off = 0; off < size; off += SCAN_MASK_BITS) {
+			sum ^= impls[i].spaces(&buf[off], size - off);
+		}
+		report(impls[i].name, "scan_spaces", size, now() - t, sum);
+	}
+	free(buf);
+
+	return 0;
+}
@@ -0,0 +1,199 @@
+/* test.c
+ * ls-fuse - ls -lR output mounter
+ *
+ * Copyright (C) 2013 Dmitry Podgorny <pasis.ua@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../src/node.h"
+#include "../src/options.h"
+#include "../src/parser.h"
+#include "test.h"
+
+/* main.c isn't a part of the tests, options are set by them */
+struct ls_options ls_opts = {
+	.threads = 1,
+};
+
+static unsigned int failed;
+
+bool test_check(bool ok, const char *expr, const char *file, int line)
+{
+	if (!ok) {
+		fprintf(stderr, "%s:%d: check failed: %s\n", file, line, expr);
+		++failed;
+	}
+	return ok;
+}
+
+int test_result(void)
+{
+	if (failed != 0) {
+		fprintf(stderr, "%u checks failed\n", failed);
+		return 1;
+	}
+	return 0;
+}
+
+int test_parse(const char *text)
+{
+	return test_parse_data(text, strlen(text));
+}
+
+char *test_tmpfile(const void *data, size_t len)
+{
+	const char *dir = getenv("TMPDIR");
+	char *path;
+	int fd;
+
+	path = malloc(PATH_MAX);
+	if (!path) {
+		return NULL;
+	}
+	snprintf(path, PATH_MAX, "%s/ls-fuse-test.XXXXXX", dir ? dir : "/tmp");
+	fd = mkstemp(path);
+	if (fd < 0) {
+		perror("mkstemp");
+		free(path);
+		return NULL;
+	}
+	if (write(fd, data, len) != (ssize_t)len) {
+		perror("write");
+		close(fd);
+		unlink(path);
+		free(path);
+		return NULL;
+	}
+	close(fd);
+
+	return path;
+}
+
+int test_parse_data(const void *data, size_t len)
+{
+	char *path = test_tmpfile(data, len);
+	int err;
+
+	if (!path) {
+		return -1;
+	}
+	err = parser_init();
+	if (err == 0) {
+		err = parse_file(path);
+		parser_destroy();
+	}
+	/* the tree points to the mapped file, it stays after unlink() */
+	unlink(path);
+	free(path);
+
+	return err;
+}
+
+int test_parse_stream(const char *text)
+{
+	size_t len = strlen(text);
+	char path[64];
+	pid_t pid;
+	int fds[2];
+	int err;
+
+	if (pipe(fds) != 0) {
+		perror("pipe");
+		return -1;
+	}
+	pid = fork();
+	if (pid < 0) {
+		perror("fork");
+		close(fds[0]);
+		close(fds[1]);
+		return -1;
+	}
+	if (pid == 0) {
+		close(fds[0]);
+		_exit(write(fds[1], text, len) == (ssize_t)len ? 0 : 1);
+	}
+	close(fds[1]);
+
+	snprintf(path, sizeof(path), "/dev/fd/%d", fds[0]);
+	err = parser_init();
+	if (err == 0) {
+		err = parse_file(path);
+		parser_destroy();
+	}
+	close(fds[0]);
+	waitpid(pid, NULL, 0);
+
+	return err;
+}
+
+static void dump_dir(FILE *out, const lsnode_t *dir, const char *path)
+{
+	const lsnode_t *node;
+	node_attr_t attr;
+	char *child;
+
+	for (node = node_entry(dir); node != NULL; node = node_next(node)) {
+		if (node->name == NULL) {
+			continue;
+		}
+		node_get_attr(node, &attr);
+		fprintf(out, "%s/%.*s mode=%o uid=%u gid=%u size=%lld "
+			"rdev=%llu time=%lld blocks=%lld selinux=%s "
+			"data=%.*s\n",
+			path, (int)node->name_len, node->name,
+			(unsigned int)attr.mode, (unsigned int)attr.uid,
+			(unsigned int)attr.gid, (long long)attr.size,
+			(unsigned long long)attr.rdev, (long long)attr.time,
+			(long long)attr.blocks,
+			attr.selinux ? attr.selinux : "",
+			(int)attr.data_len, attr.data ? attr.data : "");
+		if (S_ISDIR(node->mode)) {
+			child = malloc(strlen(path) + node->name_len + 2);
+			if (!child) {
+				abort();
+			}
+			sprintf(child, "%s/%.*s", path, (int)node->name_len,
+				node->name);
+			dump_dir(out, node, child);
+			free(child);
+		}
+	}
+}
+
+char *test_dump(void)
+{
+	char *buf = NULL;
+	size_t size = 0;
+	FILE *out;
+
+	out = open_memstream(&buf, &size);
+	if (!out) {
+		abort();
+	}
+	dump_dir(out, node_get_root(), "");
+	fclose(out);
+
+	return buf;
+}
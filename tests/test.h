@@ -0,0 +1,49 @@
+/* test.h
+ * ls-fuse - ls -lR output mounter
+ *
+ * Copyright (C) 2013 Dmitry Podgorny <pasis.ua@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LS_FUSE_TEST_H
+#define LS_FUSE_TEST_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/*
+ * Helpers of the test programs run by make check. A failed check is reported
+ * and the test goes on, so one run shows every failure.
+ */
+#define CHECK(cond) test_check((cond), #cond, __FILE__, __LINE__)
+
+bool test_check(bool ok, const char *expr, const char *file, int line);
+/* returns exit status of the test program */
+int test_result(void);
+/* writes data to a new temporary file, its path is allocated with malloc() */
+char *test_tmpfile(const void *data, size_t len);
+/* writes the listing to a temporary file and parses it into the tree */
+int test_parse(const char *text);
+/* the same for arbitrary data, e.g. a compressed listing */
+int test_parse_data(const void *data, size_t len);
+/* the same from a pipe, strings of the tree are copied from the input */
+int test_parse_stream(const char *text);
+/*
+ * Returns attributes of every node of the tree, a line per node in the order
+ * of directories. The string is allocated with malloc().
+ */
+char *test_dump(void);
+
+#endif /* LS_FUSE_TEST_H */
@@ -0,0 +1,463 @@
+/* test_fuse.c
+ * ls-fuse - ls -lR output mounter
+ *
+ * Copyright (C) 2013 Dmitry Podgorny <pasis.ua@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* tests of the path-based backend, its operations are called directly */
+
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include <fuse_lowlevel.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../src/ls_fuse.h"
+#include "../src/node.h"
+#include "../src/options.h"
+#include "../src/search.h"
+#include "../src/tools.h"
+#include "test.h"
+
+#define DIR_ENTRIES 300
+#define NAME_MAX_LEN 16
+
+/* what readdir returned, names in the order of the listing */
+typedef struct {
+	char (*names)[NAME_MAX_LEN];
+	off_t *next;
+	size_t num;
+	size_t size;
+	/* the filler reports a full buffer after so many entries */
+	size_t limit;
+	size_t added;
+} listing_t;
+
+static int filler(void *buf, const char *name, const struct stat *stbuf,
+		  off_t off
+#if FUSE_USE_VERSION >= 30
+		  , enum fuse_fill_dir_flags flags
+#endif
+		 )
+{
+	listing_t *l = buf;
+
+	(void)stbuf;
+#if FUSE_USE_VERSION >= 30
+	(void)flags;
+#endif
+	if (l->added == l->limit) {
+		return 1;
+	}
+	if (l->num == l->size) {
+		l->size = l->size ? l->size * 2 : 64;
+		l->names = realloc(l->names, l->size * sizeof(*l->names));
+		l->next = realloc(l->next, l->size * sizeof(*l->next));
+		if (l->names == NULL || l->next == NULL) {
+			perror("realloc");
+			exit(1);
+		}
+	}
+	snprintf(l->names[l->num], sizeof(l->names[0]), "%s", name);
+	l->next[l->num++] = off;
+	++l->added;
+
+	return 0;
+}
+
+static int readdir_at(const char *path, listing_t *l, off_t off,
+		      struct fuse_file_info *fi)
+{
+	l->added = 0;
+#if FUSE_USE_VERSION >= 30
+	return fuse_oper.readdir(path, l, filler, off, fi, 0);
+#else
+	return fuse_oper.readdir(path, l, filler, off, fi);
+#endif
+}
+
+static void listing_free(listing_t *l)
+{
+	free(l->names);
+	free(l->next);
+	memset(l, 0, sizeof(*l));
+}
+
+/* every entry of the directory but "." and ".." once, in any order */
+static bool listing_complete(const listing_t *l, size_t from)
+{
+	unsigned int seen[DIR_ENTRIES] = {0};
+	unsigned int k;
+	size_t i;
+
+	for (i = from; i < l->num; i++) {
+		/* "sub" takes the place of f0 */
+		if (strcmp(l->names[i], "sub") == 0) {
+			k = 0;
+		} else if (sscanf(l->names[i], "f%u", &k) != 1 ||
+			   k == 0 || k >= DIR_ENTRIES) {
+			return false;
+		}
+		++seen[k];
+	}
+	for (k = 0; k < DIR_ENTRIES; k++) {
+		if (seen[k] != 1) {
+			return false;
+		}
+	}
+	return true;
+}
+
+/* lists the directory the way the kernel does, batch entries at a time */
+static void test_batches(const char *path, size_t batch)
+{
+	struct fuse_file_info fi;
+	listing_t l = {.limit = batch};
+	off_t off = 0;
+	size_t num;
+
+	memset(&fi, 0, sizeof(fi));
+	CHECK(fuse_oper.opendir(path, &fi) == 0);
+	do {
+		num = l.num;
+		CHECK(readdir_at(path, &l, off, &fi) == 0);
+		if (l.num > num) {
+			off = l.next[l.num - 1];
+		}
+	} while (l.num > num);
+	CHECK(fuse_oper.releasedir(path, &fi) == 0);
+
+	CHECK(l.num == DIR_ENTRIES + 2);
+	CHECK(l.num > 2 && strcmp(l.names[0], ".") == 0 &&
+	      strcmp(l.names[1], "..") == 0);
+	if (!CHECK(listing_complete(&l, 2))) {
+		fprintf(stderr, "%s, batch %zu\n", path, batch);
+	}
+	listing_free(&l);
+}
+
+/*
+ * A readdir at the offset of every entry returns exactly the entries after
+ * it, whether it continues the last readdir or seeks.
+ */
+static void test_offsets(const char *path)
+{
+	struct fuse_file_info fi;
+	listing_t all = {.limit = (size_t)-1};
+	listing_t l = {.limit = (size_t)-1};
+	size_t i, k;
+
+	memset(&fi, 0, sizeof(fi));
+	CHECK(fuse_oper.opendir(path, &fi) == 0);
+	CHECK(readdir_at(path, &all, 0, &fi) == 0);
+	for (i = 0; i < all.num; i++) {
+		/* seeks backwards, the cursor points to the end */
+		l.num = 0;
+		CHECK(readdir_at(path, &l, all.next[i], &fi) == 0);
+		if (!CHECK(l.num == all.num - i - 1)) {
+			fprintf(stderr, "%s, offset %lld\n", path,
+				(long long)all.next[i]);
+			break;
+		}
+		for (k = 0; k < l.num; k++) {
+			CHECK(strcmp(l.names[k], all.names[i + 1 + k]) == 0 &&
+			      l.next[k] == all.next[i + 1 + k]);
+		}
+	}
+	CHECK(fuse_oper.releasedir(path, &fi) == 0);
+	listing_free(&all);
+	listing_free(&l);
+}
+
+static char *gen_listing(void)
+{
+	char *text;
+	size_t size;
+	FILE *out;
+	unsigned int i;
+
+	out = open_memstream(&text, &size);
+	if (out == NULL) {
+		perror("open_memstream");
+		exit(1);
+	}
+	/* "." and ".." of the listing aren't listed but take offsets */
+	fprintf(out, "/d:\ntotal 0\n"
+		"drwxr-xr-x 3 root root 4096 Jan  1  2020 .\n"
+		"drwxr-xr-x 3 root root 4096 Jan  1  2020 ..\n"
+		"drwxr-xr-x 2 root root 4096 Jan  1  2020 sub\n");
+	for (i = 1; i < DIR_ENTRIES; i++) {
+		fprintf(out, "-rw-r--r-- 1 root root %u Jan  1  2020 f%u\n",
+			i, i);
+	}
+	fclose(out);
+
+	return text;
+}
+
+static void test_readdir(void)
+{
+	size_t batch;
+
+	for (batch = 1; batch <= 7; batch++) {
+		test_batches("/d", batch);
+	}
+	test_batches("/d", 100);
+	test_offsets("/d");
+}
+
+static const char listing_content[] =
+	"/c:\n"
+	"total 0\n"
+	"-rw-r--r-- 1 root root          0 Jan  1  2020 empty\n"
+	"-rw-r--r-- 1 root root          1 Jan  1  2020 one\n"
+	"-rw-r--r-- 1 root root       4095 Jan  1  2020 page-1\n"
+	"-rw-r--r-- 1 root root       4097 Jan  1  2020 page+1\n"
+	"-rw-r--r-- 1 root root       5999 Jan  1  2020 tail\n"
+	"-rw-r--r-- 1 root root     100000 Jan  1  2020 big\n"
+	"-rw-r--r-- 1 root root 5000000000 Jan  1  2020 huge\n";
+
+static void init_content(int content)
+{
+#if FUSE_USE_VERSION >= 30
+	struct fuse_conn_info conn;
+	struct fuse_config cfg;
+
+	memset(&cfg, 0, sizeof(cfg));
+#else
+	struct fuse_conn_info conn;
+#endif
+
+	memset(&conn, 0, sizeof(conn));
+	ls_opts.content = content;
+#if FUSE_USE_VERSION >= 30
+	fuse_oper.init(&conn, &cfg);
+#else
+	fuse_oper.init(&conn);
+#endif
+}
+
+/* the same bytes at every page, the first page is remembered */
+static bool pattern_ok(off_t pos, char c)
+{
+	static char page[4096];
+
+	if (pos < (off_t)sizeof(page)) {
+		page[pos] = c;
+		return c != '\0';
+	}
+	return c == page[pos % (off_t)sizeof(page)];
+}
+
+/* reads the file in chunks of 3000 bytes, it must end at its size */
+static bool read_all(const char *path, off_t size, bool zero)
+{
+	char buf[3000];
+	off_t off = 0;
+	int i, n;
+
+	while (off <= size) {
+		n = fuse_oper.read(path, buf, sizeof(buf), off, NULL);
+		if (n <= 0) {
+			return n == 0 && off == size;
+		}
+		for (i = 0; i < n; i++) {
+			if (zero ? buf[i] != '\0' :
+				   !pattern_ok(off + i, buf[i])) {
+				return false;
+			}
+		}
+		off += n;
+	}
+	return false;
+}
+
+/* every file reads as its listed size, with zeros or with the pattern */
+static void test_content(int content)
+{
+	static const char * const small[] = {
+		"/c/empty", "/c/one", "/c/page-1", "/c/page+1", "/c/tail",
+		"/c/big",
+	};
+	const char *huge = "/c/huge";
+	struct fuse_file_info fi;
+	struct stat st;
+	char buf[4096];
+	size_t i;
+
+	init_content(content);
+	for (i = 0; i < ARRAY_SIZE(small); i++) {
+		memset(&fi, 0, sizeof(fi));
+		memset(&st, 0, sizeof(st));
+		CHECK(fuse_oper.open(small[i], &fi) == 0);
+#if FUSE_USE_VERSION >= 30
+		CHECK(fuse_oper.getattr(small[i], &st, NULL) == 0);
+#else
+		CHECK(fuse_oper.getattr(small[i], &st) == 0);
+#endif
+		if (!CHECK(read_all(small[i], st.st_size,
+				    content == CONTENT_ZERO))) {
+			fprintf(stderr, "%s\n", small[i]);
+		}
+	}
+
+	/* the size doesn't fit a node, it is kept in the ext record */
+	CHECK(fuse_oper.read(huge, buf, sizeof(buf), 5000000000LL - 10,
+			     NULL) == 10);
+	CHECK(fuse_oper.read(huge, buf, sizeof(buf), 5000000000LL,
+			     NULL) == 0);
+	CHECK(fuse_oper.read(huge, buf, sizeof(buf), 4096LL * 1000000,
+			     NULL) == (int)sizeof(buf));
+}
+
+/* every window of the rendered text is its part, bytes after it are kept */
+static void test_render_one(const char *path, const char *text)
+{
+	static const size_t sizes[] = {0, 1, 2, 7, 64, 1000};
+	const lsnode_t *node = node_from_path(path);
+	long long len = (long long)strlen(text);
+	char buf[1100];
+	long long off;
+	size_t i, n;
+
+	if (!CHECK(node != NULL)) {
+		return;
+	}
+	CHECK(node_render(node, NULL, 0, 0) == len);
+	CHECK(node_render(node, buf, sizeof(buf), -1) == -1);
+	memset(buf, 0, sizeof(buf));
+	CHECK(node_render(node, buf, sizeof(buf), 0) == len);
+	if (!CHECK(strcmp(buf, text) == 0)) {
+		fprintf(stderr, "%s:\n%s", path, buf);
+	}
+
+	for (off = 0; off <= len + 2; off++) {
+		for (i = 0; i < ARRAY_SIZE(sizes); i++) {
+			n = off < len ? (size_t)(len - off) : 0;
+			n = n < sizes[i] ? n : sizes[i];
+			memset(buf, 'X', sizeof(buf));
+			if (!CHECK(node_render(node, buf, sizes[i], off) ==
+				   len) ||
+			    !CHECK(memcmp(buf, text + off, n) == 0) ||
+			    !CHECK(buf[n] == 'X')) {
+				fprintf(stderr, "%s: off %lld size %zu\n",
+					path, off, sizes[i]);
+				return;
+			}
+		}
+	}
+	CHECK(node_render(node, buf, sizeof(buf), 1LL << 40) == len);
+}
+
+static void test_render(void)
+{
+	test_render_one("/c/big", "File: big\nSize: 97K\n"
+			"Mode: -rw-r--r--\nOwner: 0:0\nSELinux context: \n");
+	test_render_one("/c/huge", "File: huge\nSize: 4768M\n"
+			"Mode: -rw-r--r--\nOwner: 0:0\nSELinux context: \n");
+}
+
+static ino_t path_ino(const char *path)
+{
+	struct stat st;
+	int err;
+
+	memset(&st, 0, sizeof(st));
+#if FUSE_USE_VERSION >= 30
+	err = fuse_oper.getattr(path, &st, NULL);
+#else
+	err = fuse_oper.getattr(path, &st);
+#endif
+	if (!CHECK(err == 0)) {
+		fprintf(stderr, "%s: %d\n", path, err);
+		return 0;
+	}
+	return st.st_ino;
+}
+
+/*
+ * The root is FUSE_ROOT_ID, other nodes are their index + 1 and stay below
+ * the reserved indices, /.lsfuse takes the first one of them. Results of
+ * queries come after all 32bit inodes.
+ */
+static void test_inodes(void)
+{
+	static const char * const paths[] = {
+		"/c", "/c/empty", "/c/one", "/c/page-1", "/c/page+1",
+		"/c/tail", "/c/big", "/c/huge",
+	};
+	static const char * const ctl[] = {
+		"/.lsfuse/status", "/.lsfuse/stats", "/.lsfuse/lookups",
+		"/.lsfuse/search",
+	};
+	const ino_t ctl_ino = (ino_t)NODE_ID_RESERVED + 1;
+	const lsnode_t *node;
+	ino_t ino, prev;
+	size_t i;
+
+	CHECK(path_ino("/") == FUSE_ROOT_ID);
+	prev = FUSE_ROOT_ID;
+	for (i = 0; i < ARRAY_SIZE(paths); i++) {
+		node = node_from_path(paths[i]);
+		ino = path_ino(paths[i]);
+		if (!CHECK(node != NULL) ||
+		    !CHECK(ino == (ino_t)node_id(node) + 1) ||
+		    !CHECK(node_ptr((uint32_t)(ino - 1)) == node) ||
+		    !CHECK(ino != prev && ino < ctl_ino)) {
+			fprintf(stderr, "%s: %llu\n", paths[i],
+				(unsigned long long)ino);
+		}
+		prev = ino;
+	}
+
+	CHECK(path_ino("/.lsfuse") == ctl_ino);
+	for (i = 0; i < ARRAY_SIZE(ctl); i++) {
+		CHECK(path_ino(ctl[i]) == ctl_ino + 1 + i);
+	}
+	ino = path_ino("/.lsfuse/search/big");
+	CHECK(ino >= (ino_t)UINT32_MAX + 1);
+	CHECK(path_ino("/.lsfuse/search/tail") == ino + 1);
+	CHECK(path_ino("/.lsfuse/search/big") == ino);
+}
+
+int main(void)
+{
+	char *text = gen_listing();
+
+	CHECK(test_parse(text) == 0);
+	test_readdir();
+	/* entries of a frozen directory are found by their position */
+	CHECK(node_tree_freeze() == 0);
+	test_readdir();
+	node_tree_destroy();
+	free(text);
+
+	CHECK(test_parse(listing_content) == 0);
+	/* zeros first, the pattern stays once it is made */
+	test_content(CONTENT_ZERO);
+	test_content(CONTENT_PATTERN);
+	test_render();
+	CHECK(node_tree_freeze() == 0);
+	CHECK(search_build() == 0);
+	test_inodes();
+	search_destroy();
+	node_tree_destroy();
+
+	return test_result();
+}
@@ -0,0 +1,450 @@
+/* test_node.c
+ * ls-fuse - ls -lR output mounter
+ *
+ * Copyright (C) 2013 Dmitry Podgorny <pasis.ua@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <sys/stat.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../src/node.h"
+#include "../src/tools.h"
+#include "test.h"
+
+#define TEST_DIRS 100
+#define TEST_FILES 2000
+/* length of names of the files */
+#define NAME_LEN 10
+/* pools of node.c and the arena grow by chunks of this size at most */
+#define CHUNK (1024 * 1024)
+#define CHUNKS(size) (((size) + CHUNK - 1) / CHUNK * CHUNK)
+/* a file gets 12 bits of the filter, its size is rounded to power of 2 */
+#define FILTER_BYTES 3
+
+static const char * const owners[] = {
+	"root root", "user users", "daemon daemon", "1000 1000",
+};
+
+static char *gen_listing(void)
+{
+	char *text;
+	size_t size;
+	FILE *out;
+	unsigned int d, f;
+
+	out = open_memstream(&text, &size);
+	if (out == NULL) {
+		perror("open_memstream");
+		exit(1);
+	}
+	fprintf(out, "/big:\ntotal 0\n");
+	for (d = 0; d < TEST_DIRS; d++) {
+		fprintf(out, "drwxr-xr-x 2 root root 4096 Jan  1  2020 d%05u\n",
+			d);
+	}
+	for (d = 0; d < TEST_DIRS; d++) {
+		fprintf(out, "\n/big/d%05u:\ntotal 0\n", d);
+		for (f = 0; f < TEST_FILES; f++) {
+			fprintf(out, "-rw-r--r-- 1 %s %u Jan  1  2020 "
+				"file%06u\n", owners[f % ARRAY_SIZE(owners)],
+				f * 7, f);
+		}
+	}
+	fclose(out);
+
+	return text;
+}
+
+static size_t count_nodes(const lsnode_t *dir)
+{
+	const lsnode_t *node;
+	size_t n = 0;
+
+	for (node = node_entry(dir); node != NULL; node = node_next(node)) {
+		n += 1 + (S_ISDIR(node->mode) ? count_nodes(node) : 0);
+	}
+	return n;
+}
+
+static size_t mem_total(const node_mem_t *mem)
+{
+	return mem->nodes + mem->exts + mem->names + mem->owners +
+	       mem->index + mem->filter + mem->sums;
+}
+
+/*
+ * A file with a short name costs a node, its bits of the filter and its name
+ * if it is copied. The rest is rounding up to chunks and small tables.
+ */
+static void check_mem(const char *what, bool names)
+{
+	size_t n = count_nodes(node_get_root());
+	size_t name_size = n * (NAME_LEN + 1);
+	size_t limit = sizeof(lsnode_t) + FILTER_BYTES +
+		       (names ? NAME_LEN + 1 : 0);
+	/* the arena also has its smaller first chunks */
+	size_t rest = 2 * CHUNK + 128 * 1024 + (names ? 2 * CHUNK : 0);
+	node_mem_t mem;
+
+	node_mem_stats(&mem);
+	printf("%s: %zu nodes of %zu bytes, nodes %zu, exts %zu, names %zu, "
+	       "owners %zu, index %zu, filter %zu, sums %zu, %.1f bytes per "
+	       "node\n", what, n, sizeof(lsnode_t), mem.nodes, mem.exts,
+	       mem.names, mem.owners, mem.index, mem.filter, mem.sums,
+	       (double)mem_total(&mem) / (double)n);
+
+	CHECK(n == 1 + TEST_DIRS * (TEST_FILES + 1));
+	/* pointer to the name, four 32-bit and four 16-bit fields */
+	CHECK(sizeof(lsnode_t) <= 32);
+	CHECK(mem.nodes <= CHUNKS(n * sizeof(lsnode_t)));
+	/* only directories get ext records */
+	CHECK(mem.exts <= CHUNKS((TEST_DIRS + 1) * sizeof(struct lsnode_ext)));
+	/* four owners fit the smallest table */
+	CHECK(mem.owners <= 8192);
+	CHECK(mem.names <= (names ? CHUNKS(name_size) + CHUNK : 4096));
+	CHECK(mem.index <= 64 * 1024);
+	CHECK(mem.filter <= n * FILTER_BYTES);
+	/* the root, /big and its directories */
+	CHECK(mem.sums <= (TEST_DIRS + 2) * sizeof(node_sum_t));
+	CHECK(mem_total(&mem) <= n * limit + rest);
+}
+
+/* every name is found after freeze, most missing ones without a search */
+static void test_filter(void)
+{
+	lsnode_t *root = node_get_root();
+	lsnode_t *big = node_lookup_child(root, "big", 3);
+	lsnode_t *dir, *node;
+	unsigned long rejected, before;
+	size_t size, found = 0, missing = 0;
+	char name[32];
+	int len;
+
+	if (!CHECK(big != NULL)) {
+		return;
+	}
+	for (dir = node_entry(big); dir != NULL; dir = node_next(dir)) {
+		CHECK(node_lookup_child(big, dir->name, dir->name_len) ==
+		      dir);
+		for (node = node_entry(dir); node != NULL;
+		     node = node_next(node)) {
+			found += node_lookup_child(dir, node->name,
+						   node->name_len) == node;
+		}
+	}
+	CHECK(found == (size_t)TEST_DIRS * TEST_FILES);
+
+	node_filter_stats(&before, &size);
+	CHECK(size > 0);
+	for (dir = node_entry(big); dir != NULL; dir = node_next(dir)) {
+		/* names of other directories, and names nobody has */
+		len = snprintf(name, sizeof(name), "d%05u", 0);
+		missing += node_lookup_child(dir, name, (size_t)len) == NULL;
+		len = snprintf(name, sizeof(name), "file%06u", TEST_FILES);
+		missing += node_lookup_child(dir, name, (size_t)len) == NULL;
+		for (node = node_entry(dir); node != NULL;
+		     node = node_next(node)) {
+			len = snprintf(name, sizeof(name), "%.*sx",
+				       (int)node->name_len, node->name);
+			missing += node_lookup_child(dir, name,
+						     (size_t)len) == NULL;
+		}
+	}
+	CHECK(missing == (size_t)TEST_DIRS * (TEST_FILES + 2));
+	node_filter_stats(&rejected, &size);
+	printf("filter: %zu bytes, %lu of %zu missing names rejected\n",
+	       size, rejected - before, missing);
+	/* 12 bits per name give a few percent of false positives */
+	CHECK(rejected - before >= missing * 9 / 10);
+}
+
+/* writes blocks of a random tree in the order of ls -lR */
+static void gen_tree(FILE *out, const char *path, unsigned int depth)
+{
+	unsigned int n = (unsigned int)rand() % 12;
+	unsigned int sub[12];
+	unsigned int nsub = 0;
+	unsigned int i;
+	char child[256];
+
+	fprintf(out, "%s:\ntotal 0\n", path);
+	for (i = 0; i < n; i++) {
+		switch (rand() % 7) {
+		case 0:
+		case 1:
+			fprintf(out, "drwxr-xr-x 2 root root 4096 Jan  1  2020 "
+				"d%u\n", i);
+			/* some directories have no block of their own */
+			if (depth < 5 && rand() % 4 != 0) {
+				sub[nsub++] = i;
+			}
+			break;
+		case 2:
+			fprintf(out, "lrwxrwxrwx 1 root root 3 Jan  1  2020 "
+				"l%u -> f%u\n", i, i);
+			break;
+		case 3:
+			fprintf(out, "crw-rw---- 1 root tty 4, %u Jan  1  2020 "
+				"c%u\n", i, i);
+			break;
+		default:
+			/* sizes beyond 4 GiB are kept in ext records */
+			fprintf(out, "-rw-r--r-- 1 root root %llu Jan  1  2020 "
+				"f%u\n", (unsigned long long)rand() *
+				(rand() % 3 == 0 ? 4096 : 1), i);
+			break;
+		}
+	}
+	for (i = 0; i < nsub; i++) {
+		snprintf(child, sizeof(child), "%s/d%u", path, sub[i]);
+		fprintf(out, "\n");
+		gen_tree(out, child, depth + 1);
+	}
+}
+
+/* what node_tree_sum() finds, by recursion */
+static void naive_sum(const lsnode_t *dir, node_sum_t *sum)
+{
+	const lsnode_t *node;
+	node_attr_t attr;
+
+	for (node = node_entry(dir); node != NULL; node = node_next(node)) {
+		node_get_attr(node, &attr);
+		sum->size += attr.size;
+		sum->blocks += attr.blocks;
+		if (S_ISDIR(node->mode)) {
+			++sum->dirs;
+			naive_sum(node, sum);
+		} else {
+			++sum->files;
+		}
+	}
+}
+
+static void check_sums(const lsnode_t *dir, size_t *ndirs)
+{
+	const node_sum_t *sum = node_sum(dir);
+	const lsnode_t *node;
+	node_sum_t naive;
+
+	memset(&naive, 0, sizeof(naive));
+	naive_sum(dir, &naive);
+	if (node_ext(dir) == NULL) {
+		CHECK(sum == NULL);
+		return;
+	}
+	if (!CHECK(sum != NULL)) {
+		return;
+	}
+	CHECK(sum->files == naive.files);
+	CHECK(sum->dirs == naive.dirs);
+	CHECK(sum->size == naive.size);
+	CHECK(sum->blocks == naive.blocks);
+	++*ndirs;
+
+	for (node = node_entry(dir); node != NULL; node = node_next(node)) {
+		if (S_ISDIR(node->mode)) {
+			check_sums(node, ndirs);
+		}
+	}
+}
+
+/* totals of every directory match a walk of its subtree */
+static void test_sums(void)
+{
+	size_t ndirs = 0;
+	char *text;
+	size_t size;
+	FILE *out;
+	int round;
+
+	for (round = 0; round < 20; round++) {
+		out = open_memstream(&text, &size);
+		if (out == NULL) {
+			perror("open_memstream");
+			exit(1);
+		}
+		gen_tree(out, "/t", 0);
+		fclose(out);
+
+		CHECK(test_parse(text) == 0);
+		CHECK(node_tree_sum() == 0);
+		check_sums(node_get_root(), &ndirs);
+		/* freeze moves nodes, the totals stay with their ext */
+		CHECK(node_tree_freeze() == 0);
+		CHECK(node_tree_sum() == 0);
+		check_sums(node_get_root(), &ndirs);
+		node_tree_destroy();
+		free(text);
+	}
+	printf("sums: %zu directories\n", ndirs);
+}
+
+/*
+ * Only directories and files named by a header have entries. Other nodes
+ * with ext records aren't sorted as directories by node_tree_freeze().
+ */
+static void test_freeze_dirs(void)
+{
+	static const char listing[] =
+		"/t:\n"
+		"drwxr-xr-x 2 root root 4096 Jan  1  2020 dir\n"
+		"drwxr-xr-x 2 root root 4096 Jan  1  2020 empty\n"
+		"lrwxrwxrwx 1 root root 3 Jan  1  2020 link -> dir\n"
+		"brw-rw---- 1 root disk 8, 0 Jan  1  2020 sda\n"
+		"-rw-r--r-- 1 root root 99999999999 Jan  1  2020 big\n"
+		"-rw-r--r-- 1 root root 1 Jan  1  2020 file\n"
+		"-rw-r--r--. root root system_u:object_r:etc_t:s0 z\n"
+		"\n"
+		"/t/dir:\n"
+		"-rw-r--r-- 1 root root 1 Jan  1  2020 b\n"
+		"-rw-r--r-- 1 root root 1 Jan  1  2020 a\n"
+		"\n"
+		"/t/file:\n"
+		"-rw-r--r-- 1 root root 1 Jan  1  2020 inner\n";
+	static const char * const sorted[] = {"/t", "/t/dir", "/t/empty",
+					      "/t/file"};
+	/* the first three have ext records */
+	static const char * const plain[] = {"/t/link", "/t/big", "/t/z",
+					     "/t/sda", "/t/dir/a"};
+	const lsnode_t *node;
+	size_t i;
+
+	CHECK(test_parse(listing) == 0);
+	CHECK(node_tree_freeze() == 0);
+	for (i = 0; i < ARRAY_SIZE(sorted); i++) {
+		node = node_from_path(sorted[i]);
+		if (CHECK(node != NULL)) {
+			CHECK(node->flags & NODE_F_SORTED);
+		}
+	}
+	for (i = 0; i < ARRAY_SIZE(plain); i++) {
+		node = node_from_path(plain[i]);
+		if (CHECK(node != NULL)) {
+			CHECK(i >= 3 || node->ext != 0);
+			CHECK(!(node->flags & NODE_F_SORTED));
+			CHECK(node_entry(node) == NULL);
+		}
+	}
+	node = node_from_path("/t/dir");
+	CHECK(node_entry_at(node, 0) == node_from_path("/t/dir/a"));
+	CHECK(node_entry_at(node, 2) == NULL);
+	CHECK(node_from_path("/t/file/inner") != NULL);
+	node_tree_destroy();
+}
+
+#define DEEP_LEVELS 40
+
+/*
+ * The path index maps every directory of a deep tree to its node, and it
+ * keeps doing so when node_tree_freeze() moves the nodes.
+ */
+static void check_index(const char *what)
+{
+	char path[DEEP_LEVELS * 8 + 32];
+	const lsnode_t *node;
+	size_t len = 0;
+	int i;
+
+	for (i = 0; i < DEEP_LEVELS; i++) {
+		/* entries of the directory of the level */
+		sprintf(&path[len], "/file%d", i);
+		node = node_from_path(path);
+		CHECK(node != NULL && node == node_lookup(node_get_root(),
+							  path));
+		sprintf(&path[len], "/s%d", i);
+		CHECK(node_from_path(path) != NULL);
+
+		len += (size_t)sprintf(&path[len], "/d%d", i);
+		node = node_lookup(node_get_root(), path);
+		if (!CHECK(node != NULL)) {
+			fprintf(stderr, "%s: %s isn't found\n", what, path);
+			return;
+		}
+		/* keys don't have the leading '/' */
+		CHECK(node_index_get(node_tree_index(), path + 1,
+				     len - 1) == node);
+		CHECK(node_from_path(path) == node);
+	}
+	CHECK(node_index_get(node_tree_index(), "d0/d1/file1", 11) == NULL);
+	CHECK(node_from_path("/d0/d1/missing") == NULL);
+}
+
+static void test_index(void)
+{
+	char *text = NULL;
+	size_t size = 0;
+	char path[DEEP_LEVELS * 8 + 32];
+	size_t len = 0;
+	FILE *out;
+	int i;
+
+	out = open_memstream(&text, &size);
+	if (!out) {
+		abort();
+	}
+	path[0] = '\0';
+	for (i = 0; i < DEEP_LEVELS; i++) {
+		/* headers of the siblings come first, names aren't sorted */
+		fprintf(out, "%s/s%d:\n\n", path, i);
+		fprintf(out, "%s:\n"
+			"drwxr-xr-x 2 root root 4096 Jan  1  2020 s%d\n"
+			"-rw-r--r-- 1 root root 1 Jan  1  2020 file%d\n"
+			"drwxr-xr-x 2 root root 4096 Jan  1  2020 d%d\n\n",
+			len == 0 ? "/" : path, i, i, i);
+		len += (size_t)sprintf(&path[len], "/d%d", i);
+	}
+	fclose(out);
+
+	CHECK(test_parse(text) == 0);
+	check_index("parsed");
+	CHECK(node_tree_freeze() == 0);
+	check_index("frozen");
+	CHECK(node_lookup(node_get_root(), "/d0")->flags & NODE_F_SORTED);
+	node_tree_destroy();
+	free(text);
+}
+
+int main(void)
+{
+	char *text = gen_listing();
+
+	/* names point to the mapped input */
+	CHECK(test_parse(text) == 0);
+	check_mem("mapped", false);
+	CHECK(node_tree_freeze() == 0);
+	CHECK(node_tree_sum() == 0);
+	check_mem("frozen", false);
+	test_filter();
+	node_tree_destroy();
+
+	/* names are copied to the arena */
+	CHECK(test_parse_stream(text) == 0);
+	check_mem("stream", true);
+	node_tree_destroy();
+
+	free(text);
+
+	test_freeze_dirs();
+	test_index();
+	srand(1);
+	test_sums();
+
+	return test_result();
+}
@@ -0,0 +1,814 @@
+/* test_parser.c
+ * ls-fuse - ls -lR output mounter
+ *
+ * Copyright (C) 2013 Dmitry Podgorny <pasis.ua@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <unistd.h>
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+#ifdef HAVE_BZLIB
+#include <bzlib.h>
+#endif
+#ifdef HAVE_LZMA
+#include <lzma.h>
+#endif
+
+#include "../src/lexer.h"
+#include "../src/node.h"
+#include "../src/options.h"
+#include "../src/parser.h"
+#include "../src/tools.h"
+#include "test.h"
+
+static const char listing_l[] =
+	"/srv:\n"
+	"total 16\n"
+	"drwxr-xr-x  2 root root 4096 Jan  1  2020 dir\n"
+	"-rw-r--r--  1 root root  123 Mar 15 10:30 file name\n"
+	"-rwsr-xr-x. 1 root root 5120 Feb 29  2016 suid\n"
+	"drwxrwxrwt+ 3 1000 1000 4096 Dec 31 23:59 tmp\n"
+	"lrwxrwxrwx  1 root root    4 Jan  1  2020 link -> file name\n"
+	"crw-rw----  1 root tty  4,  1 Jan  1  2020 tty1\n"
+	"brw-rw----  1 root disk 8,   0 Jan  1  2020 sda\n"
+	"\n"
+	"/srv/dir:\n"
+	"total 8\n"
+	"  4 -rw-------  1 nobody nogroup 2048 Jul  4  1999 blocks\n"
+	"  0 prw-r--r--  1 root root 0 Jul  4 12:00 fifo\n";
+
+static const char listing_toolbox[] =
+	"/system:\n"
+	"drwxr-xr-x root     root              2020-01-01 10:00 bin\n"
+	"-rw-r--r-- root     root         1234 2020-01-01 10:00 build.prop\n"
+	"lrwxrwxrwx root     root              2020-01-01 10:00 etc -> /etc\n"
+	"crw-rw---- system   radio      4,  64 2020-01-01 10:00 ttyS0\n"
+	"\n"
+	"/system/bin:\n"
+	"-rwxr-xr-x root     shell       12345 2019-12-31 23:59 sh\n";
+
+static const char listing_z[] =
+	"/home:\n"
+	"drwxr-xr-x. root root system_u:object_r:home_root_t:s0 user\n"
+	"-rw-r--r--. root root unconfined_u:object_r:user_home_t:s0 notes\n"
+	"lrwxrwxrwx. root root system_u:object_r:etc_t:s0 rc -> /etc/rc\n"
+	"\n"
+	"/home/user:\n"
+	"-rw-------. 1000 1000 unconfined_u:object_r:user_home_t:s0:c0 key\n";
+
+/* a block of several layouts, every line follows a line of another one */
+static const char listing_mixed[] =
+	"/mixed:\n"
+	"-rw-r--r--. root root system_u:object_r:etc_t:s0 z1\n"
+	"-rw-r--r-- 1 root root 123 Jan  1  2020 plain\n"
+	"-rw-r--r--. root root system_u:object_r:etc_t:s0 z2\n"
+	"-rw-r--r-- root     root          456 2020-01-01 10:00 tool\n"
+	"-rw-r--r--. root root system_u:object_r:etc_t:s0 z3\n"
+	"drwxr-xr-x root     root              2020-01-01 10:00 tooldir\n"
+	"-rw-r--r--. root root system_u:object_r:etc_t:s0 z4\n"
+	"   8 -rw-r--r-- 1 root root 789 Jan  1 10:00 sized\n"
+	"drwxr-xr-x root     root              2020-01-01 10:00 tooldir2\n"
+	"-rw-r--r-- 1 root root 321 Jan  1  2020 plain2\n"
+	"-rw-r--r-- root     root          654 2020-01-01 10:00 tool2\n";
+
+/* the same days and times in both formats, see test_time() */
+static const char listing_time[] =
+	"/t:\n"
+	"-rw-r--r-- 1 root root 1 Mar 15 10:30 recent\n"
+	"-rw-r--r-- 1 root root 1 Jan  1  2020 old\n"
+	"-rw-r--r-- 1 root root 1 Mar 14  2021 spring\n"
+	"-rw-r--r-- 1 root root 1 Nov  7  2021 fall\n"
+	"-rw-r--r-- root root 1 2020-01-01 10:00 tool\n"
+	"-rw-r--r-- root root 1 2021-03-14 03:30 tool_spring\n"
+	"-rw-r--r-- root root 1 2021-11-07 01:30 tool_fall\n"
+	"-rw-r--r-- root root 1 2021-07-01 12:00 tool_summer\n"
+	"-rw-r--r-- root root 1 2020-09-09 10:00 tool_slot\n";
+
+static char *parse_dump(const char *text, int regex)
+{
+	char *dump;
+
+	ls_opts.regex = regex;
+	CHECK(test_parse(text) == 0);
+	dump = test_dump();
+	node_tree_destroy();
+
+	return dump;
+}
+
+/* the lexer and the regexps build the same tree, see --regex */
+static void test_lexer_regex(const char *text, const char *expect)
+{
+	char *lexed = parse_dump(text, 0);
+	char *matched = parse_dump(text, 1);
+
+	CHECK(strstr(lexed, expect) != NULL);
+	if (!CHECK(strcmp(lexed, matched) == 0)) {
+		fprintf(stderr, "lexer:\n%sregex:\n%s", lexed, matched);
+	}
+	free(lexed);
+	free(matched);
+}
+
+/*
+ * The format of the previous line is tried first, see parse(). Whatever it
+ * is, a line must get the fields it gets in the default order.
+ */
+static void test_first_format(const char *text)
+{
+	regmatch_t expect[MATCH_NUM];
+	regmatch_t match[MATCH_NUM];
+	const char *line = text;
+	const char *end;
+	size_t len;
+	int first;
+	int fmt;
+	int i;
+
+	for (; *line != '\0'; line = end + 1) {
+		end = strchr(line, '\n');
+		len = (size_t)(end - line);
+		fmt = lex_line(line, len, expect, LS_FMT_L);
+		for (first = 0; first < LS_FMT_NUM; first++) {
+			if (!CHECK(lex_line(line, len, match, first) == fmt)) {
+				fprintf(stderr, "first %d: %.*s\n", first,
+					(int)len, line);
+				continue;
+			}
+			for (i = 0; fmt >= 0 && i < MATCH_NUM; i++) {
+				CHECK(match[i].rm_so == expect[i].rm_so &&
+				      match[i].rm_eo == expect[i].rm_eo);
+			}
+		}
+	}
+}
+
+/* a line of ls -l or toolbox after an ls -lZ line keeps its owner and size */
+static void test_mixed(void)
+{
+	char *dump;
+
+	test_first_format(listing_l);
+	test_first_format(listing_toolbox);
+	test_first_format(listing_z);
+	test_first_format(listing_mixed);
+
+	test_lexer_regex(listing_mixed, "/mixed/plain mode=100644 ");
+	dump = parse_dump(listing_mixed, 0);
+	CHECK(strstr(dump, "/mixed/plain mode=100644 uid=0 gid=0 size=123 "));
+	CHECK(strstr(dump, "/mixed/tool mode=100644 uid=0 gid=0 size=456 "));
+	CHECK(strstr(dump, "/mixed/tooldir mode=40755 uid=0 gid=0 "));
+	CHECK(strstr(dump, "/mixed/sized mode=100644 uid=0 gid=0 size=789 "));
+	CHECK(strstr(dump, "/mixed/z4 mode=100644 uid=0 gid=0 size=0 "));
+	free(dump);
+}
+
+/* time of the node in a dump of test_dump() */
+static long long dump_time(const char *dump, const char *path)
+{
+	const char *p = strstr(dump, path);
+
+	p = p ? strstr(p, " time=") : NULL;
+	if (!CHECK(p != NULL)) {
+		fprintf(stderr, "%s isn't found\n", path);
+		return -1;
+	}
+	return strtoll(p + 6, NULL, 10);
+}
+
+/*
+ * Time which mktime() gives for the fields of ls -l per line. The year of a
+ * recent file, which is 0 here, and DST come from the current time.
+ */
+static long long mktime_time(int year, int mon, int mday, int hour, int min)
+{
+	time_t now = time(NULL);
+	struct tm t;
+
+	localtime_r(&now, &t);
+	if (year != 0) {
+		t.tm_year = year - 1900;
+	}
+	t.tm_mon = mon;
+	t.tm_mday = mday;
+	t.tm_hour = hour;
+	t.tm_min = min;
+	t.tm_sec = 0;
+
+	return (long long)mktime(&t);
+}
+
+/* the same for a toolbox date, it doesn't depend on the current time */
+static long long mktime_toolbox(int year, int mon, int mday, int hour,
+				int min)
+{
+	struct tm t;
+
+	memset(&t, 0, sizeof(t));
+	t.tm_year = year - 1900;
+	t.tm_mon = mon;
+	t.tm_mday = mday;
+
+	return (long long)mktime(&t) + hour * 3600 + min * 60;
+}
+
+/*
+ * Cached days of the local time zone give what mktime() gives per line, also
+ * on the days of DST transitions. --tz gives pure UTC arithmetic.
+ */
+static void test_time(void)
+{
+	/* US rules, so the test doesn't need the time zone database */
+	static const char *zones[] = {"EST5EDT,M3.2.0,M11.1.0", "UTC0"};
+	static const char *bad_zones[] = {"+5:3x", "+1500", "+05:60", "EST",
+					  "", "+0530 "};
+	char *old_tz = getenv("TZ");
+	time_t now;
+	struct tm t;
+	char *dump;
+	size_t i;
+
+	old_tz = old_tz ? strdup(old_tz) : NULL;
+	for (i = 0; i < ARRAY_SIZE(zones); i++) {
+		setenv("TZ", zones[i], 1);
+		tzset();
+		dump = parse_dump(listing_time, 0);
+		CHECK(dump_time(dump, "/t/recent ") ==
+		      mktime_time(0, 2, 15, 10, 30));
+		CHECK(dump_time(dump, "/t/old ") ==
+		      mktime_time(2020, 0, 1, 0, 0));
+		CHECK(dump_time(dump, "/t/spring ") ==
+		      mktime_time(2021, 2, 14, 0, 0));
+		CHECK(dump_time(dump, "/t/fall ") ==
+		      mktime_time(2021, 10, 7, 0, 0));
+		CHECK(dump_time(dump, "/t/tool ") ==
+		      mktime_toolbox(2020, 0, 1, 10, 0));
+		CHECK(dump_time(dump, "/t/tool_spring ") ==
+		      mktime_toolbox(2021, 2, 14, 3, 30));
+		CHECK(dump_time(dump, "/t/tool_fall ") ==
+		      mktime_toolbox(2021, 10, 7, 1, 30));
+		CHECK(dump_time(dump, "/t/tool_summer ") ==
+		      mktime_toolbox(2021, 6, 1, 12, 0));
+		/* takes the slot of 2020-01-01 in the cache */
+		CHECK(dump_time(dump, "/t/tool_slot ") ==
+		      mktime_toolbox(2020, 8, 9, 10, 0));
+		free(dump);
+	}
+	if (old_tz) {
+		setenv("TZ", old_tz, 1);
+		free(old_tz);
+	} else {
+		unsetenv("TZ");
+	}
+	tzset();
+
+	/* 2020-01-01 10:00 is 1577872800 in UTC */
+	ls_opts.tz = "+0530";
+	dump = parse_dump(listing_time, 0);
+	CHECK(dump_time(dump, "/t/tool ") == 1577872800 - 19800);
+	CHECK(dump_time(dump, "/t/old ") == 1577836800 - 19800);
+	/* the year of a recent file is the current one in the zone */
+	now = time(NULL) + 19800;
+	gmtime_r(&now, &t);
+	t.tm_mon = 2;
+	t.tm_mday = 15;
+	t.tm_hour = 10;
+	t.tm_min = 30;
+	t.tm_sec = 0;
+	CHECK(dump_time(dump, "/t/recent ") ==
+	      (long long)timegm(&t) - 19800);
+	free(dump);
+
+	ls_opts.tz = "-0800";
+	dump = parse_dump(listing_time, 0);
+	CHECK(dump_time(dump, "/t/tool ") == 1577872800 + 28800);
+	CHECK(dump_time(dump, "/t/tool_summer ") == 1625140800 + 28800);
+	free(dump);
+
+	ls_opts.tz = "-08:00";
+	dump = parse_dump(listing_time, 0);
+	CHECK(dump_time(dump, "/t/tool ") == 1577872800 + 28800);
+	free(dump);
+
+	ls_opts.tz = "UTC";
+	dump = parse_dump(listing_time, 0);
+	CHECK(dump_time(dump, "/t/tool_spring ") == 1615692600);
+	free(dump);
+
+	for (i = 0; i < ARRAY_SIZE(bad_zones); i++) {
+		ls_opts.tz = (char *)bad_zones[i];
+		CHECK(test_parse(listing_time) == -EINVAL);
+		node_tree_destroy();
+	}
+	ls_opts.tz = NULL;
+}
+
+/*
+ * A listing of a few MiB, so the decompressed data spans several blocks.
+ * Toolbox dates don't depend on the current time, so trees of two parses are
+ * equal.
+ */
+static char *gen_listing(size_t *len)
+{
+	char *buf = NULL;
+	size_t size = 0;
+	FILE *out;
+	int i;
+	int j;
+
+	out = open_memstream(&buf, &size);
+	if (!out) {
+		abort();
+	}
+	for (i = 0; i < 100; i++) {
+		fprintf(out, "/big/d%d:\ntotal %d\n", i, i);
+		for (j = 0; j < 500; j++) {
+			fprintf(out, "-rw-r--r-- root root %d 2020-01-01 10:00 "
+				"file%d.%d\n", i * j, i, j);
+		}
+		fputc('\n', out);
+	}
+	fclose(out);
+	*len = size;
+
+	return buf;
+}
+
+static int parse_data(const char *data, size_t len)
+{
+	int err;
+
+	ls_opts.regex = 0;
+	err = test_parse_data(data, len);
+	node_tree_destroy();
+
+	return err;
+}
+
+/* two listings of the same directories, like two hosts give */
+static const char listing_merge1[] =
+	"/m:\n"
+	"-rw-r--r-- root root 100 2020-01-01 10:00 f\n"
+	"drwxr-xr-x root root 4096 2020-01-01 10:00 d\n"
+	"drwxr-xr-x root root 4096 2020-01-01 10:00 x\n"
+	"-rw-r--r-- root root 4 2022-01-01 10:00 y\n"
+	"-rw-r--r-- root root 1 2020-01-01 10:00 only1\n"
+	"\n"
+	"/m/d:\n"
+	"-rw-r--r-- root root 1 2020-01-01 10:00 in1\n"
+	"-rw-r--r-- root root 1 2020-01-01 10:00 both\n";
+
+static const char listing_merge2[] =
+	"/m:\n"
+	"-rw-r--r-- root root 200 2021-01-01 10:00 f\n"
+	"drwx------ root root 4096 2019-01-01 10:00 d\n"
+	"-rw-r--r-- root root 3 2022-01-01 10:00 x\n"
+	"drwxr-xr-x root root 4096 2020-01-01 10:00 y\n"
+	"-rw-r--r-- root root 2 2020-01-01 10:00 only2\n"
+	"\n"
+	"/m/d:\n"
+	"-rw-r--r-- root root 2 2021-01-01 10:00 both\n"
+	"-rw-r--r-- root root 1 2020-01-01 10:00 in2\n";
+
+/* parses the listings one after another as main() does with files */
+static char *parse_files_dump(const char *text1, const char *text2)
+{
+	char *path1 = test_tmpfile(text1, strlen(text1));
+	char *path2 = test_tmpfile(text2, strlen(text2));
+	char *dump = NULL;
+
+	if (CHECK(path1 != NULL && path2 != NULL) &&
+	    CHECK(parser_init() == 0)) {
+		CHECK(parse_file(path1) == 0);
+		CHECK(parse_file(path2) == 0);
+		parser_destroy();
+		dump = test_dump();
+		node_tree_destroy();
+	}
+	if (path1) {
+		unlink(path1);
+	}
+	if (path2) {
+		unlink(path2);
+	}
+	free(path1);
+	free(path2);
+
+	return dump;
+}
+
+static size_t count_str(const char *s, const char *sub)
+{
+	size_t n = 0;
+
+	while ((s = strstr(s, sub)) != NULL) {
+		++n;
+		++s;
+	}
+	return n;
+}
+
+/*
+ * An entry listed twice is a single node, its attributes come from the
+ * listing which the policy chooses. A directory wins over a file whatever
+ * the policy is, and entries of both listings of a directory are kept.
+ */
+static void test_merge_one(int merge, const char *f_size, const char *d_mode)
+{
+	static const char * const names[] = {"/m/f ", "/m/d ", "/m/x ",
+		"/m/y ", "/m/only1 ", "/m/only2 ", "/m/d/in1 ", "/m/d/in2 ",
+		"/m/d/both "};
+	char expect[64];
+	char *dump;
+	size_t i;
+
+	ls_opts.merge = merge;
+	dump = parse_files_dump(listing_merge1, listing_merge2);
+	ls_opts.merge = MERGE_LAST;
+	if (!dump) {
+		return;
+	}
+	for (i = 0; i < ARRAY_SIZE(names); i++) {
+		if (!CHECK(count_str(dump, names[i]) == 1)) {
+			fprintf(stderr, "merge %d: %s\n", merge, names[i]);
+		}
+	}
+	snprintf(expect, sizeof(expect), "/m/f mode=100644 uid=0 gid=0 "
+		 "size=%s ", f_size);
+	CHECK(strstr(dump, expect) != NULL);
+	snprintf(expect, sizeof(expect), "/m/d mode=%s ", d_mode);
+	CHECK(strstr(dump, expect) != NULL);
+	CHECK(strstr(dump, "/m/x mode=40755 ") != NULL);
+	CHECK(strstr(dump, "/m/y mode=40755 ") != NULL);
+	if (!CHECK(count_str(dump, "\n") == ARRAY_SIZE(names) + 1)) {
+		fprintf(stderr, "merge %d:\n%s", merge, dump);
+	}
+	free(dump);
+}
+
+static void test_merge(void)
+{
+	test_merge_one(MERGE_LAST, "200", "40700");
+	test_merge_one(MERGE_FIRST, "100", "40755");
+	/* f is newer in the second listing, d in the first one */
+	test_merge_one(MERGE_NEWEST, "200", "40755");
+}
+
+/* number of loaded entries of a directory of the lazy index */
+static size_t lazy_entries(const char *path)
+{
+	const lsnode_t *dir = node_lookup(node_get_root(), path);
+	const lsnode_t *node;
+	size_t n = 0;
+
+	if (!CHECK(dir != NULL)) {
+		return 0;
+	}
+	for (node = node_entry(dir); node != NULL; node = node_next(node)) {
+		++n;
+	}
+	return n;
+}
+
+/*
+ * Each directory takes more than a half of --lazy-mem=1 in nodes, while
+ * their names stay in the mapped file. Loading two of them drops the one
+ * which was used the longest ago.
+ */
+static void test_lazy(void)
+{
+	char *buf = NULL;
+	size_t size = 0;
+	char *path;
+	FILE *out;
+	int i;
+	int j;
+
+	out = open_memstream(&buf, &size);
+	if (!out) {
+		abort();
+	}
+	for (i = 0; i < 3; i++) {
+		fprintf(out, "/lazy/%c:\n", 'a' + i);
+		for (j = 0; j < 20000; j++) {
+			fprintf(out, "-rw-r--r-- root root 1 2020-01-01 10:00 "
+				"f%d\n", j);
+		}
+		fputc('\n', out);
+	}
+	fclose(out);
+	path = test_tmpfile(buf, size);
+	free(buf);
+	if (!CHECK(path != NULL)) {
+		return;
+	}
+
+	ls_opts.lazy = 1;
+	ls_opts.lazy_mem = 1;
+	CHECK(parser_init() == 0);
+	CHECK(parse_file(path) == 0);
+	CHECK(lazy_entries("/lazy/a") == 0);
+
+	CHECK(node_from_path("/lazy/a/f19999") != NULL);
+	CHECK(lazy_entries("/lazy/a") == 20000);
+	CHECK(node_from_path("/lazy/b/f0") != NULL);
+	CHECK(lazy_entries("/lazy/a") == 0);
+	CHECK(lazy_entries("/lazy/b") == 20000);
+
+	/* a is parsed again from the mapped file, b is dropped now */
+	CHECK(node_from_path("/lazy/a/f1") != NULL);
+	CHECK(lazy_entries("/lazy/a") == 20000);
+	CHECK(lazy_entries("/lazy/b") == 0);
+	CHECK(lazy_entries("/lazy/c") == 0);
+
+	parser_destroy();
+	node_tree_destroy();
+	node_set_loader(NULL);
+	ls_opts.lazy = 0;
+	ls_opts.lazy_mem = 0;
+	unlink(path);
+	free(path);
+}
+
+/* waits until the background parser gets to the path, 10 s at most */
+static lsnode_t *bg_node(const char *path)
+{
+	lsnode_t *node = NULL;
+	int i;
+
+	for (i = 0; i < 10000; i++) {
+		node_tree_rdlock();
+		node = node_from_path(path);
+		node_tree_unlock();
+		if (node) {
+			break;
+		}
+		usleep(1000);
+	}
+	return node;
+}
+
+static bool bg_done(void)
+{
+	char status[256];
+	int i;
+
+	for (i = 0; i < 10000; i++) {
+		node_tree_rdlock();
+		parser_status(status, sizeof(status));
+		node_tree_unlock();
+		if (strstr(status, "state: done\n")) {
+			return true;
+		}
+		usleep(1000);
+	}
+	return false;
+}
+
+/*
+ * --progressive: the tree grows while input comes from a pipe. A directory is
+ * NODE_F_DONE once the next header or the end of input is parsed, and
+ * parser_wait_dir() waits for that.
+ */
+static void test_bg(void)
+{
+	static const char part1[] =
+		"/bg/a:\n"
+		"-rw-r--r-- root root 1 2020-01-01 10:00 f1\n"
+		"\n"
+		"/bg/b:\n"
+		"-rw-r--r-- root root 1 2020-01-01 10:00 f2\n";
+	static const char part2[] =
+		"-rw-r--r-- root root 1 2020-01-01 10:00 f3\n"
+		"\n"
+		"/bg/c:\n"
+		"-rw-r--r-- root root 1 2020-01-01 10:00 f4";
+	char status[256];
+	lsnode_t *a;
+	lsnode_t *b;
+	lsnode_t *c;
+	int fds[2];
+
+	if (!CHECK(pipe(fds) == 0)) {
+		return;
+	}
+	CHECK(parser_init() == 0);
+	parse_fd_bg(fds[0]);
+	parser_bg_start();
+
+	CHECK(write(fds[1], part1, sizeof(part1) - 1) ==
+	      (ssize_t)sizeof(part1) - 1);
+	CHECK(bg_node("/bg/b/f2") != NULL);
+	node_tree_rdlock();
+	a = node_from_path("/bg/a");
+	b = node_from_path("/bg/b");
+	CHECK(a != NULL && (a->flags & NODE_F_DONE));
+	CHECK(node_from_path("/bg/a/f1") != NULL);
+	/* more entries of b may follow */
+	CHECK(b != NULL && !(b->flags & NODE_F_DONE));
+	parser_status(status, sizeof(status));
+	CHECK(strstr(status, "state: parsing\n") != NULL);
+	node_tree_unlock();
+
+	CHECK(write(fds[1], part2, sizeof(part2) - 1) ==
+	      (ssize_t)sizeof(part2) - 1);
+	close(fds[1]);
+	/* returns when the header of c or the end of input is parsed */
+	parser_wait_dir("/bg/b");
+	node_tree_rdlock();
+	CHECK(b != NULL && (b->flags & NODE_F_DONE));
+	CHECK(node_from_path("/bg/b/f3") != NULL);
+	node_tree_unlock();
+
+	CHECK(bg_done());
+	node_tree_rdlock();
+	c = node_from_path("/bg/c");
+	CHECK(c != NULL && (c->flags & NODE_F_DONE));
+	/* the last line isn't terminated */
+	CHECK(node_from_path("/bg/c/f4") != NULL);
+	parser_status(status, sizeof(status));
+	CHECK(strstr(status, "error: none\n") != NULL);
+	node_tree_unlock();
+
+	parser_destroy();
+	node_tree_destroy();
+}
+
+#if defined(HAVE_ZLIB) || defined(HAVE_BZLIB) || defined(HAVE_LZMA)
+/*
+ * Compressors of the decomp tests. They return length of the compressed data
+ * or 0 on error.
+ */
+typedef size_t (*compress_t)(const char *in, size_t len, char *out,
+			     size_t size);
+
+#ifdef HAVE_ZLIB
+static size_t compress_gzip(const char *in, size_t len, char *out, size_t size)
+{
+	z_stream z;
+	size_t out_len = 0;
+
+	memset(&z, 0, sizeof(z));
+	/* 16 writes a gzip header instead of the zlib one */
+	if (deflateInit2(&z, 6, Z_DEFLATED, 15 + 16, 8,
+			 Z_DEFAULT_STRATEGY) != Z_OK) {
+		return 0;
+	}
+	z.next_in = (Bytef *)in;
+	z.avail_in = (uInt)len;
+	z.next_out = (Bytef *)out;
+	z.avail_out = (uInt)size;
+	if (deflate(&z, Z_FINISH) == Z_STREAM_END) {
+		out_len = (size_t)z.total_out;
+	}
+	deflateEnd(&z);
+
+	return out_len;
+}
+#endif
+
+#ifdef HAVE_BZLIB
+static size_t compress_bzip2(const char *in, size_t len, char *out,
+			     size_t size)
+{
+	unsigned int out_len = (unsigned int)size;
+
+	return BZ2_bzBuffToBuffCompress(out, &out_len, (char *)in,
+					(unsigned int)len, 1, 0, 0) == BZ_OK ?
+	       out_len : 0;
+}
+#endif
+
+#ifdef HAVE_LZMA
+static size_t compress_xz(const char *in, size_t len, char *out, size_t size)
+{
+	size_t out_len = 0;
+
+	return lzma_easy_buffer_encode(1, LZMA_CHECK_CRC64, NULL,
+				       (const uint8_t *)in, len,
+				       (uint8_t *)out, &out_len,
+				       size) == LZMA_OK ? out_len : 0;
+}
+#endif
+
+/*
+ * A compressed listing gives the tree of the plain one. Truncated or corrupted
+ * data is an error rather than a silently shorter tree.
+ */
+static void test_decomp_one(const char *name, compress_t compress,
+			    const char *text, size_t len, const char *plain)
+{
+	size_t size = len + 4096;
+	char *buf = malloc(size);
+	size_t half;
+	size_t n;
+	size_t m;
+	char *dump;
+
+	if (!buf) {
+		abort();
+	}
+	n = compress(text, len, buf, size);
+	if (!CHECK(n > 0)) {
+		free(buf);
+		return;
+	}
+
+	CHECK(test_parse_data(buf, n) == 0);
+	dump = test_dump();
+	node_tree_destroy();
+	if (!CHECK(strcmp(dump, plain) == 0)) {
+		fprintf(stderr, "%s: the tree differs\n", name);
+	}
+	free(dump);
+
+	/* concatenated streams, split in the middle of a line */
+	half = len / 2 + 7;
+	n = compress(text, half, buf, size);
+	m = n == 0 ? 0 : compress(text + half, len - half, buf + n, size - n);
+	if (CHECK(n > 0 && m > 0)) {
+		CHECK(test_parse_data(buf, n + m) == 0);
+		dump = test_dump();
+		node_tree_destroy();
+		if (!CHECK(strcmp(dump, plain) == 0)) {
+			fprintf(stderr, "%s: concatenated streams differ\n",
+				name);
+		}
+		free(dump);
+	}
+
+	n = compress(text, len, buf, size);
+	CHECK(parse_data(buf, n / 2) == -EIO);
+	buf[n / 2] ^= 0x55;
+	buf[n / 2 + 1] ^= 0xaa;
+	CHECK(parse_data(buf, n) == -EIO);
+
+	free(buf);
+}
+#endif
+
+static void test_decomp(void)
+{
+	size_t len;
+	char *text = gen_listing(&len);
+	char *plain;
+
+	ls_opts.regex = 0;
+	CHECK(test_parse_data(text, len) == 0);
+	plain = test_dump();
+	node_tree_destroy();
+	CHECK(strstr(plain, "/big/d99/file99.499 mode=100644 ") != NULL);
+
+#ifdef HAVE_ZLIB
+	test_decomp_one("gzip", compress_gzip, text, len, plain);
+#endif
+#ifdef HAVE_BZLIB
+	test_decomp_one("bzip2", compress_bzip2, text, len, plain);
+#endif
+#ifdef HAVE_LZMA
+	test_decomp_one("xz", compress_xz, text, len, plain);
+#endif
+#ifndef HAVE_ZSTD
+	/* the format is detected, but can't be decompressed */
+	CHECK(parse_data("\x28\xb5\x2f\xfd", 4) == -ENOTSUP);
+#endif
+
+	free(plain);
+	free(text);
+}
+
+int main(void)
+{
+	test_lexer_regex(listing_l, "/srv/file name mode=100644 ");
+	test_lexer_regex(listing_toolbox, "/system/bin/sh mode=100755 ");
+	test_lexer_regex(listing_z, "/home/user/key mode=100600 ");
+	test_mixed();
+	test_time();
+	test_merge();
+	test_lazy();
+	test_bg();
+	test_decomp();
+
+	return test_result();
+}
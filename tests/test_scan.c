@@ -0,0 +1,137 @@
+/* test_scan.c
+ * ls-fuse - ls -lR output mounter
+ *
+ * Copyright (C) 2013 Dmitry Podgorny <pasis.ua@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../src/scan.h"
+#include "../src/tools.h"
+#include "test.h"
+
+#define TEST_LEN 256
+
+/*
+ * Buffers end right before a page that can't be read, so an implementation
+ * that loads past the end of its buffer crashes the test.
+ */
+static char *guarded_page(void)
+{
+	long page = sysconf(_SC_PAGESIZE);
+	char *p;
+
+	p = mmap(NULL, (size_t)page * 2, PROT_READ | PROT_WRITE,
+		 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (p == MAP_FAILED || mprotect(p + page, (size_t)page, PROT_NONE)) {
+		perror("mmap");
+		exit(1);
+	}
+	return p + page;
+}
+
+static void fill(char *buf, size_t len, const char *chars, size_t nchars)
+{
+	size_t i;
+
+	for (i = 0; i < len; i++) {
+		buf[i] = chars[(size_t)rand() % nchars];
+	}
+}
+
+/* every implementation must return what the scalar one returns */
+static void test_impls(const struct scan_impl *impls, size_t n,
+		       const char *buf)
+{
+	const struct scan_impl *ref = &impls[0];
+	const char *s;
+	size_t i, len;
+
+	for (len = 0; len <= TEST_LEN; len++) {
+		s = buf - len;
+		for (i = 1; i < n; i++) {
+			if (!CHECK(impls[i].eol(s, len) == ref->eol(s, len)) ||
+			    !CHECK(impls[i].spaces(s, len) ==
+				   ref->spaces(s, len))) {
+				fprintf(stderr, "%s, length %zu\n",
+					impls[i].name, len);
+				return;
+			}
+		}
+	}
+}
+
+static void test_scalar(const struct scan_impl *ref, char *end)
+{
+	char *s = end - 70;
+	size_t i;
+
+	fill(s, 70, "a", 1);
+	CHECK(ref->eol(s, 70) == 70);
+	CHECK(ref->spaces(s, 70) == 0);
+	s[69] = '\r';
+	s[40] = '\n';
+	CHECK(ref->eol(s, 70) == 40);
+	CHECK(ref->eol(s, 40) == 40);
+	s[0] = ' ';
+	s[63] = '\t';
+	s[64] = ' ';
+	CHECK(ref->spaces(s, 70) == (((uint64_t)1 << 63) | 1));
+	CHECK(ref->spaces(s, 63) == 1);
+	for (i = 0; i < 70; i++) {
+		s[i] = ' ';
+	}
+	CHECK(ref->spaces(s, 70) == UINT64_MAX);
+	CHECK(ref->spaces(s, 5) == 0x1f);
+}
+
+int main(void)
+{
+	/* sparse and dense line ends and spaces */
+	static const char * const sets[] = {
+		"abcdefghijklmnopqrstuvwxyz0123456789 \t\n",
+		"abcdefghijklmnopqrstuvwxyz0123456789 \t\r",
+		"abcdefghijklmnopqrstuvwxyz0123456789 ",
+		"a \t\n\r",
+		"a ",
+	};
+	const struct scan_impl *impls;
+	char *end = guarded_page();
+	size_t n, i, round;
+
+	n = scan_impls(&impls);
+	for (i = 0; i < n; i++) {
+		printf("testing %s\n", impls[i].name);
+	}
+
+	srand(1);
+	test_scalar(&impls[0], end);
+	for (i = 0; i < ARRAY_SIZE(sets); i++) {
+		for (round = 0; round < 64; round++) {
+			fill(end - TEST_LEN, TEST_LEN, sets[i],
+			     strlen(sets[i]));
+			test_impls(impls, n, end);
+		}
+	}
+
+	return test_result();
+}
@@ -0,0 +1,282 @@
+/* test_search.c
+ * ls-fuse - ls -lR output mounter
+ *
+ * Copyright (C) 2013 Dmitry Podgorny <pasis.ua@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <sys/stat.h>
+
+#include <errno.h>
+#include <fnmatch.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../src/node.h"
+#include "../src/search.h"
+#include "../src/tools.h"
+#include "test.h"
+
+/* names are made of these, some of them are special in patterns */
+static const char * const parts[] = {
+	"ab", "abc", "x", "readme", ".c", ".txt", "foo", "bar", "*", "[1]",
+	"?", "-",
+};
+
+static const char * const patterns[] = {
+	"foo", "abc.c", "readme", "*", "*.c", "ab*", "*bar*", "?b*",
+	"[ax]*", "*[!c]", "a\\*", "\\[1\\]*", "*abc*x", "x", "missing",
+	"*.txt", "*[[]1]*", "foo?", "[!a-z]*", "*c.c",
+};
+
+/* names of the whole tree that match, one full path per line */
+typedef struct {
+	char *buf;
+	size_t len;
+	size_t size;
+} paths_t;
+
+static void paths_add(paths_t *p, const char *path, size_t len)
+{
+	void *tmp;
+
+	tmp = grow(p->buf, &p->size, p->len + len + 1, 1);
+	if (!tmp) {
+		perror("realloc");
+		exit(1);
+	}
+	p->buf = tmp;
+	memcpy(&p->buf[p->len], path, len);
+	p->buf[p->len + len] = '\n';
+	p->len += len + 1;
+}
+
+/* fnmatch() of every name of the tree */
+static void naive_search(const lsnode_t *dir, const char *pattern,
+			 char *path, size_t len, paths_t *p)
+{
+	const lsnode_t *node;
+	size_t n;
+
+	for (node = node_entry(dir); node != NULL; node = node_next(node)) {
+		if (node->name == NULL || is_dot(node->name, node->name_len)) {
+			continue;
+		}
+		n = len + 1 + node->name_len;
+		path[len] = '/';
+		memcpy(&path[len + 1], node->name, node->name_len);
+		path[n] = '\0';
+		if (fnmatch(pattern, &path[len + 1], 0) == 0) {
+			paths_add(p, path, n);
+		}
+		if (S_ISDIR(node->mode)) {
+			naive_search(node, pattern, path, n, p);
+		}
+	}
+}
+
+static int line_cmp(const void *a, const void *b)
+{
+	return strcmp(*(char * const *)a, *(char * const *)b);
+}
+
+/* splits the buffer to sorted lines, the buffer is changed */
+static char **sorted_lines(char *buf, size_t len, size_t *num)
+{
+	char **lines;
+	size_t n = 0;
+	size_t i;
+	char *s = buf;
+
+	for (i = 0; i < len; i++) {
+		n += buf[i] == '\n';
+	}
+	lines = malloc((n + 1) * sizeof(*lines));
+	if (!lines) {
+		perror("malloc");
+		exit(1);
+	}
+	for (n = 0, i = 0; i < len; i++) {
+		if (buf[i] == '\n') {
+			buf[i] = '\0';
+			lines[n++] = s;
+			s = &buf[i + 1];
+		}
+	}
+	qsort(lines, n, sizeof(*lines), line_cmp);
+	*num = n;
+
+	return lines;
+}
+
+/* reads the result in pieces, returns -errno or its length */
+static long long read_result(long id, char **out)
+{
+	long long len = search_read(id, NULL, 0, 0);
+	long long off;
+	long long n;
+	char *buf;
+
+	if (len < 0) {
+		return len;
+	}
+	buf = malloc((size_t)len + 1);
+	if (!buf) {
+		perror("malloc");
+		exit(1);
+	}
+	for (off = 0; off < len; off += 1000) {
+		n = search_read(id, &buf[off], 1000, off);
+		if (n != len) {
+			free(buf);
+			return n < 0 ? n : -EIO;
+		}
+	}
+	*out = buf;
+
+	return len;
+}
+
+static bool same_paths(char *a, size_t a_len, char *b, size_t b_len)
+{
+	char **la, **lb;
+	size_t na, nb, i;
+	bool same;
+
+	la = sorted_lines(a, a_len, &na);
+	lb = sorted_lines(b, b_len, &nb);
+	same = na == nb;
+	for (i = 0; same && i < na; i++) {
+		same = strcmp(la[i], lb[i]) == 0;
+	}
+	free(la);
+	free(lb);
+
+	return same;
+}
+
+static void check_pattern(const char *pattern)
+{
+	static char path[64 * 1024];
+	paths_t naive = {0};
+	char *result = NULL;
+	long long len;
+	long id;
+
+	naive_search(node_get_root(), pattern, path, 0, &naive);
+	id = search_query(pattern);
+	CHECK(id >= 0);
+	CHECK(search_query(pattern) == id);
+	len = read_result(id, &result);
+	if (!CHECK(len == (long long)naive.len) ||
+	    !CHECK(same_paths(result, (size_t)len, naive.buf, naive.len))) {
+		fprintf(stderr, "pattern %s\n", pattern);
+	}
+	free(result);
+	free(naive.buf);
+}
+
+/* writes blocks of a random tree, names repeat across directories */
+static void gen_tree(FILE *out, const char *path, unsigned int depth)
+{
+	unsigned int n = (unsigned int)rand() % 20;
+	char name[32];
+	char child[4096];
+	unsigned int i, k, m;
+	char subs[20][40];
+	unsigned int nsub = 0;
+
+	fprintf(out, "%s:\ntotal 0\n"
+		"drwxr-xr-x 2 root root 4096 Jan  1  2020 .\n"
+		"drwxr-xr-x 2 root root 4096 Jan  1  2020 ..\n", path);
+	for (i = 0; i < n; i++) {
+		name[0] = '\0';
+		m = 1 + (unsigned int)rand() % 3;
+		for (k = 0; k < m; k++) {
+			strcat(name, parts[(size_t)rand() % ARRAY_SIZE(parts)]);
+		}
+		if (depth < 4 && rand() % 4 == 0) {
+			snprintf(subs[nsub], sizeof(subs[0]), "%s%u", name, i);
+			fprintf(out, "drwxr-xr-x 2 root root 4096 Jan  1  2020 "
+				"%s\n", subs[nsub++]);
+		} else {
+			fprintf(out, "-rw-r--r-- 1 root root 0 Jan  1  2020 "
+				"%s\n", name);
+		}
+	}
+	for (i = 0; i < nsub; i++) {
+		snprintf(child, sizeof(child), "%s/%s", path, subs[i]);
+		fprintf(out, "\n");
+		gen_tree(out, child, depth + 1);
+	}
+}
+
+/* old queries are replaced, their ids aren't given to new ones */
+static void test_replaced(void)
+{
+	char pattern[32];
+	char *result = NULL;
+	long first, id;
+	int i;
+
+	first = search_query("*.c");
+	for (i = 0; i < 100; i++) {
+		snprintf(pattern, sizeof(pattern), "*%d*", i);
+		id = search_query(pattern);
+		CHECK(id > first);
+		/* results of a few of them are kept */
+		CHECK(search_read(id, NULL, 0, 0) >= 0);
+	}
+	CHECK(search_read(first, NULL, 0, 0) == -ESTALE);
+	id = search_query("*.c");
+	CHECK(id != first);
+	CHECK(read_result(id, &result) >= 0);
+	free(result);
+}
+
+int main(void)
+{
+	char *text;
+	size_t size;
+	FILE *out;
+	size_t i;
+	int round;
+
+	srand(1);
+	for (round = 0; round < 10; round++) {
+		out = open_memstream(&text, &size);
+		if (out == NULL) {
+			perror("open_memstream");
+			return 1;
+		}
+		gen_tree(out, "/t", 0);
+		fclose(out);
+
+		CHECK(test_parse(text) == 0);
+		CHECK(node_tree_freeze() == 0);
+		CHECK(search_build() == 0);
+		/* twice, the second time results are found in the cache */
+		for (i = 0; i < ARRAY_SIZE(patterns) * 2; i++) {
+			check_pattern(patterns[i % ARRAY_SIZE(patterns)]);
+		}
+		test_replaced();
+		search_destroy();
+		node_tree_destroy();
+		free(text);
+	}
+
+	return test_result();
+}